@@ -0,0 +1,207 @@
+/* JSON throughput: `make bench`, or bench/json_bench FILE...
+
+   Each file is parsed (as one document, or one per line when its name
+   ends in .ndjson) and the result stringified again, repeatedly, from
+   memory; rates are MB of JSON text per second. Files over 64 MB are
+   streamed instead: read in 256 KB pieces cut at the last newline and
+   parsed line by line, next to a pass that only reads the file, which is
+   the bound to compare against. Small pieces keep the values built from
+   one piece in cache; much larger ones run at half the speed. */
+
+#include "json.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MIN_SECONDS  0.5
+#define STREAM_OVER  (64u << 20)
+#define PIECE        (256u << 10)
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static double mb_per_s(size_t bytes, double seconds) {
+    return (double)bytes / (1 << 20) / seconds;
+}
+
+static bool ends_with(const char *s, const char *suffix) {
+    size_t n = strlen(s);
+    size_t m = strlen(suffix);
+    return n >= m && strcmp(s + n - m, suffix) == 0;
+}
+
+static bool parse(Value text, bool lines, Value *out) {
+    char err[160];
+    bool ok = lines ? json_parse_lines(text, out, err, sizeof(err))
+                    : json_parse(text, out, err, sizeof(err));
+    if (!ok) {
+        fprintf(stderr, "%s\n", err);
+    }
+    return ok;
+}
+
+static int bench_memory(const char *path, bool lines) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return 1;
+    }
+    fseek(f, 0, SEEK_END);
+    size_t n = (size_t)ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    Value text = value_string_alloc(n);
+    if (fread(text.as.str_val.buf->bytes, 1, n, f) != n) {
+        perror(path);
+        fclose(f);
+        return 1;
+    }
+    fclose(f);
+
+    Value v;
+    size_t rounds = 0;
+    double start = now();
+    double parse_s;
+    do {
+        if (rounds > 0) {
+            value_free(v);
+        }
+        if (!parse(text, lines, &v)) {
+            return 1;
+        }
+        rounds++;
+    } while ((parse_s = now() - start) < MIN_SECONDS);
+    double parse_rate = mb_per_s(n * rounds, parse_s);
+
+    Value out;
+    const char *err;
+    size_t out_bytes = 0;
+    rounds = 0;
+    start = now();
+    double stringify_s;
+    do {
+        if (!json_stringify(v, &out, &err)) {
+            fprintf(stderr, "%s\n", err);
+            return 1;
+        }
+        out_bytes += out.as.str_val.len;
+        value_free(out);
+        rounds++;
+    } while ((stringify_s = now() - start) < MIN_SECONDS);
+
+    printf("%-32s %10zu bytes  parse %8.1f MB/s  stringify %8.1f MB/s\n",
+           path, n, parse_rate, mb_per_s(out_bytes, stringify_s));
+    value_free(v);
+    value_free(text);
+    return 0;
+}
+
+/* One pass over the file in pieces; with parse, each piece up to its
+   last newline is parsed and the rest carried into the next one. */
+static int stream_pass(const char *path, bool parse_lines, size_t *bytes,
+                       size_t *values) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return 1;
+    }
+
+    /* pieces are parsed as views of one buffer, never copied */
+    Value whole = value_string_alloc(PIECE * 2);
+    char *buf = whole.as.str_val.buf->bytes;
+    size_t carry = 0;
+    int status = 0;
+    *bytes = 0;
+    *values = 0;
+
+    for (;;) {
+        ssize_t got = read(fd, buf + carry, PIECE);
+        if (got < 0) {
+            perror(path);
+            status = 1;
+            break;
+        }
+        *bytes += (size_t)got;
+        size_t have = carry + (size_t)got;
+        size_t cut = have;
+        if (got > 0) {
+            while (cut > 0 && buf[cut - 1] != '\n') cut--;
+        }
+        if (cut == 0 && have > PIECE) {
+            fprintf(stderr, "%s: line longer than %u bytes\n", path, PIECE);
+            status = 1;
+            break;
+        }
+
+        if (parse_lines && cut > 0) {
+            Value text = value_string_view(whole, 0, cut);
+            Value v;
+            if (!parse(text, true, &v)) {
+                value_free(text);
+                status = 1;
+                break;
+            }
+            *values += v.as.array_val->count;
+            value_free(v);
+            value_free(text);
+        }
+        memmove(buf, buf + cut, have - cut);
+        carry = have - cut;
+        if (got == 0) {
+            break;
+        }
+    }
+
+    value_free(whole);
+    close(fd);
+    return status;
+}
+
+static int bench_stream(const char *path) {
+    size_t bytes;
+    size_t values;
+
+    double start = now();
+    if (stream_pass(path, false, &bytes, &values) != 0) {
+        return 1;
+    }
+    double read_s = now() - start;
+
+    start = now();
+    if (stream_pass(path, true, &bytes, &values) != 0) {
+        return 1;
+    }
+    double parse_s = now() - start;
+
+    printf("%-32s %10zu bytes  read %8.1f MB/s  read+parse %8.1f MB/s  "
+           "(%zu values)\n", path, bytes, mb_per_s(bytes, read_s),
+           mb_per_s(bytes, parse_s), values);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int status = 0;
+
+    for (int i = 1; i < argc; i++) {
+        struct stat st;
+        if (stat(argv[i], &st) != 0) {
+            perror(argv[i]);
+            status = 1;
+            continue;
+        }
+        bool lines = ends_with(argv[i], ".ndjson");
+        if (lines && (size_t)st.st_size > STREAM_OVER) {
+            status |= bench_stream(argv[i]);
+        } else {
+            status |= bench_memory(argv[i], lines);
+        }
+    }
+    return status;
+}
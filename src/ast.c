@@ -1,4 +1,5 @@
 #include "ast.h"
+#include "format.h"
 #include <stdlib.h>
 
 /* =========================
@@ -18,6 +19,7 @@ static void expr_free(Expr *expr) {
     switch (expr->kind) {
 
         case EXPR_STRING:
+        case EXPR_BIGINT:
             free(expr->as.string.data);
             break;
 
@@ -32,12 +34,22 @@ static void expr_free(Expr *expr) {
             free(expr->as.array.items);
             break;
 
+        case EXPR_MAP:
+            for (size_t i = 0; i < expr->as.map.count; i++) {
+                expr_free(expr->as.map.keys[i]);
+                expr_free(expr->as.map.values[i]);
+            }
+            free(expr->as.map.keys);
+            free(expr->as.map.values);
+            break;
+
         case EXPR_CALL:
             free(expr->as.call.callee);
             for (size_t i = 0; i < expr->as.call.argc; i++) {
                 expr_free(expr->as.call.args[i]);
             }
             free(expr->as.call.args);
+            format_free(expr->as.call.format);
             break;
 
         case EXPR_INDEX:
@@ -45,6 +57,11 @@ static void expr_free(Expr *expr) {
             expr_free(expr->as.index.index);
             break;
 
+        case EXPR_FIELD:
+            expr_free(expr->as.field.base);
+            free(expr->as.field.name);
+            break;
+
         case EXPR_UNARY:
             expr_free(expr->as.unary.rhs);
             break;
@@ -76,6 +93,11 @@ static void stmt_free(Stmt *stmt) {
             expr_free(stmt->as.assign.value);
             break;
 
+        case STMT_INDEX_ASSIGN:
+            expr_free(stmt->as.index_assign.target);
+            expr_free(stmt->as.index_assign.value);
+            break;
+
         case STMT_EXPR:
             expr_free(stmt->as.expr.expr);
             break;
@@ -116,6 +138,15 @@ static void stmt_free(Stmt *stmt) {
             free(stmt->as.fn_def.body);
             break;
 
+        case STMT_RECORD:
+            /* the shape outlives the AST; values may still point at it */
+            free(stmt->as.record.name);
+            for (size_t i = 0; i < stmt->as.record.field_count; i++) {
+                free(stmt->as.record.fields[i]);
+            }
+            free(stmt->as.record.fields);
+            break;
+
         case STMT_RETURN:
             expr_free(stmt->as.return_stmt.value);
             break;
@@ -7,6 +7,8 @@
 /* Forward declarations */
 typedef struct Expr Expr;
 typedef struct Stmt Stmt;
+struct Shape;
+struct Format;
 
 /* =========================
    EXPRESSIONS
@@ -14,12 +16,15 @@ typedef struct Stmt Stmt;
 
 typedef enum {
     EXPR_INT,
+    EXPR_BIGINT,
     EXPR_BOOL, 
     EXPR_STRING,
     EXPR_VAR,
     EXPR_ARRAY,
+    EXPR_MAP,
     EXPR_CALL,
     EXPR_INDEX,
+    EXPR_FIELD,
     EXPR_UNARY,
     EXPR_BINARY
 } ExprKind;
@@ -53,6 +58,8 @@ struct Expr {
         int64_t int_val;
         int bool_val; 
         
+        /* EXPR_STRING, and EXPR_BIGINT: the digits of an integer
+           literal past the int64_t range. */
         struct {
             char *data;
             size_t len;
@@ -67,10 +74,20 @@ struct Expr {
             size_t count;
         } array;
 
+        struct {
+            Expr **keys;
+            Expr **values;
+            size_t count;
+        } map;
+
+        /* format is the compiled format string of a format() call,
+           an opaque handle from format.h kept here by the interpreter
+           and freed with the node. */
         struct {
             char *callee;
             Expr **args;
             size_t argc;
+            struct Format *format;
         } call;
 
         struct {
@@ -78,6 +95,15 @@ struct Expr {
             Expr *index;
         } index;
 
+        /* base.name; the last shape seen here and its slot are cached
+           so repeated access skips the field-name lookup. */
+        struct {
+            Expr *base;
+            char *name;
+            const struct Shape *cache_shape;
+            size_t cache_slot;
+        } field;
+
         struct {
             UnOp op;
             Expr *rhs;
@@ -98,10 +124,12 @@ struct Expr {
 
 typedef enum {
     STMT_ASSIGN,
+    STMT_INDEX_ASSIGN,
     STMT_EXPR,
     STMT_IF,
     STMT_DO,
     STMT_FNDEF,
+    STMT_RECORD,
     STMT_RETURN
 } StmtKind;
 
@@ -116,6 +144,11 @@ struct Stmt {
             Expr *value;
         } assign;
 
+        struct {
+            Expr *target;   /* EXPR_INDEX or EXPR_FIELD */
+            Expr *value;
+        } index_assign;
+
         struct {
             Expr *expr;
         } expr;
@@ -146,6 +179,13 @@ struct Stmt {
             size_t body_count;
         } fn_def;
 
+        struct {
+            char *name;
+            char **fields;
+            size_t field_count;
+            struct Shape *shape;   /* created on first evaluation */
+        } record;
+
         struct {
             Expr *value;
         } return_stmt;
@@ -0,0 +1,416 @@
+#include "batch.h"
+#include "error.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define RING_ENTRIES 256
+#define RING_FILES   RING_ENTRIES         /* files per window */
+#define RING_READ_MAX (1u << 30)          /* larger files finish with pread */
+#define MAX_THREADS  8
+
+/* =========================
+   Thread pool
+   ========================= */
+
+typedef struct {
+    void (*fn)(void *ctx, size_t i);
+    void *ctx;
+    size_t count;
+    size_t next;   /* next index to hand out */
+} Work;
+
+static void *worker(void *arg) {
+    Work *w = (Work *)arg;
+
+    for (;;) {
+        size_t i = __atomic_fetch_add(&w->next, 1, __ATOMIC_RELAXED);
+        if (i >= w->count) {
+            return NULL;
+        }
+        w->fn(w->ctx, i);
+    }
+}
+
+size_t batch_threads(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (n < 1) {
+        return 1;
+    }
+    return n > MAX_THREADS ? MAX_THREADS : (size_t)n;
+}
+
+void batch_parallel(size_t count, void (*fn)(void *ctx, size_t i), void *ctx) {
+    Work w = { fn, ctx, count, 0 };
+    pthread_t threads[MAX_THREADS];
+    size_t wanted = batch_threads();
+    size_t started = 0;
+
+    if (wanted > count) {
+        wanted = count;
+    }
+
+    /* the calling thread is one of the workers */
+    while (started + 1 < wanted &&
+           pthread_create(&threads[started], NULL, worker, &w) == 0) {
+        started++;
+    }
+    worker(&w);
+
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+/* =========================
+   Reading one file
+   ========================= */
+
+/* Fills content (allocated at the file's size) from offset `have` on,
+   and shortens it if the file turns out to end early. */
+static bool read_into(int fd, Value *content, size_t have) {
+    String *s = &content->as.str_val;
+    char *bytes = s->buf->bytes;
+
+    while (have < s->len) {
+        ssize_t n = pread(fd, bytes + have, s->len - have, (off_t)have);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        if (n == 0) {
+            break;
+        }
+        have += (size_t)n;
+    }
+
+    s->len = have;
+    s->buf->used = have;
+    bytes[have] = '\0';
+    return true;
+}
+
+/* Files with no size up front (pipes, /proc) are read to the end. */
+static bool read_stream(int fd, Value *content) {
+    char chunk[65536];
+    ssize_t n;
+
+    *content = value_string_len("", 0);
+    while ((n = read(fd, chunk, sizeof(chunk))) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        *content = value_string_append(*content, chunk, (size_t)n);
+    }
+    return true;
+}
+
+static void fail_read(BatchResult *r) {
+    value_free(r->content);
+    r->err = "Failed to read file";
+}
+
+static void read_one(const char *path, BatchResult *r) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        r->err = "Failed to open file";
+        return;
+    }
+
+    struct stat st;
+    bool ok;
+
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        r->content = value_string_alloc((size_t)st.st_size);
+        ok = read_into(fd, &r->content, 0);
+    } else {
+        ok = read_stream(fd, &r->content);
+    }
+    close(fd);
+
+    if (!ok) {
+        fail_read(r);
+    }
+}
+
+/* =========================
+   io_uring
+   ========================= */
+
+typedef struct {
+    int fd;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+
+    void *sq_map;
+    void *cq_map;
+    size_t sq_map_len;
+    size_t cq_map_len;
+    size_t sqes_len;
+
+    unsigned queued;   /* entries filled in since the last submit */
+} Ring;
+
+static void *map_ring(int fd, size_t len, off_t offset) {
+    return mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                fd, offset);
+}
+
+static void ring_free(Ring *r) {
+    if (r->cq_map != r->sq_map && r->cq_map != MAP_FAILED) {
+        munmap(r->cq_map, r->cq_map_len);
+    }
+    if (r->sq_map != MAP_FAILED) {
+        munmap(r->sq_map, r->sq_map_len);
+    }
+    if (r->sqes != MAP_FAILED) {
+        munmap(r->sqes, r->sqes_len);
+    }
+    close(r->fd);
+}
+
+static bool ring_init(Ring *r) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+
+    r->fd = (int)syscall(__NR_io_uring_setup, RING_ENTRIES, &p);
+    if (r->fd < 0) {
+        return false;
+    }
+
+    r->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single && r->cq_map_len > r->sq_map_len) {
+        r->sq_map_len = r->cq_map_len;
+    }
+
+    r->sq_map = map_ring(r->fd, r->sq_map_len, IORING_OFF_SQ_RING);
+    r->cq_map = single ? r->sq_map : map_ring(r->fd, r->cq_map_len, IORING_OFF_CQ_RING);
+    r->sqes = (struct io_uring_sqe *)map_ring(r->fd, r->sqes_len, IORING_OFF_SQES);
+
+    /* openat, statx and close arrived in 5.6, the same release as
+       IORING_FEAT_RW_CUR_POS; older rings are not worth using here */
+    if (r->sq_map == MAP_FAILED || r->cq_map == MAP_FAILED ||
+        r->sqes == (struct io_uring_sqe *)MAP_FAILED ||
+        !(p.features & IORING_FEAT_RW_CUR_POS)) {
+        ring_free(r);
+        return false;
+    }
+
+    char *sq = (char *)r->sq_map;
+    char *cq = (char *)r->cq_map;
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    r->queued = 0;
+    return true;
+}
+
+static struct io_uring_sqe *ring_sqe(Ring *r, uint8_t op, uint64_t user_data) {
+    unsigned index = (*r->sq_tail + r->queued) & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = op;
+    sqe->user_data = user_data;
+    r->sq_array[index] = index;
+    r->queued++;
+    return sqe;
+}
+
+/* Submits everything queued and waits for as many completions. */
+static void ring_submit_and_wait(Ring *r) {
+    unsigned submit = r->queued;
+    unsigned wait = r->queued;
+
+    __atomic_store_n(r->sq_tail, *r->sq_tail + r->queued, __ATOMIC_RELEASE);
+    r->queued = 0;
+
+    while (submit > 0) {
+        long n = syscall(__NR_io_uring_enter, r->fd, submit, wait,
+                         IORING_ENTER_GETEVENTS, NULL, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            runtime_error("io_uring submission failed");
+        }
+        submit -= (unsigned)n;
+    }
+
+    /* a wait cut short by a signal: keep waiting */
+    while (__atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE) - *r->cq_head < wait) {
+        syscall(__NR_io_uring_enter, r->fd, 0, wait, IORING_ENTER_GETEVENTS, NULL, 0);
+    }
+}
+
+/* Takes the next completion and returns its user_data, the index of the
+   file it belongs to; only called after a wait has been met. */
+static size_t ring_cqe(Ring *r, int32_t *res) {
+    unsigned head = *r->cq_head;
+    const struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+    size_t i = (size_t)cqe->user_data;
+
+    *res = cqe->res;
+    __atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+    return i;
+}
+
+/* Three round trips for up to RING_FILES files: the opens, then reads
+   straight into the result strings, then the closes. Sizes come from a
+   plain fstat(); a statx through the ring is always handed off to a
+   kernel worker thread and costs more than it saves. */
+static void ring_read_window(Ring *r, char *const *paths, size_t n,
+                             BatchResult *results, int *fds) {
+    for (size_t i = 0; i < n; i++) {
+        struct io_uring_sqe *sqe = ring_sqe(r, IORING_OP_OPENAT, i);
+        sqe->fd = AT_FDCWD;
+        sqe->addr = (uint64_t)(uintptr_t)paths[i];
+        sqe->open_flags = O_RDONLY | O_CLOEXEC;
+    }
+    ring_submit_and_wait(r);
+
+    for (size_t k = 0; k < n; k++) {
+        int32_t res;
+        size_t i = ring_cqe(r, &res);
+        fds[i] = res;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        BatchResult *res = &results[i];
+        struct stat st;
+
+        if (fds[i] < 0) {
+            res->err = "Failed to open file";
+            continue;
+        }
+        if (fstat(fds[i], &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+            /* rare: no size to read up to, so stream it here */
+            if (!read_stream(fds[i], &res->content)) {
+                fail_read(res);
+            }
+            continue;
+        }
+
+        res->content = value_string_alloc((size_t)st.st_size);
+
+        struct io_uring_sqe *sqe = ring_sqe(r, IORING_OP_READ, i);
+        sqe->fd = fds[i];
+        sqe->addr = (uint64_t)(uintptr_t)res->content.as.str_val.buf->bytes;
+        sqe->len = st.st_size > RING_READ_MAX ? RING_READ_MAX : (uint32_t)st.st_size;
+        sqe->off = 0;
+    }
+    ring_submit_and_wait(r);
+
+    while (__atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE) != *r->cq_head) {
+        int32_t got;
+        size_t i = ring_cqe(r, &got);
+        BatchResult *res = &results[i];
+
+        if (got < 0) {
+            fail_read(res);
+        } else if ((size_t)got < res->content.as.str_val.len &&
+                   !read_into(fds[i], &res->content, (size_t)got)) {
+            fail_read(res);
+        }
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        if (fds[i] >= 0) {
+            struct io_uring_sqe *sqe = ring_sqe(r, IORING_OP_CLOSE, i);
+            sqe->fd = fds[i];
+        }
+    }
+    ring_submit_and_wait(r);
+    __atomic_store_n(r->cq_head, __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE),
+                     __ATOMIC_RELEASE);
+}
+
+/* =========================
+   Batch reads
+   ========================= */
+
+typedef struct {
+    char *const *paths;
+    BatchResult *results;
+    size_t count;
+    size_t next_window;
+} ReadJob;
+
+static bool take_window(ReadJob *job, size_t *start, size_t *n) {
+    size_t w = __atomic_fetch_add(&job->next_window, 1, __ATOMIC_RELAXED);
+
+    *start = w * RING_FILES;
+    if (*start >= job->count) {
+        return false;
+    }
+    *n = job->count - *start < RING_FILES ? job->count - *start : RING_FILES;
+    return true;
+}
+
+/* One pool thread: its own ring over windows taken from the shared
+   counter, or plain system calls where io_uring is unavailable. */
+static void read_windows(void *ctx, size_t thread) {
+    ReadJob *job = (ReadJob *)ctx;
+    size_t start, n;
+    Ring ring;
+    int fds[RING_FILES];
+
+    (void)thread;
+
+    if (!ring_init(&ring)) {
+        while (take_window(job, &start, &n)) {
+            for (size_t i = start; i < start + n; i++) {
+                read_one(job->paths[i], &job->results[i]);
+            }
+        }
+        return;
+    }
+
+    while (take_window(job, &start, &n)) {
+        ring_read_window(&ring, job->paths + start, n, job->results + start, fds);
+    }
+    ring_free(&ring);
+}
+
+void batch_read_files(char *const *paths, size_t count, BatchResult *results) {
+    ReadJob job = { paths, results, count, 0 };
+    size_t windows = (count + RING_FILES - 1) / RING_FILES;
+
+    for (size_t i = 0; i < count; i++) {
+        results[i].err = NULL;
+    }
+
+    if (count == 1) {
+        read_one(paths[0], &results[0]);
+        return;
+    }
+    batch_parallel(windows < batch_threads() ? windows : batch_threads(),
+                   read_windows, &job);
+}
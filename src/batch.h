@@ -0,0 +1,29 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "value.h"
+
+/* Reading many files at once.
+
+   batch_read_files hands the opens, reads and closes of a whole window
+   of files to an io_uring, so a few hundred files cost three
+   io_uring_enter calls plus an fstat each, instead of four system calls
+   each. Windows are spread over a small thread pool, one ring per
+   thread; where io_uring is unavailable the same threads fall back to
+   plain system calls. Either way each file is read straight into the
+   buffer of its result string. */
+
+typedef struct {
+    Value content;      /* the file's bytes when err is NULL */
+    const char *err;
+} BatchResult;
+
+void batch_read_files(char *const *paths, size_t count, BatchResult *results);
+
+/* Runs fn(ctx, i) for every i in [0, count) on up to batch_threads()
+   threads and returns when all are done. fn must not touch interpreter
+   state other than its own slot. */
+void batch_parallel(size_t count, void (*fn)(void *ctx, size_t i), void *ctx);
+size_t batch_threads(void);
+
+#endif
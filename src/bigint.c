@@ -0,0 +1,482 @@
+#include "bigint.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Below this many limbs schoolbook multiplication wins. */
+#define KARATSUBA_CUTOFF 32
+
+/* =========================
+   Magnitudes
+   ========================= */
+
+/* A borrowed view of an operand's magnitude. Ints are spilled into
+   `small`, so both kinds go through the same limb routines. */
+typedef struct {
+    const uint32_t *d;
+    size_t n;
+    bool neg;
+    uint32_t small[2];
+} Operand;
+
+static void load(Operand *op, const Value *v) {
+    if (v->type == VAL_INT) {
+        int64_t x = v->as.int_val;
+        uint64_t m = x < 0 ? -(uint64_t)x : (uint64_t)x;
+
+        op->small[0] = (uint32_t)m;
+        op->small[1] = (uint32_t)(m >> 32);
+        op->d = op->small;
+        op->n = op->small[1] ? 2 : (op->small[0] ? 1 : 0);
+        op->neg = x < 0;
+        return;
+    }
+
+    op->d = v->as.big_val->limbs;
+    op->n = v->as.big_val->len;
+    op->neg = v->as.big_val->neg;
+}
+
+static uint32_t *limbs_alloc(size_t n) {
+    uint32_t *d = (uint32_t *)calloc(n ? n : 1, sizeof(uint32_t));
+    if (!d) {
+        exit(1);
+    }
+    return d;
+}
+
+static size_t trim(const uint32_t *d, size_t n) {
+    while (n > 0 && d[n - 1] == 0) {
+        n--;
+    }
+    return n;
+}
+
+static int mag_cmp(const uint32_t *a, size_t an, const uint32_t *b, size_t bn) {
+    if (an != bn) {
+        return an < bn ? -1 : 1;
+    }
+    for (size_t i = an; i-- > 0;) {
+        if (a[i] != b[i]) {
+            return a[i] < b[i] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+/* dst[0..dn) += src[0..sn); the sum must fit in dn limbs. */
+static void add_into(uint32_t *dst, size_t dn, const uint32_t *src, size_t sn) {
+    uint64_t carry = 0;
+    size_t i = 0;
+
+    for (; i < sn; i++) {
+        uint64_t t = (uint64_t)dst[i] + src[i] + carry;
+        dst[i] = (uint32_t)t;
+        carry = t >> 32;
+    }
+    for (; carry && i < dn; i++) {
+        uint64_t t = (uint64_t)dst[i] + carry;
+        dst[i] = (uint32_t)t;
+        carry = t >> 32;
+    }
+}
+
+/* dst[0..dn) -= src[0..sn); requires dst >= src. */
+static void sub_into(uint32_t *dst, size_t dn, const uint32_t *src, size_t sn) {
+    int64_t borrow = 0;
+    size_t i = 0;
+
+    for (; i < sn; i++) {
+        int64_t t = (int64_t)dst[i] - src[i] - borrow;
+        dst[i] = (uint32_t)t;
+        borrow = t < 0;
+    }
+    for (; borrow && i < dn; i++) {
+        int64_t t = (int64_t)dst[i] - borrow;
+        dst[i] = (uint32_t)t;
+        borrow = t < 0;
+    }
+}
+
+static void mul_school(const uint32_t *a, size_t an,
+                       const uint32_t *b, size_t bn, uint32_t *out) {
+    memset(out, 0, sizeof(uint32_t) * (an + bn));
+
+    for (size_t i = 0; i < an; i++) {
+        uint64_t carry = 0;
+        uint64_t ai = a[i];
+
+        if (ai == 0) {
+            continue;
+        }
+        for (size_t j = 0; j < bn; j++) {
+            uint64_t t = ai * b[j] + out[i + j] + carry;
+            out[i + j] = (uint32_t)t;
+            carry = t >> 32;
+        }
+        out[i + bn] = (uint32_t)carry;
+    }
+}
+
+/* out[0..an+bn) = a * b. Karatsuba on balanced operands above the
+   cutoff; a much longer `a` is cut into bn-sized pieces first. */
+static void mag_mul(const uint32_t *a, size_t an,
+                    const uint32_t *b, size_t bn, uint32_t *out) {
+    if (an < bn) {
+        const uint32_t *t = a;
+        a = b;
+        b = t;
+        size_t tn = an;
+        an = bn;
+        bn = tn;
+    }
+
+    if (bn < KARATSUBA_CUTOFF) {
+        mul_school(a, an, b, bn, out);
+        return;
+    }
+
+    if (an >= 2 * bn) {
+        uint32_t *part = limbs_alloc(2 * bn);
+
+        memset(out, 0, sizeof(uint32_t) * (an + bn));
+        for (size_t i = 0; i < an; i += bn) {
+            size_t len = an - i < bn ? an - i : bn;
+            mag_mul(a + i, len, b, bn, part);
+            add_into(out + i, an + bn - i, part, len + bn);
+        }
+        free(part);
+        return;
+    }
+
+    /* a = a1*B^m + a0, b = b1*B^m + b0, with m < bn <= an */
+    size_t m = an / 2;
+    const uint32_t *a0 = a, *a1 = a + m, *b0 = b, *b1 = b + m;
+    size_t a1n = an - m, b1n = bn - m;
+
+    size_t san = (a1n > m ? a1n : m) + 1;
+    size_t sbn = (b1n > m ? b1n : m) + 1;
+    uint32_t *sa = limbs_alloc(san);
+    uint32_t *sb = limbs_alloc(sbn);
+    uint32_t *z1 = limbs_alloc(san + sbn);
+
+    memcpy(sa, a0, sizeof(uint32_t) * m);
+    add_into(sa, san, a1, a1n);
+    memcpy(sb, b0, sizeof(uint32_t) * m);
+    add_into(sb, sbn, b1, b1n);
+
+    /* z0 lands in out[0..2m), z2 in out[2m..an+bn) */
+    mag_mul(a0, m, b0, m, out);
+    mag_mul(a1, a1n, b1, b1n, out + 2 * m);
+
+    mag_mul(sa, san, sb, sbn, z1);
+    sub_into(z1, san + sbn, out, 2 * m);
+    sub_into(z1, san + sbn, out + 2 * m, a1n + b1n);
+
+    add_into(out + m, an + bn - m, z1, trim(z1, san + sbn));
+
+    free(sa);
+    free(sb);
+    free(z1);
+}
+
+/* q = u / d for a single-limb divisor; returns the remainder. */
+static uint32_t divmod_small(const uint32_t *u, size_t n, uint32_t d,
+                             uint32_t *q) {
+    uint64_t r = 0;
+    for (size_t i = n; i-- > 0;) {
+        uint64_t cur = (r << 32) | u[i];
+        q[i] = (uint32_t)(cur / d);
+        r = cur % d;
+    }
+    return (uint32_t)r;
+}
+
+/* q[0..un-vn+1) = u / v (Knuth, algorithm D). Requires un >= vn >= 2 and
+   a normalized v. */
+static void mag_div(const uint32_t *u, size_t un,
+                    const uint32_t *v, size_t vn, uint32_t *q) {
+    int s = __builtin_clz(v[vn - 1]);
+    uint32_t *vs = limbs_alloc(vn);
+    uint32_t *us = limbs_alloc(un + 1);
+
+    for (size_t i = vn - 1; i > 0; i--) {
+        vs[i] = (v[i] << s) | (uint32_t)((uint64_t)v[i - 1] >> (32 - s));
+    }
+    vs[0] = v[0] << s;
+
+    us[un] = (uint32_t)((uint64_t)u[un - 1] >> (32 - s));
+    for (size_t i = un - 1; i > 0; i--) {
+        us[i] = (u[i] << s) | (uint32_t)((uint64_t)u[i - 1] >> (32 - s));
+    }
+    us[0] = u[0] << s;
+
+    const uint64_t base = (uint64_t)1 << 32;
+
+    for (size_t j = un - vn + 1; j-- > 0;) {
+        uint64_t num = ((uint64_t)us[j + vn] << 32) | us[j + vn - 1];
+        uint64_t qhat = num / vs[vn - 1];
+        uint64_t rhat = num % vs[vn - 1];
+
+        while (qhat >= base ||
+               qhat * vs[vn - 2] > ((rhat << 32) | us[j + vn - 2])) {
+            qhat--;
+            rhat += vs[vn - 1];
+            if (rhat >= base) {
+                break;
+            }
+        }
+
+        /* us[j..j+vn] -= qhat * vs */
+        int64_t k = 0;
+        int64_t t;
+        for (size_t i = 0; i < vn; i++) {
+            uint64_t p = qhat * vs[i];
+            t = (int64_t)us[i + j] - k - (int64_t)(p & 0xFFFFFFFFu);
+            us[i + j] = (uint32_t)t;
+            k = (int64_t)(p >> 32) - (t >> 32);
+        }
+        t = (int64_t)us[j + vn] - k;
+        us[j + vn] = (uint32_t)t;
+
+        q[j] = (uint32_t)qhat;
+        if (t < 0) {
+            /* qhat was one too large: add vs back */
+            uint64_t c = 0;
+            q[j]--;
+            for (size_t i = 0; i < vn; i++) {
+                uint64_t sum = (uint64_t)us[i + j] + vs[i] + c;
+                us[i + j] = (uint32_t)sum;
+                c = sum >> 32;
+            }
+            us[j + vn] += (uint32_t)c;
+        }
+    }
+
+    free(vs);
+    free(us);
+}
+
+/* =========================
+   Results
+   ========================= */
+
+/* Builds a normalized result from a magnitude (borrowed). */
+static Value make_result(const uint32_t *d, size_t n, bool neg) {
+    n = trim(d, n);
+
+    if (n <= 2) {
+        uint64_t m = n == 0 ? 0 : d[0];
+        if (n == 2) {
+            m |= (uint64_t)d[1] << 32;
+        }
+        if (m <= (uint64_t)INT64_MAX) {
+            return value_int(neg ? -(int64_t)m : (int64_t)m);
+        }
+        if (neg && m == (uint64_t)INT64_MAX + 1) {
+            return value_int(INT64_MIN);
+        }
+    }
+
+    BigInt *big = (BigInt *)malloc(sizeof(BigInt) + sizeof(uint32_t) * n);
+    if (!big) {
+        exit(1);
+    }
+    big->refcount = 1;
+    big->neg = neg;
+    big->len = n;
+    memcpy(big->limbs, d, sizeof(uint32_t) * n);
+
+    Value v;
+    v.type = VAL_BIGINT;
+    v.as.big_val = big;
+    return v;
+}
+
+/* a + b where b's sign has already been chosen by the caller. */
+static Value signed_add(const Operand *a, const Operand *b, bool bneg) {
+    if (a->neg == bneg) {
+        size_t n = (a->n > b->n ? a->n : b->n) + 1;
+        uint32_t *sum = limbs_alloc(n);
+
+        memcpy(sum, a->d, sizeof(uint32_t) * a->n);
+        add_into(sum, n, b->d, b->n);
+
+        Value v = make_result(sum, n, bneg);
+        free(sum);
+        return v;
+    }
+
+    /* opposite signs: subtract the smaller magnitude from the larger */
+    int c = mag_cmp(a->d, a->n, b->d, b->n);
+    const Operand *big = c >= 0 ? a : b;
+    const Operand *small = c >= 0 ? b : a;
+    bool neg = c >= 0 ? a->neg : bneg;
+    uint32_t *diff = limbs_alloc(big->n);
+
+    memcpy(diff, big->d, sizeof(uint32_t) * big->n);
+    sub_into(diff, big->n, small->d, small->n);
+
+    Value v = make_result(diff, big->n, neg);
+    free(diff);
+    return v;
+}
+
+/* =========================
+   Public API
+   ========================= */
+
+Value bigint_add(Value a, Value b) {
+    Operand x, y;
+    load(&x, &a);
+    load(&y, &b);
+    return signed_add(&x, &y, y.neg);
+}
+
+Value bigint_sub(Value a, Value b) {
+    Operand x, y;
+    load(&x, &a);
+    load(&y, &b);
+    return signed_add(&x, &y, !y.neg);
+}
+
+Value bigint_mul(Value a, Value b) {
+    Operand x, y;
+    load(&x, &a);
+    load(&y, &b);
+
+    if (x.n == 0 || y.n == 0) {
+        return value_int(0);
+    }
+
+    uint32_t *prod = limbs_alloc(x.n + y.n);
+    mag_mul(x.d, x.n, y.d, y.n, prod);
+
+    Value v = make_result(prod, x.n + y.n, x.neg != y.neg);
+    free(prod);
+    return v;
+}
+
+Value bigint_div(Value a, Value b) {
+    Operand x, y;
+    load(&x, &a);
+    load(&y, &b);
+
+    if (mag_cmp(x.d, x.n, y.d, y.n) < 0) {
+        return value_int(0);
+    }
+
+    size_t qn = x.n - y.n + 1;
+    uint32_t *q = limbs_alloc(qn);
+
+    if (y.n == 1) {
+        divmod_small(x.d, x.n, y.d[0], q);
+    } else {
+        mag_div(x.d, x.n, y.d, y.n, q);
+    }
+
+    Value v = make_result(q, qn, x.neg != y.neg);
+    free(q);
+    return v;
+}
+
+Value bigint_neg(Value a) {
+    Operand x;
+    load(&x, &a);
+    return make_result(x.d, x.n, x.n > 0 && !x.neg);
+}
+
+int bigint_cmp(Value a, Value b) {
+    Operand x, y;
+    load(&x, &a);
+    load(&y, &b);
+
+    if (x.neg != y.neg) {
+        return x.neg ? -1 : 1;
+    }
+
+    int c = mag_cmp(x.d, x.n, y.d, y.n);
+    return x.neg ? -c : c;
+}
+
+Value bigint_from_limbs(const uint32_t *limbs, size_t len, bool neg) {
+    return make_result(limbs, len, neg);
+}
+
+/* In steps of 18 digits, so each step is one multiply and one add. */
+Value bigint_from_digits(const char *digits, size_t len, bool neg) {
+    Value acc = value_int(0);
+    size_t i = 0;
+
+    while (i < len) {
+        size_t step = len - i < 18 ? len - i : 18;
+        int64_t chunk = 0;
+        int64_t scale = 1;
+        for (size_t k = 0; k < step; k++) {
+            chunk = chunk * 10 + (digits[i + k] - '0');
+            scale *= 10;
+        }
+        Value scaled = bigint_mul(acc, value_int(scale));
+        value_free(acc);
+        acc = bigint_add(scaled, value_int(chunk));
+        value_free(scaled);
+        i += step;
+    }
+
+    if (neg) {
+        Value negated = bigint_neg(acc);
+        value_free(acc);
+        acc = negated;
+    }
+    return acc;
+}
+
+char *bigint_to_cstr(const BigInt *big) {
+    /* Peel off base-10^9 chunks, least significant first. */
+    size_t n = big->len;
+    size_t max_chunks = n * 32 / 29 + 2;
+    uint32_t *work = limbs_alloc(n);
+    uint32_t *chunks = limbs_alloc(max_chunks);
+    size_t count = 0;
+
+    memcpy(work, big->limbs, sizeof(uint32_t) * n);
+    while (n > 0) {
+        chunks[count++] = divmod_small(work, n, 1000000000u, work);
+        n = trim(work, n);
+    }
+
+    char *out = (char *)malloc(count * 9 + 2);
+    if (!out) {
+        exit(1);
+    }
+
+    char *p = out;
+    if (big->neg) {
+        *p++ = '-';
+    }
+
+    /* top chunk unpadded, the rest zero-padded to nine digits */
+    uint32_t top = chunks[count - 1];
+    char tmp[10];
+    size_t t = 0;
+    do {
+        tmp[t++] = (char)('0' + top % 10);
+        top /= 10;
+    } while (top);
+    while (t > 0) {
+        *p++ = tmp[--t];
+    }
+
+    for (size_t c = count - 1; c-- > 0;) {
+        uint32_t chunk = chunks[c];
+        for (int d = 8; d >= 0; d--) {
+            p[d] = (char)('0' + chunk % 10);
+            chunk /= 10;
+        }
+        p += 9;
+    }
+    *p = '\0';
+
+    free(work);
+    free(chunks);
+    return out;
+}
@@ -0,0 +1,43 @@
+#ifndef BIGINT_H
+#define BIGINT_H
+
+#include "value.h"
+
+/* Arbitrary-precision integers.
+
+   Ints stay unboxed int64_t; arithmetic that overflows (detected with
+   __builtin_*_overflow in the interpreter) is redone here. Results are
+   normalized: anything that fits in int64_t comes back as a plain
+   VAL_INT, so a VAL_BIGINT is always outside the int64_t range and ints
+   and bigints never compare equal.
+
+   The magnitude is little-endian base-2^32 limbs with no leading zeros.
+   Bigints are immutable and refcounted. */
+
+struct BigInt {
+    size_t refcount;
+    bool neg;
+    size_t len;
+    uint32_t limbs[];
+};
+
+/* Operands are VAL_INT or VAL_BIGINT (borrowed); results are owned. */
+Value bigint_add(Value a, Value b);
+Value bigint_sub(Value a, Value b);
+Value bigint_mul(Value a, Value b);
+Value bigint_div(Value a, Value b);   /* truncates; b != 0 */
+Value bigint_neg(Value a);
+int   bigint_cmp(Value a, Value b);   /* -1, 0, 1 */
+
+/* The value of the decimal digits[0, len) (only '0'-'9'), negated if
+   neg; an int when it fits. */
+Value bigint_from_digits(const char *digits, size_t len, bool neg);
+
+/* The value of the magnitude limbs[0, len) (little-endian base 2^32,
+   leading zeros allowed), negated if neg; an int when it fits. */
+Value bigint_from_limbs(const uint32_t *limbs, size_t len, bool neg);
+
+/* Decimal digits with a leading '-' if negative; malloc'd. */
+char *bigint_to_cstr(const BigInt *big);
+
+#endif
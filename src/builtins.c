@@ -0,0 +1,2102 @@
+#include "builtins.h"
+#include "error.h"
+#include "simd.h"
+#include "map.h"
+#include "bigint.h"
+#include "serial.h"
+#include "io.h"
+#include "batch.h"
+#include "walk.h"
+#include "proc.h"
+#include "interp.h"
+#include "output.h"
+#include "regex.h"
+#include "sort.h"
+#include "json.h"
+#include "csv.h"
+#include "format.h"
+#include "memo.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+/* =========================
+   Helpers
+   ========================= */
+
+/* [true, v] / [false, msg], the result shape of fallible builtins. */
+static Value ok_result(Value v) {
+    Value *items = malloc(sizeof(Value) * 2);
+    if (!items) {
+        runtime_error("Out of memory");
+    }
+    items[0] = value_bool(true);
+    items[1] = v;
+    return value_array_from_values(items, 2);
+}
+
+/* [true], for fallible builtins with nothing to return. */
+static Value done_result(void) {
+    Value *items = malloc(sizeof(Value));
+    if (!items) {
+        runtime_error("Out of memory");
+    }
+    items[0] = value_bool(true);
+    return value_array_from_values(items, 1);
+}
+
+static Value err_result(const char *msg) {
+    Value *items = malloc(sizeof(Value) * 2);
+    if (!items) {
+        runtime_error("Out of memory");
+    }
+    items[0] = value_bool(false);
+    items[1] = value_string(msg);
+    return value_array_from_values(items, 2);
+}
+
+static Handle *expect_handle(Value v, const char *msg) {
+    if (v.type != VAL_HANDLE) {
+        runtime_error(msg);
+    }
+    if (v.as.handle_val->fd < 0) {
+        runtime_error("Handle is closed");
+    }
+    return v.as.handle_val;
+}
+
+static Handle *expect_reader(Value v, const char *msg) {
+    Handle *h = expect_handle(v, msg);
+    if (h->writable) {
+        runtime_error("Handle is not open for reading");
+    }
+    return h;
+}
+
+static Handle *expect_writer(Value v, const char *msg) {
+    Handle *h = expect_handle(v, msg);
+    if (!h->writable) {
+        runtime_error("Handle is not open for writing");
+    }
+    return h;
+}
+
+/* =========================
+   Core builtins
+   ========================= */
+
+Value builtin_print(Value *args, size_t argc) {
+    if (argc != 1) {
+        runtime_error("print expects exactly one argument");
+    }
+
+    out_value(args[0]);
+    out_line_end();
+    return value_bool(true);
+}
+
+/* flush() empties the stdout buffer; flush(h) a writer handle's. */
+Value builtin_flush(Value *args, size_t argc) {
+    if (argc > 1) {
+        runtime_error("flush expects at most one argument");
+    }
+
+    if (argc == 1) {
+        Handle *h = expect_writer(args[0], "flush expects a handle");
+        return value_bool(io_flush(h));
+    }
+
+    out_flush();
+    return value_bool(true);
+}
+
+/* Writes exactly content->len bytes to the file at path, for write_file
+   and write_bytes. */
+static Value write_path(const String *path_str, const String *content) {
+    char *path = string_to_cstr(path_str);
+
+    FILE *f = fopen(path, "wbe");
+    free(path);
+    if (!f) {
+        return err_result("Failed to open file for writing");
+    }
+
+    size_t written = fwrite(content->data, 1, content->len, f);
+    fclose(f);
+
+    if (written != content->len) {
+        return err_result("Failed to write full content");
+    }
+    return done_result();
+}
+
+Value builtin_write_file(Value *args, size_t argc) {
+    if (argc != 2) {
+        runtime_error("write_file expects exactly two arguments");
+    }
+
+    if (args[0].type != VAL_STRING ||
+        args[1].type != VAL_STRING) {
+        runtime_error("write_file expects (string path, string content)");
+    }
+
+    return write_path(&args[0].as.str_val, &args[1].as.str_val);
+}
+
+/* write_bytes(path, b) -> [true] or [false, msg], like write_file. */
+Value builtin_write_bytes(Value *args, size_t argc) {
+    if (argc != 2) {
+        runtime_error("write_bytes expects exactly two arguments");
+    }
+
+    if (args[0].type != VAL_STRING ||
+        args[1].type != VAL_BYTES) {
+        runtime_error("write_bytes expects (string path, bytes content)");
+    }
+
+    return write_path(&args[0].as.str_val, &args[1].as.str_val);
+}
+
+
+Value builtin_len(Value *args, size_t argc) {
+    if (argc != 1) {
+        runtime_error("len expects exactly one argument");
+    }
+
+    Value v = args[0];
+
+    if (v.type == VAL_ARRAY) {
+        return value_int((int64_t)v.as.array_val->count);
+    }
+
+    if (v.type == VAL_MAP) {
+        return value_int((int64_t)v.as.map_val->count);
+    }
+
+    if (v.type != VAL_STRING && v.type != VAL_BYTES) {
+        runtime_error("len expects a string, bytes, array or map");
+    }
+
+    return value_int((int64_t)v.as.str_val.len);
+}
+
+/* substr(s, start, len): a view sharing s's buffer, no bytes are copied.
+   len is clipped to the end of the string. On bytes it returns bytes. */
+Value builtin_substr(Value *args, size_t argc) {
+    if (argc != 3) {
+        runtime_error("substr expects exactly three arguments");
+    }
+
+    if ((args[0].type != VAL_STRING && args[0].type != VAL_BYTES) ||
+        args[1].type != VAL_INT ||
+        args[2].type != VAL_INT) {
+        runtime_error("substr expects (string or bytes, int start, int len)");
+    }
+
+    const String *s = &args[0].as.str_val;
+    int64_t start = args[1].as.int_val;
+    int64_t len = args[2].as.int_val;
+
+    if (start < 0 || (size_t)start > s->len) {
+        runtime_error("substr start out of bounds");
+    }
+    if (len < 0) {
+        runtime_error("substr length must not be negative");
+    }
+
+    size_t avail = s->len - (size_t)start;
+    if ((uint64_t)len > avail) {
+        len = (int64_t)avail;
+    }
+
+    Value out = value_string_view(args[0], (size_t)start, (size_t)len);
+    out.type = args[0].type;
+    return out;
+}
+
+/* Reads a file that cannot be mapped (pipes, /proc, ...) to the end,
+   as a value of type (a string or bytes). */
+static Value read_fd_fully(int fd, ValueType type) {
+    Value out = value_string_len("", 0);
+    char chunk[65536];
+    ssize_t n;
+
+    while ((n = read(fd, chunk, sizeof(chunk))) > 0) {
+        out = value_string_append(out, chunk, (size_t)n);
+    }
+    if (n < 0) {
+        value_free(out);
+        return err_result("Failed to read file");
+    }
+    out.type = type;
+    return ok_result(out);
+}
+
+/* The whole file at path as a value of type, for read_file and
+   read_bytes. Regular files are mapped read-only and the content is a
+   view of the mapping, so no copy is made and embedded NUL bytes
+   survive. */
+static Value read_path(const String *path_str, ValueType type) {
+    char *path = string_to_cstr(path_str);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    free(path);
+    if (fd < 0) {
+        return err_result("Failed to open file");
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return err_result("Failed to open file");
+    }
+
+    if (!S_ISREG(st.st_mode) || st.st_size == 0) {
+        /* size 0 may still have content (procfs); mmap needs a length */
+        Value result = read_fd_fully(fd, type);
+        close(fd);
+        return result;
+    }
+
+    size_t size = (size_t)st.st_size;
+    void *addr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        return err_result("Failed to map file");
+    }
+    madvise(addr, size, MADV_SEQUENTIAL);
+
+    Value content = value_string_mapped(addr, size);
+    content.type = type;
+    return ok_result(content);
+}
+
+/* read_file(path) -> [true, content] or [false, msg]. */
+Value builtin_read_file(Value *args, size_t argc) {
+    if (argc != 1) {
+        runtime_error("read_file expects exactly one argument");
+    }
+
+    if (args[0].type != VAL_STRING) {
+        runtime_error("read_file expects a string path");
+    }
+
+    return read_path(&args[0].as.str_val, VAL_STRING);
+}
+
+/* read_bytes(path) -> [true, b] or [false, msg]: read_file's content as
+   bytes, length-delimited like every string. */
+Value builtin_read_bytes(Value *args, size_t argc) {
+    if (argc != 1) {
+        runtime_error("read_bytes expects exactly one argument");
+    }
+
+    if (args[0].type != VAL_STRING) {
+        runtime_error("read_bytes expects a string path");
+    }
+
+    return read_path(&args[0].as.str_val, VAL_BYTES);
+}
+
+/* read_files(paths) -> one [true, content] or [false, msg] per path, in
+   order, read as a batch (see batch.h). */
+Value builtin_read_files(Value *args, size_t argc) {
+    if (argc != 1) {
+        runtime_error("read_files expects exactly one argument");
+    }
+    if (args[0].type != VAL_ARRAY) {
+        runtime_error("read_files expects an array of string paths");
+    }
+
+    const Array *arr = args[0].as.array_val;
+    size_t count = arr->count;
+
+    if (count > 0 && arr->kind != ARRAY_VALUES) {
+        runtime_error("read_files expects an array of string paths");
+    }
+
+    char **paths = malloc(sizeof(char *) * (count ? count : 1));
+    BatchResult *results = malloc(sizeof(BatchResult) * (count ? count : 1));
+    Value *items = malloc(sizeof(Value) * (count ? count : 1));
+    if (!paths || !results || !items) {
+        runtime_error("Out of memory");
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (arr->items[i].type != VAL_STRING) {
+            runtime_error("read_files expects an array of string paths");
+        }
+        paths[i] = string_to_cstr(&arr->items[i].as.str_val);
+    }
+
+    batch_read_files(paths, count, results);
+
+    for (size_t i = 0; i < count; i++) {
+        items[i] = results[i].err ? err_result(results[i].err)
+                                  : ok_result(results[i].content);
+        free(paths[i]);
+    }
+    free(paths);
+    free(results);
+
+    return value_array_from_values(items, count);
+}
+
+/* copy_file(src, dst) -> [true, bytes] or [false, msg]. The bytes never
+   enter the interpreter; see io_copy_fd. dst is created or truncated,
+   but only after checking that it is not src under another name. */
+Value builtin_copy_file(Value *args, size_t argc) {
+    if (argc != 2) {
+        runtime_error("copy_file expects exactly two arguments");
+    }
+    if (args[0].type != VAL_STRING || args[1].type != VAL_STRING) {
+        runtime_error("copy_file expects (string src, string dst)");
+    }
+
+    char *src = string_to_cstr(&args[0].as.str_val);
+    char *dst = string_to_cstr(&args[1].as.str_val);
+    int in = open(src, O_RDONLY | O_CLOEXEC);
+    int out = in < 0 ? -1 : open(dst, O_WRONLY | O_CREAT | O_CLOEXEC, 0666);
+    free(src);
+    free(dst);
+
+    if (in < 0) {
+        return err_result("Failed to open file");
+    }
+    if (out < 0) {
+        close(in);
+        return err_result("Failed to open file for writing");
+    }
+
+    struct stat in_st, out_st;
+    if (fstat(in, &in_st) != 0 || fstat(out, &out_st) != 0) {
+        close(in);
+        close(out);
+        return err_result("Failed to open file");
+    }
+    if (in_st.st_dev == out_st.st_dev && in_st.st_ino == out_st.st_ino) {
+        close(in);
+        close(out);
+        return err_result("source and destination are the same file");
+    }
+    if (S_ISREG(out_st.st_mode) && ftruncate(out, 0) != 0) {
+        close(in);
+        close(out);
+        return err_result("Failed to open file for writing");
+    }
+
+    uint64_t copied = 0;
+    bool ok = io_copy_fd(in, out, &copied);
+    close(in);
+    if (close(out) != 0) {
+        ok = false;
+    }
+
+    return ok ? ok_result(value_int((int64_t)copied))
+              : err_result("Failed to copy file");
+}
+
+/* cat_to_stdout(path) -> [true, bytes] or [false, msg]: the file's bytes
+   as they are, after anything already printed. */
+Value builtin_cat_to_stdout(Value *args, size_t argc) {
+    if (argc != 1) {
+        runtime_error("cat_to_stdout expects exactly one argument");
+    }
+    if (args[0].type != VAL_STRING) {
+        runtime_error("cat_to_stdout expects a string path");
+    }
+
+    char *path = string_to_cstr(&args[0].as.str_val);
+    int in = open(path, O_RDONLY | O_CLOEXEC);
+    free(path);
+    if (in < 0) {
+        return err_result("Failed to open file");
+    }
+
+    uint64_t copied = 0;
+    out_flush();
+    bool ok = io_copy_fd(in, STDOUT_FILENO, &copied);
+    close(in);
+
+    return ok ? ok_result(value_int((int64_t)copied))
+              : err_result("Failed to copy file");
+}
+
+/* walk(dir, pattern) -> [true, paths] or [false, msg]: every regular
+   file under dir whose name matches the glob pattern, sorted. */
+Value builtin_walk(Value *args, size_t argc) {
+    if (argc != 2) {
+        runtime_error("walk expects exactly two arguments");
+    }
+    if (args[0].type != VAL_STRING || args[1].type != VAL_STRING) {
+        runtime_error("walk expects (string dir, string pattern)");
+    }
+
+    char *root = string_to_cstr(&args[0].as.str_val);
+    char *pattern = string_to_cstr(&args[1].as.str_val);
+    WalkResult found;
+    bool ok = walk_tree(root, pattern, &found);
+    free(root);
+    free(pattern);
+
+    if (!ok) {
+        return err_result("Failed to open directory");
+    }
+
+    Value *items = malloc(sizeof(Value) * (found.count ? found.count : 1));
+    if (!items) {
+        runtime_error("Out of memory");
+    }
+    for (size_t i = 0; i < found.count; i++) {
+        items[i] = value_string(found.paths[i]);
+        free(found.paths[i]);
+    }
+    free(found.paths);
+
+    return ok_result(value_array_from_values(items, found.count));
+}
+
+#define MAP_CHUNK 1024
+
+typedef struct {
+    char *const *paths;
+    size_t count;
+    BatchResult *results;
+} Prefetch;
+
+static void *prefetch_chunk(void *arg) {
+    Prefetch *p = (Prefetch *)arg;
+    batch_read_files(p->paths, p->count, p->results);
+    return NULL;
+}
+
+/* map_files(paths, fn) -> [fn(path, r), ...] in path order, where r is
+   what read_file(path) would return. Files are read in chunks on the
+   batch pool, the next chunk while fn runs over the current one; fn
+   itself runs on this thread, as the interpreter is single-threaded.
+   fn may also be a builtin or a record constructor. */
+Value builtin_map_files(Value *args, size_t argc) {
+    if (argc != 2) {
+        runtime_error("map_files expects exactly two arguments");
+    }
+    if (args[0].type != VAL_ARRAY ||
+        (args[1].type != VAL_FUNCTION && args[1].type != VAL_BUILTIN &&
+         args[1].type != VAL_SHAPE)) {
+        runtime_error("map_files expects (array of string paths, function)");
+    }
+
+    const Array *arr = args[0].as.array_val;
+    size_t count = arr->count;
+
+    if (count > 0 && arr->kind != ARRAY_VALUES) {
+        runtime_error("map_files expects an array of string paths");
+    }
+
+    char **paths = malloc(sizeof(char *) * (count ? count : 1));
+    Value *items = malloc(sizeof(Value) * (count ? count : 1));
+    BatchResult *chunks[2] = {
+        malloc(sizeof(BatchResult) * MAP_CHUNK),
+        malloc(sizeof(BatchResult) * MAP_CHUNK),
+    };
+    if (!paths || !items || !chunks[0] || !chunks[1]) {
+        runtime_error("Out of memory");
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (arr->items[i].type != VAL_STRING) {
+            runtime_error("map_files expects an array of string paths");
+        }
+        paths[i] = string_to_cstr(&arr->items[i].as.str_val);
+    }
+
+    if (count > 0) {
+        batch_read_files(paths, count < MAP_CHUNK ? count : MAP_CHUNK, chunks[0]);
+    }
+
+    for (size_t start = 0, k = 0; start < count; start += MAP_CHUNK, k ^= 1) {
+        size_t n = count - start < MAP_CHUNK ? count - start : MAP_CHUNK;
+        size_t next = start + n;
+        Prefetch ahead = { paths + next, 0, chunks[k ^ 1] };
+        pthread_t reader;
+        bool reading = false;
+
+        if (next < count) {
+            ahead.count = count - next < MAP_CHUNK ? count - next : MAP_CHUNK;
+            reading = pthread_create(&reader, NULL, prefetch_chunk, &ahead) == 0;
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            const BatchResult *res = &chunks[k][i];
+            Value call_args[2];
+
+            call_args[0] = arr->items[start + i];
+            call_args[1] = res->err ? err_result(res->err) : ok_result(res->content);
+            items[start + i] = interp_call(args[1], call_args, 2);
+            value_free(call_args[1]);
+        }
+
+        if (reading) {
+            pthread_join(reader, NULL);
+        } else if (ahead.count > 0) {
+            prefetch_chunk(&ahead);
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        free(paths[i]);
+    }
+    free(paths);
+    free(chunks[0]);
+    free(chunks[1]);
+
+    return value_array_from_values(items, count);
+}
+
+/* save_value(path, v) -> [true] or [false, msg] */
+Value builtin_save_value(Value *args, size_t argc) {
+    if (argc != 2) {
+        runtime_error("save_value expects exactly two arguments");
+    }
+    if (args[0].type != VAL_STRING) {
+        runtime_error("save_value expects (string path, value)");
+    }
+
+    char *path = string_to_cstr(&args[0].as.str_val);
+    const char *err;
+    bool ok = serial_save(path, args[1], &err);
+    free(path);
+
+    if (!ok) {
+        return err_result(err);
+    }
+    return done_result();
+}
+
+/* load_value(path) -> [true, v] or [false, msg] */
+Value builtin_load_value(Value *args, size_t argc) {
+    if (argc != 1) {
+        runtime_error("load_value expects exactly one argument");
+    }
+    if (args[0].type != VAL_STRING) {
+        runtime_error("load_value expects a string path");
+    }
+
+    char *path = string_to_cstr(&args[0].as.str_val);
+    const char *err;
+    Value v;
+    bool ok = serial_load(path, &v, &err);
+    free(path);
+
+    return ok ? ok_result(v) : err_result(err);
+}
+
+static Value json_parse_with(Value *args, size_t argc, const char *name,
+                             bool (*parse)(Value, Value *, char *, size_t)) {
+    char msg[160];
+
+    if (argc != 1 || args[0].type != VAL_STRING) {
+        snprintf(msg, sizeof(msg), "%s expects a string", name);
+        runtime_error(msg);
+    }
+
+    Value v;
+    if (!parse(args[0], &v, msg, sizeof(msg))) {
+        return err_result(msg);
+    }
+    return ok_result(v);
+}
+
+/* json_parse(s) -> [true, value] or [false, message]. Unescaped strings
+   in the value are views into s. */
+Value builtin_json_parse(Value *args, size_t argc) {
+    return json_parse_with(args, argc, "json_parse", json_parse);
+}
+
+/* json_parse_lines(s) -> [true, array of values], one per non-blank line
+   of newline-delimited JSON, or [false, message]. */
+Value builtin_json_parse_lines(Value *args, size_t argc) {
+    return json_parse_with(args, argc, "json_parse_lines", json_parse_lines);
+}
+
+Value builtin_json_stringify(Value *args, size_t argc) {
+    if (argc != 1) {
+        runtime_error("json_stringify expects exactly one argument");
+    }
+
+    Value out;
+    const char *err;
+    if (!json_stringify(args[0], &out, &err)) {
+        runtime_error(err);
+    }
+    return out;
+}
+
+/* =========================
+   Strings
+   ========================= */
+
+static const String *expect_string(const Value *v, const char *msg) {
+    if (v->type != VAL_STRING) {
+        runtime_error(msg);
+    }
+    return &v->as.str_val;
+}
+
+/* find(s, sub) / find(s, sub, start) -> index of the first occurrence at
+   or after start, or -1. */
+Value builtin_find(Value *args, size_t argc) {
+    if (argc != 2 && argc != 3) {
+        runtime_error("find expects two or three arguments");
+    }
+
+    const char *msg = "find expects (string, string, optional int start)";
+    const String *s = expect_string(&args[0], msg);
+    const String *sub = expect_string(&args[1], msg);
+    size_t start = 0;
+
+    if (argc == 3) {
+        if (args[2].type != VAL_INT || args[2].as.int_val < 0) {
+            runtime_error(msg);
+        }
+        start = (size_t)args[2].as.int_val;
+        if (start > s->len) {
+            return value_int(-1);
+        }
+    }
+
+    size_t at = simd_find_substr(s->data + start, s->len - start,
+                                 sub->data, sub->len);
+    if (at + sub->len > s->len - start) {
+        return value_int(-1);
+    }
+    return value_int((int64_t)(start + at));
+}
+
+/* count(s, sub) -> non-overlapping occurrences of a non-empty sub. */
+Value builtin_count(Value *args, size_t argc) {
+    if (argc != 2) {
+        runtime_error("count expects exactly two arguments");
+    }
+
+    const String *s = expect_string(&args[0], "count expects (string, string)");
+    const String *sub = expect_string(&args[1], "count expects (string, string)");
+
+    if (sub->len == 0) {
+        runtime_error("count expects a non-empty substring");
+    }
+    if (sub->len == 1) {
+        return value_int((int64_t)simd_count_byte(s->data, s->len, sub->data[0]));
+    }
+
+    size_t count = 0;
+    size_t pos = 0;
+    for (;;) {
+        size_t at = simd_find_substr(s->data + pos, s->len - pos,
+                                     sub->data, sub->len);
+        if (at + sub->len > s->len - pos) {
+            break;
+        }
+        count++;
+        pos += at + sub->len;
+    }
+    return value_int((int64_t)count);
+}
+
+/* Pieces of s between occurrences of sep, as views of s. The pieces are
+   counted first so the result array is allocated once. */
+static Value split_on(Value str, const char *sep, size_t sep_len, bool drop_last_empty) {
+    const String *s = &str.as.str_val;
+    size_t pieces = 1;
+
+    if (sep_len == 1) {
+        pieces += simd_count_byte(s->data, s->len, sep[0]);
+    } else {
+        for (size_t pos = 0;;) {
+            size_t at = simd_find_substr(s->data + pos, s->len - pos, sep, sep_len);
+            if (at + sep_len > s->len - pos) {
+                break;
+            }
+            pieces++;
+            pos += at + sep_len;
+        }
+    }
+
+    Value *items = malloc(sizeof(Value) * pieces);
+    if (!items) {
+        runtime_error("Out of memory");
+    }
+
+    size_t pos = 0;
+    for (size_t i = 0; i + 1 < pieces; i++) {
+        size_t at = simd_find_substr(s->data + pos, s->len - pos, sep, sep_len);
+        items[i] = value_string_view(str, pos, at);
+        pos += at + sep_len;
+    }
+
+    if (drop_last_empty && pos == s->len) {
+        pieces--;
+    } else {
+        items[pieces - 1] = value_string_view(str, pos, s->len - pos);
+    }
+    return value_array_from_values(items, pieces);
+}
+
+/* split(s, sep) -> the pieces between separators, empty ones included;
+   split("", sep) is [""]. */
+Value builtin_split(Value *args, size_t argc) {
+    if (argc != 2) {
+        runtime_error("split expects exactly two arguments");
+    }
+
+    expect_string(&args[0], "split expects (string, string separator)");
+    const String *sep = expect_string(&args[1], "split expects (string, string separator)");
+
+    if (sep->len == 0) {
+        runtime_error("split expects a non-empty separator");
+    }
+    return split_on(args[0], sep->data, sep->len, false);
+}
+
+/* split_lines(s) -> lines without their '\n'; a final '\n' does not
+   start another line. */
+Value builtin_split_lines(Value *args, size_t argc) {
+    if (argc != 1) {
+        runtime_error("split_lines expects exactly one argument");
+    }
+
+    expect_string(&args[0], "split_lines expects a string");
+    return split_on(args[0], "\n", 1, true);
+}
+
+/* split_whitespace(s) -> the runs of non-whitespace in s. Whitespace is
+   classified into a bitmap up front; words start where a set bit is
+   followed by a clear one, so they are counted with popcounts and cut
+   out with bit scans. */
+Value builtin_split_whitespace(Value *args, size_t argc) {
+    if (argc != 1) {
+        runtime_error("split_whitespace expects exactly one argument");
+    }
+
+    const String *s = expect_string(&args[0], "split_whitespace expects a string");
+    size_t words = (s->len + 63) / 64;
+    uint64_t *space = malloc(sizeof(uint64_t) * (words ? words : 1));
+    if (!space) {
+        runtime_error("Out of memory");
+    }
+    simd_space_bits(s->data, s->len, space);
+
+    /* bit i of starts: p[i] is a word byte and p[i - 1] is not */
+    size_t count = 0;
+    uint64_t carry = 1;   /* before the string counts as whitespace */
+    for (size_t w = 0; w < words; w++) {
+        size_t valid = s->len - w * 64 < 64 ? s->len - w * 64 : 64;
+        uint64_t mask = valid == 64 ? ~(uint64_t)0 : ((uint64_t)1 << valid) - 1;
+        uint64_t starts = ~space[w] & ((space[w] << 1) | carry) & mask;
+        carry = space[w] >> 63;
+        count += (size_t)__builtin_popcountll(starts);
+    }
+
+    Value *items = malloc(sizeof(Value) * (count ? count : 1));
+    if (!items) {
+        runtime_error("Out of memory");
+    }
+
+    size_t n = 0;
+    size_t start = 0;
+    bool in_word = false;
+    for (size_t w = 0; w < words; w++) {
+        size_t valid = s->len - w * 64 < 64 ? s->len - w * 64 : 64;
+        uint64_t mask = valid == 64 ? ~(uint64_t)0 : ((uint64_t)1 << valid) - 1;
+        uint64_t sp = space[w];
+        uint64_t prev = (sp << 1) | (in_word ? 0 : 1);
+        uint64_t starts = ~sp & prev & mask;
+        uint64_t ends = sp & ~prev & mask;   /* first space after a word */
+
+        while (starts | ends) {
+            size_t s_at = starts ? (size_t)__builtin_ctzll(starts) : 64;
+            size_t e_at = ends ? (size_t)__builtin_ctzll(ends) : 64;
+
+            if (e_at < s_at) {
+                items[n++] = value_string_view(args[0], start, w * 64 + e_at - start);
+                ends &= ends - 1;
+                in_word = false;
+            } else {
+                start = w * 64 + s_at;
+                starts &= starts - 1;
+                in_word = true;
+            }
+        }
+        if (valid == 64) {
+            in_word = !(sp >> 63);
+        }
+    }
+    if (in_word) {
+        items[n++] = value_string_view(args[0], start, s->len - start);
+    }
+
+    free(space);
+    return value_array_from_values(items, n);
+}
+
+/* join(arr, sep) -> the strings of arr with sep between them, built in
+   one allocation of the exact size. */
+Value builtin_join(Value *args, size_t argc) {
+    if (argc != 2) {
+        runtime_error("join expects exactly two arguments");
+    }
+    if (args[0].type != VAL_ARRAY) {
+        runtime_error("join expects (array of strings, string separator)");
+    }
+
+    const Array *arr = args[0].as.array_val;
+    const String *sep = expect_string(&args[1], "join expects (array of strings, string separator)");
+
+    if (arr->count == 0) {
+        return value_string_len("", 0);
+    }
+    if (arr->kind != ARRAY_VALUES) {
+        runtime_error("join expects an array of strings");
+    }
+
+    size_t total = sep->len * (arr->count - 1);
+    for (size_t i = 0; i < arr->count; i++) {
+        total += expect_string(&arr->items[i], "join expects an array of strings")->len;
+    }
+
+    Value out = value_string_alloc(total);
+    char *p = out.as.str_val.buf->bytes;
+
+    for (size_t i = 0; i < arr->count; i++) {
+        const String *item = &arr->items[i].as.str_val;
+        if (i > 0) {
+            memcpy(p, sep->data, sep->len);
+            p += sep->len;
+        }
+        memcpy(p, item->data, item->len);
+        p += item->len;
+    }
+    return out;
+}
+
+/* str(v): the text print writes for v. */
+Value builtin_str(Value *args, size_t argc) {
+    if (argc != 1) {
+        runtime_error("str expects exactly one argument");
+    }
+    return value_text(args[0]);
+}
+
+/* to_int(s) -> [true, int] or [false, msg]; s is an optional sign and
+   decimal digits, with no spaces. */
+Value builtin_to_int(Value *args, size_t argc) {
+    if (argc != 1) {
+        runtime_error("to_int expects exactly one argument");
+    }
+
+    const String *s = expect_string(&args[0], "to_int expects a string");
+    Value v;
+    if (!parse_int(s->data, s->len, &v)) {
+        return err_result("to_int: not an integer");
+    }
+    return ok_result(v);
+}
+
+/* parse_ints(text, optional sep) -> packed int array of the fields of
+   text split at sep (default ",") and at line ends. A bad field is a
+   runtime error naming its line. */
+Value builtin_parse_ints(Value *args, size_t argc) {
+    if (argc != 1 && argc != 2) {
+        runtime_error("parse_ints expects one or two arguments");
+    }
+
+    const char *msg = "parse_ints expects (string, optional one-character separator)";
+    const String *s = expect_string(&args[0], msg);
+    char sep = ',';
+
+    if (argc == 2) {
+        const String *sep_str = expect_string(&args[1], msg);
+        if (sep_str->len != 1 || memchr("0123456789+-\r", sep_str->data[0], 13)) {
+            runtime_error("parse_ints separator must be one character other than a digit, sign or \\r");
+        }
+        sep = sep_str->data[0];
+    }
+
+    Value out;
+    size_t bad;
+    if (!parse_ints(s->data, s->len, sep, &out, &bad)) {
+        char err[96];
+        snprintf(err, sizeof(err), "parse_ints: not an integer at line %zu",
+                 simd_count_byte(s->data, bad, '\n') + 1);
+        runtime_error(err);
+    }
+    return out;
+}
+
+/* format(fmt, args...). Calls in the source go through the interpreter,
+   which caches the compiled format per call site; this is the path for
+   indirect calls, and compiles every time. */
+Value builtin_format(Value *args, size_t argc) {
+    if (argc == 0 || args[0].type != VAL_STRING) {
+        runtime_error("format expects (string format, values...)");
+    }
+
+    const char *err;
+    Format *f = format_compile(args[0].as.str_val.data, args[0].as.str_val.len, &err);
+    if (!f) {
+        runtime_error(err);
+    }
+    if (format_arg_count(f) != argc - 1) {
+        runtime_error("format: argument count does not match the format string");
+    }
+
+    Value out = format_apply(f, args + 1, argc - 1);
+    format_free(f);
+    return out;
+}
+
+/* =========================
+   Bytes
+   ========================= */
+
+/* to_bytes(x): a string's bytes, sharing its buffer, or an array of ints
+   0 to 255 packed one per byte. */
+Value builtin_to_bytes(Value *args, size_t argc) {
+    if (argc != 1) {
+        runtime_error("to_bytes expects exactly one argument");
+    }
+
+    if (args[0].type == VAL_STRING) {
+        Value out = value_clone(args[0]);
+        out.type = VAL_BYTES;
+        return out;
+    }
+
+    const Array *arr = args[0].type == VAL_ARRAY ? args[0].as.array_val : NULL;
+    if (!arr || (arr->count > 0 && arr->kind != ARRAY_INTS)) {
+        runtime_error("to_bytes expects a string or an array of ints");
+    }
+
+    Value out = value_string_alloc(arr->count);
+    unsigned char *p = (unsigned char *)out.as.str_val.buf->bytes;
+
+    for (size_t i = 0; i < arr->count; i++) {
+        int64_t x = arr->ints[i];
+        if (x < 0 || x > 255) {
+            value_free(out);
+            runtime_error("to_bytes: array element is not a byte (0 to 255)");
+        }
+        p[i] = (unsigned char)x;
+    }
+    out.type = VAL_BYTES;
+    return out;
+}
+
+/* to_str(b): the same bytes as a string, sharing b's buffer. */
+Value builtin_to_str(Value *args, size_t argc) {
+    if (argc != 1) {
+        runtime_error("to_str expects exactly one argument");
+    }
+    if (args[0].type != VAL_BYTES) {
+        runtime_error("to_str expects bytes");
+    }
+
+    Value out = value_clone(args[0]);
+    out.type = VAL_STRING;
+    return out;
+}
+
+/* =========================
+   Regular expressions
+   ========================= */
+
+static Regex *expect_regex(const Value *v, const char *msg) {
+    const String *pat = expect_string(v, msg);
+    const char *err;
+    Regex *re = regex_get(pat->data, pat->len, &err);
+
+    if (!re) {
+        char buf[128];
+        snprintf(buf, sizeof(buf), "Invalid pattern: %s", err);
+        runtime_error(buf);
+    }
+    return re;
+}
+
+/* Every non-overlapping match, left to right, as [start, end) pairs in
+   spans. An empty match moves the search on by one byte, so no match
+   starts where an empty one was found: find_all("11", "\\w*?") is three
+   empty matches, where Python also takes each "1" after the empty match
+   in front of it. */
+static size_t all_matches(Regex *re, const String *s, size_t **spans) {
+    size_t cap = 16;
+    size_t count = 0;
+    size_t pos = 0;
+    size_t *out = malloc(sizeof(size_t) * 2 * cap);
+    if (!out) {
+        runtime_error("Out of memory");
+    }
+
+    size_t start, end;
+    while (pos <= s->len && regex_search(re, s->data, s->len, pos, &start, &end)) {
+        if (count == cap) {
+            cap *= 2;
+            out = realloc(out, sizeof(size_t) * 2 * cap);
+            if (!out) {
+                runtime_error("Out of memory");
+            }
+        }
+        out[count * 2] = start;
+        out[count * 2 + 1] = end;
+        count++;
+        pos = end > start ? end : end + 1;
+    }
+
+    *spans = out;
+    return count;
+}
+
+/* match(s, pattern) -> whether the pattern matches all of s */
+Value builtin_match(Value *args, size_t argc) {
+    if (argc != 2) {
+        runtime_error("match expects exactly two arguments");
+    }
+
+    const char *msg = "match expects (string, string pattern)";
+    const String *s = expect_string(&args[0], msg);
+    Regex *re = expect_regex(&args[1], msg);
+    return value_bool(regex_full_match(re, s->data, s->len));
+}
+
+/* search(s, pattern) / search(s, pattern, start) -> [start, end] of the
+   first match at or after start, or [-1, -1]. */
+Value builtin_search(Value *args, size_t argc) {
+    if (argc != 2 && argc != 3) {
+        runtime_error("search expects two or three arguments");
+    }
+
+    const char *msg = "search expects (string, string pattern, optional int start)";
+    const String *s = expect_string(&args[0], msg);
+    Regex *re = expect_regex(&args[1], msg);
+    size_t from = 0;
+
+    if (argc == 3) {
+        if (args[2].type != VAL_INT || args[2].as.int_val < 0) {
+            runtime_error(msg);
+        }
+        from = (size_t)args[2].as.int_val;
+    }
+
+    Value out = value_int_array(2);
+    int64_t *span = out.as.array_val->ints;
+    size_t start, end;
+
+    if (from <= s->len && regex_search(re, s->data, s->len, from, &start, &end)) {
+        span[0] = (int64_t)start;
+        span[1] = (int64_t)end;
+    } else {
+        span[0] = span[1] = -1;
+    }
+    return out;
+}
+
+/* find_all(s, pattern) -> the non-overlapping matches, as views of s.
+   Empty matches are found as all_matches describes. */
+Value builtin_find_all(Value *args, size_t argc) {
+    if (argc != 2) {
+        runtime_error("find_all expects exactly two arguments");
+    }
+
+    const char *msg = "find_all expects (string, string pattern)";
+    const String *s = expect_string(&args[0], msg);
+    Regex *re = expect_regex(&args[1], msg);
+    size_t *spans;
+    size_t count = all_matches(re, s, &spans);
+
+    Value *items = malloc(sizeof(Value) * (count ? count : 1));
+    if (!items) {
+        runtime_error("Out of memory");
+    }
+    for (size_t i = 0; i < count; i++) {
+        items[i] = value_string_view(args[0], spans[i * 2], spans[i * 2 + 1] - spans[i * 2]);
+    }
+
+    free(spans);
+    return value_array_from_values(items, count);
+}
+
+/* replace(s, pattern, repl) -> s with every match replaced by repl,
+   taken literally. Matches, empty ones included, are those find_all
+   returns. */
+Value builtin_replace(Value *args, size_t argc) {
+    if (argc != 3) {
+        runtime_error("replace expects exactly three arguments");
+    }
+
+    const char *msg = "replace expects (string, string pattern, string replacement)";
+    const String *s = expect_string(&args[0], msg);
+    Regex *re = expect_regex(&args[1], msg);
+    const String *repl = expect_string(&args[2], msg);
+    size_t *spans;
+    size_t count = all_matches(re, s, &spans);
+
+    if (count == 0) {
+        free(spans);
+        return value_clone(args[0]);
+    }
+
+    size_t total = s->len + count * repl->len;
+    for (size_t i = 0; i < count; i++) {
+        total -= spans[i * 2 + 1] - spans[i * 2];
+    }
+
+    Value out = value_string_alloc(total);
+    char *p = out.as.str_val.buf->bytes;
+    size_t pos = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        memcpy(p, s->data + pos, spans[i * 2] - pos);
+        p += spans[i * 2] - pos;
+        memcpy(p, repl->data, repl->len);
+        p += repl->len;
+        pos = spans[i * 2 + 1];
+    }
+    memcpy(p, s->data + pos, s->len - pos);
+
+    free(spans);
+    return out;
+}
+
+/* =========================
+   Handles
+   ========================= */
+
+/* open(path, mode) -> [true, handle] or [false, msg] */
+Value builtin_open(Value *args, size_t argc) {
+    if (argc != 2) {
+        runtime_error("open expects exactly two arguments");
+    }
+    if (args[0].type != VAL_STRING || args[1].type != VAL_STRING) {
+        runtime_error("open expects (string path, string mode)");
+    }
+
+    char *path = string_to_cstr(&args[0].as.str_val);
+    char *mode = string_to_cstr(&args[1].as.str_val);
+    const char *err;
+    Value h;
+    bool ok = io_open(path, mode, &h, &err);
+    free(path);
+    free(mode);
+
+    return ok ? ok_result(h) : err_result(err);
+}
+
+/* read_line(h): the next line without its newline, "" at end of input;
+   eof(h) tells an empty line from the end. */
+Value builtin_read_line(Value *args, size_t argc) {
+    if (argc != 1) {
+        runtime_error("read_line expects exactly one argument");
+    }
+
+    Handle *h = expect_reader(args[0], "read_line expects a handle");
+    Value line;
+
+    if (h->csv) {
+        runtime_error("read_line cannot read a CSV handle");
+    }
+
+    if (!io_read_line(h, &line)) {
+        return value_string_len("", 0);
+    }
+    return line;
+}
+
+Value builtin_read_chunk(Value *args, size_t argc) {
+    if (argc != 2) {
+        runtime_error("read_chunk expects exactly two arguments");
+    }
+    if (args[1].type != VAL_INT || args[1].as.int_val < 0) {
+        runtime_error("read_chunk expects (handle, non-negative int)");
+    }
+
+    Handle *h = expect_reader(args[0], "read_chunk expects (handle, non-negative int)");
+    if (h->csv) {
+        runtime_error("read_chunk cannot read a CSV handle");
+    }
+    return io_read_chunk(h, (size_t)args[1].as.int_val);
+}
+
+Value builtin_eof(Value *args, size_t argc) {
+    if (argc != 1) {
+        runtime_error("eof expects exactly one argument");
+    }
+
+    Handle *h = expect_reader(args[0], "eof expects a handle");
+    return value_bool(io_eof(h));
+}
+
+Value builtin_close(Value *args, size_t argc) {
+    if (argc != 1) {
+        runtime_error("close expects exactly one argument");
+    }
+    if (args[0].type != VAL_HANDLE) {
+        runtime_error("close expects a handle");
+    }
+
+    return value_bool(io_close(args[0].as.handle_val));
+}
+
+Value builtin_write(Value *args, size_t argc) {
+    if (argc != 2) {
+        runtime_error("write expects exactly two arguments");
+    }
+    if (args[1].type != VAL_STRING && args[1].type != VAL_BYTES) {
+        runtime_error("write expects (handle, string or bytes)");
+    }
+
+    Handle *h = expect_writer(args[0], "write expects (handle, string or bytes)");
+    const String *s = &args[1].as.str_val;
+
+    if (!io_write(h, s->data, s->len)) {
+        runtime_error("Failed to write to handle");
+    }
+    return value_bool(true);
+}
+
+/* write_lines(h, arr): every string followed by a newline, with long
+   strings handed to the kernel in place rather than copied. */
+Value builtin_write_lines(Value *args, size_t argc) {
+    if (argc != 2) {
+        runtime_error("write_lines expects exactly two arguments");
+    }
+    if (args[1].type != VAL_ARRAY) {
+        runtime_error("write_lines expects (handle, array of strings)");
+    }
+
+    Handle *h = expect_writer(args[0], "write_lines expects (handle, array of strings)");
+    const Array *arr = args[1].as.array_val;
+
+    if (arr->count == 0) {
+        return value_bool(true);
+    }
+    if (arr->kind != ARRAY_VALUES) {
+        runtime_error("write_lines expects an array of strings");
+    }
+    for (size_t i = 0; i < arr->count; i++) {
+        if (arr->items[i].type != VAL_STRING) {
+            runtime_error("write_lines expects an array of strings");
+        }
+    }
+
+    if (!io_write_lines(h, arr->items, arr->count)) {
+        runtime_error("Failed to write to handle");
+    }
+    return value_bool(true);
+}
+
+/* csv_open(path, optional map opts) -> [true, handle] or [false, msg];
+   see csv.h for the options. */
+Value builtin_csv_open(Value *args, size_t argc) {
+    if (argc < 1 || argc > 2) {
+        runtime_error("csv_open expects one or two arguments");
+    }
+    if (args[0].type != VAL_STRING) {
+        runtime_error("csv_open expects (string path, optional map options)");
+    }
+
+    char *path = string_to_cstr(&args[0].as.str_val);
+    const char *err;
+    Value h;
+    bool ok = csv_open(path, argc == 2 ? args[1] : value_int(0), &h, &err);
+    free(path);
+
+    return ok ? ok_result(h) : err_result(err);
+}
+
+/* csv_next(h): the selected columns of the next batch of records, each
+   column an array; all of them are empty at end of input. */
+Value builtin_csv_next(Value *args, size_t argc) {
+    if (argc != 1) {
+        runtime_error("csv_next expects exactly one argument");
+    }
+
+    Handle *h = expect_reader(args[0], "csv_next expects a CSV handle");
+    if (!h->csv) {
+        runtime_error("csv_next expects a CSV handle");
+    }
+    return csv_next(h);
+}
+
+/* =========================
+   Processes
+   ========================= */
+
+static void map_put(Value map, const char *key, Value v) {
+    map_set(map.as.map_val, value_string(key), v);
+}
+
+/* p[name] for a process map from spawn; NULL if absent. */
+static const Value *proc_field(Value p, const char *name) {
+    Value key = value_string(name);
+    const Value *v = map_find(p.as.map_val, key);
+    value_free(key);
+    return v;
+}
+
+static Handle *proc_handle(Value p, const char *name, const char *who) {
+    const Value *v = p.type == VAL_MAP ? proc_field(p, name) : NULL;
+
+    if (!v || v->type != VAL_HANDLE) {
+        runtime_error(who);
+    }
+    return expect_handle(*v, "Handle is closed");
+}
+
+/* spawn(argv) -> [true, p] or [false, msg], where p is
+   {"pid": int, "stdin": writer handle, "stdout": reader handle}. */
+Value builtin_spawn(Value *args, size_t argc) {
+    if (argc != 1) {
+        runtime_error("spawn expects exactly one argument");
+    }
+    if (args[0].type != VAL_ARRAY || args[0].as.array_val->count == 0 ||
+        args[0].as.array_val->kind != ARRAY_VALUES) {
+        runtime_error("spawn expects a non-empty array of strings");
+    }
+
+    const Array *arr = args[0].as.array_val;
+    char **argv = malloc(sizeof(char *) * (arr->count + 1));
+    if (!argv) {
+        runtime_error("Out of memory");
+    }
+    for (size_t i = 0; i < arr->count; i++) {
+        if (arr->items[i].type != VAL_STRING) {
+            runtime_error("spawn expects a non-empty array of strings");
+        }
+        argv[i] = string_to_cstr(&arr->items[i].as.str_val);
+    }
+    argv[arr->count] = NULL;
+
+    /* the child must not inherit unwritten output */
+    out_flush();
+
+    Proc proc;
+    const char *err;
+    bool ok = proc_spawn(argv, &proc, &err);
+
+    for (size_t i = 0; i < arr->count; i++) {
+        free(argv[i]);
+    }
+    free(argv);
+
+    if (!ok) {
+        return err_result(err);
+    }
+
+    Value p = value_map();
+    map_put(p, "pid", value_int(proc.pid));
+    map_put(p, "stdin", io_fd_writer(proc.in));
+    map_put(p, "stdout", io_fd_reader(proc.out));
+    return ok_result(p);
+}
+
+/* pipe_between(a, b): a's stdout feeds b's stdin from now on, through
+   the kernel on a background thread. Both handles are closed here; read
+   b's stdout as usual. */
+Value builtin_pipe_between(Value *args, size_t argc) {
+    if (argc != 2) {
+        runtime_error("pipe_between expects exactly two arguments");
+    }
+
+    const char *who = "pipe_between expects two processes from spawn";
+    Handle *from = proc_handle(args[0], "stdout", who);
+    Handle *to = proc_handle(args[1], "stdin", who);
+
+    /* whatever was already written or read ahead goes first */
+    if (!io_write(to, from->buf ? from->buf + from->pos : "", from->end - from->pos) ||
+        !io_flush(to)) {
+        runtime_error("Failed to write to handle");
+    }
+
+    int in = io_take_fd(from);
+    int out = io_take_fd(to);
+
+    if (!proc_pump(in, out)) {
+        close(in);
+        close(out);
+        runtime_error("Failed to start pipe");
+    }
+    return value_bool(true);
+}
+
+/* wait(p) -> exit code, 128 + signal if killed. Closes p's stdin first
+   so a child reading it sees the end. */
+Value builtin_wait(Value *args, size_t argc) {
+    if (argc != 1) {
+        runtime_error("wait expects exactly one argument");
+    }
+
+    const Value *pid = args[0].type == VAL_MAP ? proc_field(args[0], "pid") : NULL;
+    if (!pid || pid->type != VAL_INT) {
+        runtime_error("wait expects a process from spawn");
+    }
+
+    const Value *in = proc_field(args[0], "stdin");
+    if (in && in->type == VAL_HANDLE) {
+        io_close(in->as.handle_val);
+    }
+
+    int code = proc_wait((pid_t)pid->as.int_val);
+    if (code < 0) {
+        runtime_error("Process cannot be waited for");
+    }
+    return value_int(code);
+}
+
+/* =========================
+   Array mutation
+   ========================= */
+
+bool builtin_mutates_first_arg(BuiltinFn fn) {
+    return fn == builtin_push ||
+           fn == builtin_pop ||
+           fn == builtin_reserve ||
+           fn == builtin_remove;
+}
+
+bool builtin_is_quiet(BuiltinFn fn) {
+    return fn == builtin_print ||
+           fn == builtin_flush ||
+           fn == builtin_close ||
+           fn == builtin_write ||
+           fn == builtin_write_lines ||
+           fn == builtin_cat_to_stdout ||
+           fn == builtin_pipe_between ||
+           builtin_mutates_first_arg(fn);
+}
+
+/* push(a, x): append with geometric growth. */
+Value builtin_push(Value *args, size_t argc) {
+    if (argc != 2) {
+        runtime_error("push expects exactly two arguments");
+    }
+    if (args[0].type != VAL_ARRAY) {
+        runtime_error("push expects an array");
+    }
+
+    array_push(args[0].as.array_val, value_clone(args[1]));
+    return value_bool(true);
+}
+
+/* pop(a): remove and return the last element. */
+Value builtin_pop(Value *args, size_t argc) {
+    if (argc != 1) {
+        runtime_error("pop expects exactly one argument");
+    }
+    if (args[0].type != VAL_ARRAY) {
+        runtime_error("pop expects an array");
+    }
+    if (args[0].as.array_val->count == 0) {
+        runtime_error("pop from empty array");
+    }
+
+    return array_pop(args[0].as.array_val);
+}
+
+/* reserve(a, n): make room for n elements without changing len(a). */
+Value builtin_reserve(Value *args, size_t argc) {
+    if (argc != 2 || args[0].type != VAL_ARRAY || args[1].type != VAL_INT ||
+        args[1].as.int_val < 0) {
+        runtime_error("reserve expects (array, int capacity)");
+    }
+
+    array_reserve(args[0].as.array_val, (size_t)args[1].as.int_val);
+    return value_bool(true);
+}
+
+/* =========================
+   Sorting
+   ========================= */
+
+/* The natural order: ints and bigints by value, strings and bytes
+   bytewise, false before true. */
+static int compare_values(const Value *a, const Value *b) {
+    if (a->type == VAL_INT && b->type == VAL_INT) {
+        return (a->as.int_val > b->as.int_val) - (a->as.int_val < b->as.int_val);
+    }
+    if ((a->type == VAL_INT || a->type == VAL_BIGINT) &&
+        (b->type == VAL_INT || b->type == VAL_BIGINT)) {
+        return bigint_cmp(*a, *b);
+    }
+    if (a->type == b->type && (a->type == VAL_STRING || a->type == VAL_BYTES)) {
+        const String *x = &a->as.str_val;
+        const String *y = &b->as.str_val;
+        int c = memcmp(x->data, y->data, x->len < y->len ? x->len : y->len);
+        if (c != 0) {
+            return c;
+        }
+        return (x->len > y->len) - (x->len < y->len);
+    }
+    if (a->type == VAL_BOOL && b->type == VAL_BOOL) {
+        return (int)a->as.bool_val - (int)b->as.bool_val;
+    }
+    runtime_error("sort expects ints, strings, bytes or bools of one kind; use sort_by for other values");
+    return 0;
+}
+
+static bool less_asc(const Value *a, const Value *b, void *ctx) {
+    (void)ctx;
+    return compare_values(a, b) < 0;
+}
+
+static bool less_desc(const Value *a, const Value *b, void *ctx) {
+    (void)ctx;
+    return compare_values(b, a) < 0;
+}
+
+/* less(a, b) returns a bool, or an int that is negative when a goes first. */
+static bool less_callback(const Value *a, const Value *b, void *ctx) {
+    Value args[2] = {*a, *b};
+    Value r = callback_call((Callback *)ctx, args);
+    bool before;
+
+    if (r.type == VAL_BOOL) {
+        before = r.as.bool_val;
+    } else if (r.type == VAL_INT) {
+        before = r.as.int_val < 0;
+    } else {
+        runtime_error("sort_by expects the comparator to return a bool or an int");
+        return false;
+    }
+    value_free(r);
+    return before;
+}
+
+/* The elements of arr, boxed, sorted through less, as a new array. */
+static Value sort_boxed(const Array *arr, SortLess less, void *ctx, bool stable) {
+    Value *items = malloc(sizeof(Value) * (arr->count ? arr->count : 1));
+    if (!items) {
+        runtime_error("Out of memory");
+    }
+    for (size_t i = 0; i < arr->count; i++) {
+        items[i] = array_get(arr, i);
+    }
+
+    sort_values(items, arr->count, less, ctx, stable);
+    return value_array_from_values(items, arr->count);
+}
+
+static Value sort_ints_copy(const int64_t *src, size_t count, bool desc) {
+    Value out = value_int_array(count);
+    sort_ints(src, out.as.array_val->ints, count, desc);
+    return out;
+}
+
+static bool optional_stable(Value *args, size_t argc, size_t at, const char *msg) {
+    if (argc <= at) {
+        return false;
+    }
+    if (args[at].type != VAL_BOOL) {
+        runtime_error(msg);
+    }
+    return args[at].as.bool_val;
+}
+
+static Value sort_natural(Value *args, size_t argc, bool desc, const char *msg) {
+    if (argc != 1 && argc != 2) {
+        runtime_error(msg);
+    }
+    if (args[0].type != VAL_ARRAY) {
+        runtime_error(msg);
+    }
+
+    const Array *arr = args[0].as.array_val;
+    bool stable = optional_stable(args, argc, 1, msg);
+
+    if (arr->kind == ARRAY_INTS) {
+        return sort_ints_copy(arr->ints, arr->count, desc);
+    }
+
+    if (arr->kind == ARRAY_BOOLS) {
+        size_t trues = 0;
+        for (size_t i = 0; i < arr->count; i++) {
+            trues += array_get_bool(arr, i);
+        }
+        Value out = value_bool_array(arr->count);
+        for (size_t i = 0; i < arr->count; i++) {
+            bool first_part = i < (desc ? trues : arr->count - trues);
+            array_set_bool(out.as.array_val, i, desc ? first_part : !first_part);
+        }
+        return out;
+    }
+
+    if (arr->kind == ARRAY_VALUES) {
+        /* ints mixed with nothing else still take the radix sort */
+        size_t i = 0;
+        while (i < arr->count && arr->items[i].type == VAL_INT) {
+            i++;
+        }
+        if (i == arr->count && arr->count > 0) {
+            int64_t *ints = malloc(sizeof(int64_t) * arr->count);
+            if (!ints) {
+                runtime_error("Out of memory");
+            }
+            for (i = 0; i < arr->count; i++) {
+                ints[i] = arr->items[i].as.int_val;
+            }
+            Value out = sort_ints_copy(ints, arr->count, desc);
+            free(ints);
+            return out;
+        }
+    }
+
+    return sort_boxed(arr, desc ? less_desc : less_asc, NULL, stable);
+}
+
+/* sort(arr) / sort(arr, stable) -> a sorted copy, smallest first. Int
+   arrays are radix sorted; anything else uses pattern-defeating
+   quicksort, or a merge sort when stable is true. */
+Value builtin_sort(Value *args, size_t argc) {
+    return sort_natural(args, argc, false, "sort expects (array, optional bool stable)");
+}
+
+/* sort_desc(arr) / sort_desc(arr, stable) -> a sorted copy, largest first. */
+Value builtin_sort_desc(Value *args, size_t argc) {
+    return sort_natural(args, argc, true, "sort_desc expects (array, optional bool stable)");
+}
+
+/* sort_by(arr, less) / sort_by(arr, less, stable) -> a copy sorted by
+   less(a, b), which says whether a goes before b. */
+Value builtin_sort_by(Value *args, size_t argc) {
+    const char *msg = "sort_by expects (array, function less, optional bool stable)";
+
+    if (argc != 2 && argc != 3) {
+        runtime_error(msg);
+    }
+    if (args[0].type != VAL_ARRAY) {
+        runtime_error(msg);
+    }
+
+    bool stable = optional_stable(args, argc, 2, msg);
+    Callback cb;
+    callback_init(&cb, args[1], 2);
+    Value out = sort_boxed(args[0].as.array_val, less_callback, &cb, stable);
+    callback_free(&cb);
+    return out;
+}
+
+/* =========================
+   Memoization
+   ========================= */
+
+/* memo(f) or memo(f, limit): f with a result table. Calls with equal
+   arguments (ints, bools, strings, bigints, arrays and records, compared
+   by content) run f once; a limit keeps at most that many results, the
+   least recently used going first. Rebinding the name, as in
+   `fib = memo(fib)`, also catches the recursive calls f makes. */
+Value builtin_memo(Value *args, size_t argc) {
+    if (argc != 1 && argc != 2) {
+        runtime_error("memo expects one or two arguments");
+    }
+    if (args[0].type != VAL_FUNCTION ||
+        (argc == 2 && (args[1].type != VAL_INT || args[1].as.int_val < 1))) {
+        runtime_error("memo expects (function, optional int limit >= 1)");
+    }
+
+    size_t limit = argc == 2 ? (size_t)args[1].as.int_val : 0;
+    Value out = value_clone(args[0]);
+    Function *fn = out.as.fn_val;
+
+    memo_release(fn->memo);
+    fn->memo = memo_new(fn->param_count, limit);
+    return out;
+}
+
+/* memo_stats(f) -> {"hits", "misses", "evictions", "size"} for a
+   function from memo(). */
+Value builtin_memo_stats(Value *args, size_t argc) {
+    if (argc != 1) {
+        runtime_error("memo_stats expects exactly one argument");
+    }
+    if (args[0].type != VAL_FUNCTION || !args[0].as.fn_val->memo) {
+        runtime_error("memo_stats expects a function from memo()");
+    }
+
+    MemoStats s = memo_stats(args[0].as.fn_val->memo);
+    Value out = value_map();
+    map_put(out, "hits", value_int((int64_t)s.hits));
+    map_put(out, "misses", value_int((int64_t)s.misses));
+    map_put(out, "evictions", value_int((int64_t)s.evictions));
+    map_put(out, "size", value_int((int64_t)s.count));
+    return out;
+}
+
+/* =========================
+   Map builtins
+   ========================= */
+
+static const Map *expect_map(Value v, const char *msg) {
+    if (v.type != VAL_MAP) {
+        runtime_error(msg);
+    }
+    return v.as.map_val;
+}
+
+/* has(m, key) */
+Value builtin_has(Value *args, size_t argc) {
+    if (argc != 2) {
+        runtime_error("has expects exactly two arguments");
+    }
+
+    const Map *map = expect_map(args[0], "has expects (map, key)");
+    return value_bool(map_find(map, args[1]) != NULL);
+}
+
+/* keys(m): keys in insertion order */
+Value builtin_keys(Value *args, size_t argc) {
+    if (argc != 1) {
+        runtime_error("keys expects exactly one argument");
+    }
+
+    const Map *map = expect_map(args[0], "keys expects a map");
+
+    Value out = value_array();
+    array_reserve(out.as.array_val, map->count);
+
+    for (size_t i = 0; i < map->used; i++) {
+        if (!map->entries[i].deleted) {
+            array_push(out.as.array_val, value_clone(map->entries[i].key));
+        }
+    }
+    return out;
+}
+
+/* remove(m, key): true when the key was present */
+Value builtin_remove(Value *args, size_t argc) {
+    if (argc != 2) {
+        runtime_error("remove expects exactly two arguments");
+    }
+
+    expect_map(args[0], "remove expects (map, key)");
+    return value_bool(map_remove(args[0].as.map_val, args[1]));
+}
+
+/* =========================
+   Packed array builtins
+   ========================= */
+
+/* Returns the array's elements as raw int64_t. Packed arrays are used in
+   place; a Value array of ints is unpacked into *tmp (caller frees). */
+static const int64_t *int_elems(Value v, const char *who, int64_t **tmp) {
+    *tmp = NULL;
+
+    if (v.type != VAL_ARRAY) {
+        runtime_error(who);
+    }
+
+    const Array *arr = v.as.array_val;
+
+    if (arr->kind == ARRAY_INTS) {
+        return arr->ints;
+    }
+    if (arr->kind != ARRAY_VALUES && arr->count > 0) {
+        runtime_error(who);
+    }
+
+    *tmp = malloc(sizeof(int64_t) * (arr->count ? arr->count : 1));
+    if (!*tmp) {
+        runtime_error("Out of memory");
+    }
+
+    for (size_t i = 0; i < arr->count; i++) {
+        if (arr->items[i].type != VAL_INT) {
+            runtime_error(who);
+        }
+        (*tmp)[i] = arr->items[i].as.int_val;
+    }
+    return *tmp;
+}
+
+/* Whether a Value array holds a bigint, which sends the arithmetic
+   builtins down their exact path. */
+static bool holds_bigint(Value v) {
+    if (v.type != VAL_ARRAY || v.as.array_val->kind != ARRAY_VALUES) {
+        return false;
+    }
+    const Array *arr = v.as.array_val;
+    for (size_t i = 0; i < arr->count; i++) {
+        if (arr->items[i].type == VAL_BIGINT) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* a + b or a * b on ints and bigints, promoting on overflow the way the
+   interpreter's operators do; a and b are consumed. */
+static Value exact_arith(Value a, Value b, int mul, const char *who) {
+    if ((a.type != VAL_INT && a.type != VAL_BIGINT) ||
+        (b.type != VAL_INT && b.type != VAL_BIGINT)) {
+        runtime_error(who);
+    }
+
+    int64_t r;
+    if (a.type == VAL_INT && b.type == VAL_INT &&
+        !(mul ? __builtin_mul_overflow(a.as.int_val, b.as.int_val, &r)
+              : __builtin_add_overflow(a.as.int_val, b.as.int_val, &r))) {
+        return value_int(r);
+    }
+
+    Value out = mul ? bigint_mul(a, b) : bigint_add(a, b);
+    value_free(a);
+    value_free(b);
+    return out;
+}
+
+Value builtin_sum(Value *args, size_t argc) {
+    const char *who = "sum expects an int array";
+    if (argc != 1) {
+        runtime_error("sum expects exactly one argument");
+    }
+
+    /* bools sum to the number of trues */
+    if (args[0].type == VAL_ARRAY && args[0].as.array_val->kind == ARRAY_BOOLS) {
+        const Array *arr = args[0].as.array_val;
+        return value_int((int64_t)simd_popcount_bits(arr->bits, arr->count));
+    }
+
+    if (!holds_bigint(args[0])) {
+        int64_t *tmp;
+        const int64_t *xs = int_elems(args[0], who, &tmp);
+        int64_t total;
+        bool exact = simd_sum_i64(xs, args[0].as.array_val->count, &total);
+
+        free(tmp);
+        if (exact) {
+            return value_int(total);
+        }
+    }
+
+    /* Past int64_t: add one element at a time, in bigints once needed. */
+    const Array *arr = args[0].as.array_val;
+    Value total = value_int(0);
+    for (size_t i = 0; i < arr->count; i++) {
+        total = exact_arith(total, array_get(arr, i), 0, who);
+    }
+    return total;
+}
+
+static Value min_max(Value *args, size_t argc, int want_max) {
+    const char *who = want_max ? "max expects a non-empty int array"
+                               : "min expects a non-empty int array";
+    if (argc != 1) {
+        runtime_error(want_max ? "max expects exactly one argument"
+                               : "min expects exactly one argument");
+    }
+
+    /* With bigints among the ints: compare one element at a time. */
+    if (holds_bigint(args[0])) {
+        const Array *arr = args[0].as.array_val;
+        Value best = arr->items[0];
+        for (size_t i = 0; i < arr->count; i++) {
+            Value x = arr->items[i];
+            if (x.type != VAL_INT && x.type != VAL_BIGINT) {
+                runtime_error(who);
+            }
+            int c = bigint_cmp(x, best);
+            if (want_max ? c > 0 : c < 0) {
+                best = x;
+            }
+        }
+        return value_clone(best);
+    }
+
+    int64_t *tmp;
+    const int64_t *xs = int_elems(args[0], who, &tmp);
+    size_t n = args[0].as.array_val->count;
+
+    if (n == 0) {
+        runtime_error(who);
+    }
+
+    int64_t m = want_max ? simd_max_i64(xs, n) : simd_min_i64(xs, n);
+    free(tmp);
+    return value_int(m);
+}
+
+Value builtin_min(Value *args, size_t argc) {
+    return min_max(args, argc, 0);
+}
+
+Value builtin_max(Value *args, size_t argc) {
+    return min_max(args, argc, 1);
+}
+
+Value builtin_count_eq(Value *args, size_t argc) {
+    if (argc != 2) {
+        runtime_error("count_eq expects exactly two arguments");
+    }
+    if (args[0].type != VAL_ARRAY) {
+        runtime_error("count_eq expects (array, value)");
+    }
+
+    const Array *arr = args[0].as.array_val;
+    Value x = args[1];
+
+    if (arr->kind == ARRAY_INTS) {
+        if (x.type != VAL_INT) {
+            return value_int(0);
+        }
+        return value_int((int64_t)simd_count_eq_i64(arr->ints, arr->count,
+                                                    x.as.int_val));
+    }
+
+    if (arr->kind == ARRAY_BOOLS) {
+        if (x.type != VAL_BOOL) {
+            return value_int(0);
+        }
+        size_t trues = simd_popcount_bits(arr->bits, arr->count);
+        return value_int((int64_t)(x.as.bool_val ? trues
+                                                 : arr->count - trues));
+    }
+
+    size_t count = 0;
+    for (size_t i = 0; i < arr->count; i++) {
+        Value item = array_get(arr, i);
+        count += value_equal(item, x);
+        value_free(item);
+    }
+    return value_int((int64_t)count);
+}
+
+/* The slow path of elem_add / elem_mul: element by element, with any
+   result past int64_t as a bigint. */
+static Value elementwise_exact(Value *args, size_t n, int mul, const char *who) {
+    const Array *a = args[0].as.array_val;
+    const Array *b = args[1].as.array_val;
+    Value *items = malloc(sizeof(Value) * (n ? n : 1));
+    if (!items) {
+        runtime_error("Out of memory");
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        items[i] = exact_arith(array_get(a, i), array_get(b, i), mul, who);
+    }
+    return value_array_from_values(items, n);
+}
+
+static Value elementwise(Value *args, size_t argc, int mul) {
+    const char *who = mul ? "elem_mul expects two int arrays of equal length"
+                          : "elem_add expects two int arrays of equal length";
+    if (argc != 2) {
+        runtime_error(who);
+    }
+
+    if (holds_bigint(args[0]) || holds_bigint(args[1])) {
+        if (args[0].type != VAL_ARRAY || args[1].type != VAL_ARRAY ||
+            args[0].as.array_val->count != args[1].as.array_val->count) {
+            runtime_error(who);
+        }
+        return elementwise_exact(args, args[0].as.array_val->count, mul, who);
+    }
+
+    int64_t *tmp_a;
+    int64_t *tmp_b;
+    const int64_t *a = int_elems(args[0], who, &tmp_a);
+    const int64_t *b = int_elems(args[1], who, &tmp_b);
+    size_t n = args[0].as.array_val->count;
+
+    if (args[1].as.array_val->count != n) {
+        runtime_error(who);
+    }
+
+    Value out = value_int_array(n);
+    bool exact = mul ? simd_mul_i64(out.as.array_val->ints, a, b, n)
+                     : simd_add_i64(out.as.array_val->ints, a, b, n);
+
+    free(tmp_a);
+    free(tmp_b);
+    if (exact) {
+        return out;
+    }
+    value_free(out);
+    return elementwise_exact(args, n, mul, who);
+}
+
+Value builtin_elem_add(Value *args, size_t argc) {
+    return elementwise(args, argc, 0);
+}
+
+Value builtin_elem_mul(Value *args, size_t argc) {
+    return elementwise(args, argc, 1);
+}
+
+/* int_array(n, fill) / bool_array(n, fill): explicit packed arrays. */
+Value builtin_int_array(Value *args, size_t argc) {
+    if (argc != 2 || args[0].type != VAL_INT || args[1].type != VAL_INT ||
+        args[0].as.int_val < 0) {
+        runtime_error("int_array expects (int count, int fill)");
+    }
+
+    size_t n = (size_t)args[0].as.int_val;
+    int64_t fill = args[1].as.int_val;
+    Value out = value_int_array(n);
+
+    if (fill != 0) {
+        for (size_t i = 0; i < n; i++) {
+            out.as.array_val->ints[i] = fill;
+        }
+    }
+    return out;
+}
+
+Value builtin_bool_array(Value *args, size_t argc) {
+    if (argc != 2 || args[0].type != VAL_INT || args[1].type != VAL_BOOL ||
+        args[0].as.int_val < 0) {
+        runtime_error("bool_array expects (int count, bool fill)");
+    }
+
+    size_t n = (size_t)args[0].as.int_val;
+    Value out = value_bool_array(n);
+
+    if (args[1].as.bool_val && n > 0) {
+        memset(out.as.array_val->bits, 0xff,
+               sizeof(uint64_t) * ((n + 63) / 64));
+    }
+    return out;
+}
+
+/* range(start, end): packed ints start, start+1, ..., end-1 */
+Value builtin_range(Value *args, size_t argc) {
+    if (argc != 2 || args[0].type != VAL_INT || args[1].type != VAL_INT) {
+        runtime_error("range expects (int start, int end)");
+    }
+
+    int64_t start = args[0].as.int_val;
+    int64_t end = args[1].as.int_val;
+    /* end - start can overflow int64_t; the unsigned difference cannot */
+    uint64_t span = end > start ? (uint64_t)end - (uint64_t)start : 0;
+    Value out = value_int_array(0);
+
+    if (span == 0) {
+        return out;
+    }
+    int64_t *ints = span <= SIZE_MAX / sizeof(int64_t)
+                  ? malloc(sizeof(int64_t) * (size_t)span) : NULL;
+    if (!ints) {
+        value_free(out);
+        runtime_error("range too large");
+    }
+
+    size_t n = (size_t)span;
+    for (size_t i = 0; i < n; i++) {
+        ints[i] = (int64_t)((uint64_t)start + i);
+    }
+    out.as.array_val->ints = ints;
+    out.as.array_val->count = n;
+    out.as.array_val->capacity = n;
+    return out;
+}
@@ -0,0 +1,90 @@
+#ifndef BUILTINS_H
+#define BUILTINS_H
+
+#include "value.h"
+
+/* All builtins borrow their arguments and return an owned value. */
+
+/* Builtins that mutate their first argument in place. The interpreter
+   passes them the caller's own (uniquely owned) storage when the
+   argument is a variable or an indexed element. */
+bool builtin_mutates_first_arg(BuiltinFn fn);
+
+/* Builtins called for their effect: a bare call statement does not
+   echo their result. */
+bool builtin_is_quiet(BuiltinFn fn);
+
+Value builtin_print(Value *args, size_t argc);
+Value builtin_flush(Value *args, size_t argc);
+Value builtin_len(Value *args, size_t argc);
+Value builtin_substr(Value *args, size_t argc);
+Value builtin_find(Value *args, size_t argc);
+Value builtin_count(Value *args, size_t argc);
+Value builtin_split(Value *args, size_t argc);
+Value builtin_split_lines(Value *args, size_t argc);
+Value builtin_split_whitespace(Value *args, size_t argc);
+Value builtin_join(Value *args, size_t argc);
+Value builtin_match(Value *args, size_t argc);
+Value builtin_search(Value *args, size_t argc);
+Value builtin_find_all(Value *args, size_t argc);
+Value builtin_replace(Value *args, size_t argc);
+Value builtin_str(Value *args, size_t argc);
+Value builtin_to_int(Value *args, size_t argc);
+Value builtin_parse_ints(Value *args, size_t argc);
+Value builtin_format(Value *args, size_t argc);
+Value builtin_to_bytes(Value *args, size_t argc);
+Value builtin_to_str(Value *args, size_t argc);
+Value builtin_push(Value *args, size_t argc);
+Value builtin_pop(Value *args, size_t argc);
+Value builtin_reserve(Value *args, size_t argc);
+Value builtin_sort(Value *args, size_t argc);
+Value builtin_sort_desc(Value *args, size_t argc);
+Value builtin_sort_by(Value *args, size_t argc);
+Value builtin_memo(Value *args, size_t argc);
+Value builtin_memo_stats(Value *args, size_t argc);
+
+/* Maps */
+Value builtin_has(Value *args, size_t argc);
+Value builtin_keys(Value *args, size_t argc);
+Value builtin_remove(Value *args, size_t argc);
+Value builtin_read_file(Value *args, size_t argc);
+Value builtin_read_bytes(Value *args, size_t argc);
+Value builtin_read_files(Value *args, size_t argc);
+Value builtin_copy_file(Value *args, size_t argc);
+Value builtin_cat_to_stdout(Value *args, size_t argc);
+Value builtin_spawn(Value *args, size_t argc);
+Value builtin_pipe_between(Value *args, size_t argc);
+Value builtin_wait(Value *args, size_t argc);
+Value builtin_walk(Value *args, size_t argc);
+Value builtin_map_files(Value *args, size_t argc);
+Value builtin_write_file(Value *args, size_t argc);
+Value builtin_write_bytes(Value *args, size_t argc);
+Value builtin_save_value(Value *args, size_t argc);
+Value builtin_load_value(Value *args, size_t argc);
+Value builtin_json_parse(Value *args, size_t argc);
+Value builtin_json_parse_lines(Value *args, size_t argc);
+Value builtin_json_stringify(Value *args, size_t argc);
+
+/* Handles */
+Value builtin_open(Value *args, size_t argc);
+Value builtin_read_line(Value *args, size_t argc);
+Value builtin_read_chunk(Value *args, size_t argc);
+Value builtin_eof(Value *args, size_t argc);
+Value builtin_close(Value *args, size_t argc);
+Value builtin_write(Value *args, size_t argc);
+Value builtin_write_lines(Value *args, size_t argc);
+Value builtin_csv_open(Value *args, size_t argc);
+Value builtin_csv_next(Value *args, size_t argc);
+
+/* Packed arrays */
+Value builtin_sum(Value *args, size_t argc);
+Value builtin_min(Value *args, size_t argc);
+Value builtin_max(Value *args, size_t argc);
+Value builtin_count_eq(Value *args, size_t argc);
+Value builtin_elem_add(Value *args, size_t argc);
+Value builtin_elem_mul(Value *args, size_t argc);
+Value builtin_int_array(Value *args, size_t argc);
+Value builtin_bool_array(Value *args, size_t argc);
+Value builtin_range(Value *args, size_t argc);
+
+#endif
@@ -0,0 +1,598 @@
+#include "csv.h"
+#include "io.h"
+#include "map.h"
+#include "simd.h"
+#include "error.h"
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define NEWLINE_FLAG  0x80000000u
+#define CSV_MAX_BLOCK (1u << 30)
+
+struct CsvReader {
+    int fd;              /* the handle's */
+    char sep;
+
+    Value block;         /* string over the current block */
+    size_t pos;          /* next unread byte of the block */
+    size_t len;          /* bytes in the block */
+    bool at_end;         /* read() has returned 0 */
+    size_t record;       /* records read, for messages */
+
+    size_t count;        /* selected columns */
+    size_t *cols;        /* file column of each selected column */
+    bool *ints;
+    int *slot;           /* file column -> selected column or -1 */
+    size_t width;        /* file columns that are selected or before one */
+
+    /* Scratch for one block. */
+    SimdCsvBlock *blocks;
+    uint32_t *bounds;    /* field ends relative to pos, NEWLINE_FLAG on
+                            record ends */
+    size_t scratch_cap;  /* bytes the scratch covers */
+};
+
+/* =========================
+   Blocks
+   ========================= */
+
+/* Starts a new block with the unread tail of the current one, then fills
+   it from the file. Views into the old block keep it alive. A record
+   that does not fit in half a block doubles the block. */
+static void refill(CsvReader *r) {
+    const char *old = r->block.as.str_val.data;
+    size_t carry = r->len - r->pos;
+    size_t cap = CSV_BLOCK;
+
+    while (cap < carry * 2) {
+        cap *= 2;
+    }
+    if (cap > CSV_MAX_BLOCK) {
+        runtime_error("CSV record too long");
+    }
+
+    Value block = value_string_alloc(cap);
+    char *dst = block.as.str_val.buf->bytes;
+    size_t len = carry;
+
+    memcpy(dst, old + r->pos, carry);
+    while (len < cap && !r->at_end) {
+        ssize_t n = read(r->fd, dst + len, cap - len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            runtime_error("Failed to read from handle");
+        }
+        if (n == 0) {
+            r->at_end = true;
+        }
+        len += (size_t)n;
+    }
+
+    value_free(r->block);
+    r->block = block;
+    r->pos = 0;
+    r->len = len;
+}
+
+/* Finds the field ends in the unread part of the block. Returns how
+   many of them belong to complete records and counts those records. At
+   the end of input a last record without a newline is complete too; it
+   gets a record end at the end of the block. */
+static size_t scan(CsvReader *r, size_t *records) {
+    const char *p = r->block.as.str_val.data + r->pos;
+    size_t n = r->len - r->pos;
+
+    if (n + 64 > r->scratch_cap) {
+        r->scratch_cap = n + 64;
+        free(r->blocks);
+        free(r->bounds);
+        r->blocks = malloc(sizeof(SimdCsvBlock) * (r->scratch_cap / 64 + 1));
+        r->bounds = malloc(sizeof(uint32_t) * (r->scratch_cap + 1));
+        if (!r->blocks || !r->bounds) {
+            runtime_error("Out of memory");
+        }
+    }
+
+    simd_csv_blocks(p, n, r->sep, r->blocks);
+
+    uint32_t *bounds = r->bounds;
+    size_t count = 0;
+    size_t complete = 0;
+    size_t lines = 0;
+    uint64_t in_quote = 0;
+
+    for (size_t w = 0; w * 64 < n; w++) {
+        const SimdCsvBlock *b = &r->blocks[w];
+        uint64_t quoted = simd_prefix_xor(b->quote) ^ in_quote;
+        in_quote = (uint64_t)((int64_t)quoted >> 63);
+
+        uint64_t ends = (b->sep | b->newline) & ~quoted;
+        uint64_t newlines = b->newline & ~quoted;
+
+        while (ends) {
+            int at = __builtin_ctzll(ends);
+            uint64_t bit = (uint64_t)1 << at;
+            bool nl = (newlines & bit) != 0;
+
+            bounds[count++] = (uint32_t)(w * 64 + (size_t)at) |
+                              (nl ? NEWLINE_FLAG : 0);
+            if (nl) {
+                complete = count;
+                lines++;
+            }
+            ends &= ends - 1;
+        }
+    }
+
+    size_t last_end = complete > 0 ? (bounds[complete - 1] & ~NEWLINE_FLAG) + 1 : 0;
+    if (r->at_end && last_end < n) {
+        bounds[count++] = (uint32_t)n | NEWLINE_FLAG;
+        complete = count;
+        lines++;
+    }
+
+    *records = lines;
+    return complete;
+}
+
+/* =========================
+   Fields
+   ========================= */
+
+/* The text of the field p[start, end): a trailing \r of a record is
+   dropped, and a quoted field loses its quotes. Sets *doubled when the
+   text still holds doubled quotes to undo. */
+static void field_text(const char *p, size_t start, size_t end, bool nl,
+                       size_t *from, size_t *to, bool *doubled) {
+    if (nl && end > start && p[end - 1] == '\r') {
+        end--;
+    }
+    *doubled = false;
+
+    if (end > start && p[start] == '"') {
+        start++;
+        if (end > start && p[end - 1] == '"') {
+            end--;
+        }
+        *doubled = memchr(p + start, '"', end - start) != NULL;
+    }
+    *from = start;
+    *to = end;
+}
+
+static Value field_string(CsvReader *r, size_t start, size_t end, bool nl) {
+    const char *p = r->block.as.str_val.data;
+    size_t from;
+    size_t to;
+    bool doubled;
+
+    field_text(p, start, end, nl, &from, &to, &doubled);
+    if (!doubled) {
+        return value_string_view(r->block, from, to - from);
+    }
+
+    Value s = value_string_alloc(to - from);
+    char *dst = s.as.str_val.buf->bytes;
+    size_t len = 0;
+    for (size_t i = from; i < to; i++) {
+        dst[len++] = p[i];
+        if (p[i] == '"' && i + 1 < to && p[i + 1] == '"') {
+            i++;
+        }
+    }
+    dst[len] = '\0';
+    s.as.str_val.buf->used = len;
+    s.as.str_val.len = len;
+    return s;
+}
+
+static int64_t field_int_slow(CsvReader *r, size_t start, size_t end, bool nl,
+                              size_t column) {
+    const char *p = r->block.as.str_val.data;
+    size_t from;
+    size_t to;
+    bool doubled;
+
+    field_text(p, start, end, nl, &from, &to, &doubled);
+
+    size_t i = from;
+    bool neg = false;
+    if (i < to && (p[i] == '-' || p[i] == '+')) {
+        neg = p[i] == '-';
+        i++;
+    }
+
+    uint64_t mag = 0;
+    bool ok = i < to || from == to;
+    for (; i < to && ok; i++) {
+        unsigned d = (unsigned char)p[i] - '0';
+        ok = d <= 9 && !__builtin_mul_overflow(mag, 10, &mag) &&
+             !__builtin_add_overflow(mag, d, &mag);
+    }
+    if (!ok || mag > (uint64_t)INT64_MAX + neg) {
+        char msg[128];
+        snprintf(msg, sizeof(msg), "csv_next: column %zu of record %zu is not an int",
+                 column, r->record + 1);
+        runtime_error(msg);
+    }
+    return neg ? (int64_t)(0 - mag) : (int64_t)mag;
+}
+
+/* Up to 18 plain digits, optionally after a '-', cannot overflow and
+   need no unquoting; anything else takes the careful path. Up to 8
+   digits are converted together when 8 bytes can be loaded. */
+static inline int64_t field_int(CsvReader *r, size_t start, size_t end, bool nl,
+                                size_t column) {
+    const char *p = r->block.as.str_val.data + start;
+    size_t n = end - start;
+    bool neg = n > 0 && p[0] == '-';
+    size_t i = neg;
+    size_t digits = n - i;
+
+    if (n > i && digits <= 8 && start + i + 8 <= r->len) {
+        uint64_t x;
+        memcpy(&x, p + i, 8);
+        x <<= 8 * (8 - digits);   /* leading zero bytes read as '0' */
+        uint64_t pad = digits < 8 ? 0x3030303030303030u >> (8 * digits) : 0;
+        if (simd_is_digits8(x | pad)) {
+            int64_t v = (int64_t)simd_digits8(x);
+            return neg ? -v : v;
+        }
+    }
+    if (n > i && digits <= 18) {
+        uint64_t mag = 0;
+        for (; i < n; i++) {
+            unsigned d = (unsigned char)p[i] - '0';
+            if (d > 9) {
+                break;
+            }
+            mag = mag * 10 + d;
+        }
+        if (i == n) {
+            return neg ? -(int64_t)mag : (int64_t)mag;
+        }
+    }
+    return field_int_slow(r, start, end, nl, column);
+}
+
+/* =========================
+   Reading
+   ========================= */
+
+/* Scans for at least one complete record, reading more (into a bigger
+   block if one record needs it) until there is one or the input ends.
+   Returns the number of field ends to use. */
+static size_t next_records(CsvReader *r, size_t *records) {
+    if (!r->at_end) {
+        refill(r);
+    }
+    for (;;) {
+        size_t used = scan(r, records);
+        if (used > 0 || r->at_end) {
+            return used;
+        }
+        refill(r);
+    }
+}
+
+Value csv_next(Handle *h) {
+    CsvReader *r = h->csv;
+    size_t records;
+    size_t used = next_records(r, &records);
+    const char *p = r->block.as.str_val.data + r->pos;
+    size_t rows_max = records;
+
+    Value *out = malloc(sizeof(Value) * (r->count ? r->count : 1));
+    Value **strs = calloc(r->count ? r->count : 1, sizeof(Value *));
+    if (!out || !strs) {
+        runtime_error("Out of memory");
+    }
+    for (size_t k = 0; k < r->count; k++) {
+        if (r->ints[k]) {
+            out[k] = value_int_array(rows_max);
+        } else {
+            strs[k] = malloc(sizeof(Value) * (rows_max ? rows_max : 1));
+            if (!strs[k]) {
+                runtime_error("Out of memory");
+            }
+        }
+    }
+
+    const uint32_t *bounds = r->bounds;
+    const int *slot = r->slot;
+    const bool *ints = r->ints;
+    size_t width = r->width;
+    size_t base = r->pos;
+    size_t row = 0;
+    size_t field = 0;
+    size_t start = 0;
+
+    for (size_t i = 0; i < used; i++) {
+        uint32_t bound = bounds[i];
+        size_t end = bound & ~NEWLINE_FLAG;
+        bool nl = (bound & NEWLINE_FLAG) != 0;
+
+        if (nl && field == 0 && (end == start ||
+            (end == start + 1 && p[start] == '\r'))) {
+            start = end + 1;
+            r->record++;
+            continue;
+        }
+
+        if (field < width && slot[field] >= 0) {
+            size_t k = (size_t)slot[field];
+            if (ints[k]) {
+                out[k].as.array_val->ints[row] =
+                    field_int(r, base + start, base + end, nl, field);
+            } else {
+                strs[k][row] = field_string(r, base + start, base + end, nl);
+            }
+        }
+        field++;
+
+        if (nl) {
+            /* short record: the missing fields are empty */
+            for (size_t k = 0; field < r->width && k < r->count; k++) {
+                if (r->cols[k] >= field) {
+                    if (r->ints[k]) {
+                        out[k].as.array_val->ints[row] = 0;
+                    } else {
+                        strs[k][row] = value_string_view(r->block, 0, 0);
+                    }
+                }
+            }
+            row++;
+            field = 0;
+            r->record++;
+        }
+        start = end + 1;
+    }
+
+    /* past the last record end, which may be the end of the block */
+    r->pos = r->pos + start < r->len ? r->pos + start : r->len;
+
+    for (size_t k = 0; k < r->count; k++) {
+        if (r->ints[k]) {
+            out[k].as.array_val->count = row;
+        } else if (row == 0) {
+            free(strs[k]);
+            out[k] = value_array();
+        } else {
+            out[k] = value_array_from_values(strs[k], row);
+        }
+    }
+    free(strs);
+    return value_array_from_values(out, r->count);
+}
+
+/* =========================
+   Opening
+   ========================= */
+
+/* opts[name], or NULL when opts has no such key (or is not a map). */
+static const Value *option(Value opts, const char *name) {
+    if (opts.type != VAL_MAP) {
+        return NULL;
+    }
+    Value key = value_string(name);
+    const Value *v = map_find(opts.as.map_val, key);
+    value_free(key);
+    return v;
+}
+
+/* Reads up to the first record that is not blank and returns its field
+   count, 0 for an empty file. The record stays unread; *end is the
+   offset just past it. */
+static size_t first_record(CsvReader *r, size_t *end) {
+    for (;;) {
+        size_t records;
+        size_t used = scan(r, &records);
+        if (used == 0 && !r->at_end) {
+            refill(r);
+            continue;
+        }
+        if (used == 0) {
+            *end = 0;
+            return 0;
+        }
+
+        const char *p = r->block.as.str_val.data + r->pos;
+        size_t first = r->bounds[0] & ~NEWLINE_FLAG;
+        if ((r->bounds[0] & NEWLINE_FLAG) &&
+            (first == 0 || (first == 1 && p[0] == '\r'))) {
+            r->pos += first + 1 < r->len - r->pos ? first + 1 : r->len - r->pos;
+            continue;
+        }
+
+        size_t fields = 1;
+        while (!(r->bounds[fields - 1] & NEWLINE_FLAG)) {
+            fields++;
+        }
+        *end = (r->bounds[fields - 1] & ~NEWLINE_FLAG) + 1;
+        return fields;
+    }
+}
+
+/* The file column a "columns" or "ints" entry names: a 0-based index or,
+   with a header, a column name. */
+static bool column_of(Value spec, const Value *names, size_t fields,
+                      size_t *col, const char **err) {
+    if (spec.type == VAL_INT) {
+        if (spec.as.int_val < 0 || (uint64_t)spec.as.int_val >= fields) {
+            *err = "csv_open: column index out of range";
+            return false;
+        }
+        *col = (size_t)spec.as.int_val;
+        return true;
+    }
+    if (spec.type != VAL_STRING) {
+        *err = "csv_open: columns must be names or indexes";
+        return false;
+    }
+    if (!names) {
+        *err = "csv_open: column names need a header";
+        return false;
+    }
+    for (size_t i = 0; i < fields; i++) {
+        if (value_equal(names[i], spec)) {
+            *col = i;
+            return true;
+        }
+    }
+    *err = "csv_open: unknown column name";
+    return false;
+}
+
+static bool select_columns(CsvReader *r, const Value *columns, const Value *ints,
+                           const Value *names, size_t fields, const char **err) {
+    r->count = columns ? columns->as.array_val->count : fields;
+    r->cols = malloc(sizeof(size_t) * (r->count ? r->count : 1));
+    r->ints = calloc(r->count ? r->count : 1, sizeof(bool));
+    if (!r->cols || !r->ints) {
+        runtime_error("Out of memory");
+    }
+
+    r->width = 0;
+    for (size_t k = 0; k < r->count; k++) {
+        r->cols[k] = k;
+        if (columns) {
+            Value spec = array_get(columns->as.array_val, k);
+            bool ok = column_of(spec, names, fields, &r->cols[k], err);
+            value_free(spec);
+            if (!ok) {
+                return false;
+            }
+        }
+        if (r->cols[k] + 1 > r->width) {
+            r->width = r->cols[k] + 1;
+        }
+    }
+
+    r->slot = malloc(sizeof(int) * (r->width ? r->width : 1));
+    if (!r->slot) {
+        runtime_error("Out of memory");
+    }
+    for (size_t i = 0; i < r->width; i++) {
+        r->slot[i] = -1;
+    }
+    for (size_t k = 0; k < r->count; k++) {
+        if (r->slot[r->cols[k]] >= 0) {
+            *err = "csv_open: a column is selected twice";
+            return false;
+        }
+        r->slot[r->cols[k]] = (int)k;
+    }
+
+    for (size_t i = 0; ints && i < ints->as.array_val->count; i++) {
+        Value spec = array_get(ints->as.array_val, i);
+        size_t col;
+        bool ok = column_of(spec, names, fields, &col, err);
+        value_free(spec);
+        if (!ok) {
+            return false;
+        }
+        if (col >= r->width || r->slot[col] < 0) {
+            *err = "csv_open: \"ints\" names a column that is not returned";
+            return false;
+        }
+        r->ints[r->slot[col]] = true;
+    }
+    return true;
+}
+
+bool csv_open(const char *path, Value opts, Value *out, const char **err) {
+    if (opts.type != VAL_MAP && !(opts.type == VAL_INT && opts.as.int_val == 0)) {
+        *err = "csv_open options must be a map";
+        return false;
+    }
+
+    const Value *sep = option(opts, "sep");
+    const Value *header = option(opts, "header");
+    const Value *columns = option(opts, "columns");
+    const Value *ints = option(opts, "ints");
+
+    if (sep && (sep->type != VAL_STRING || sep->as.str_val.len != 1 ||
+                memchr("\"\r\n", sep->as.str_val.data[0], 3))) {
+        *err = "csv_open: \"sep\" must be one character other than a quote or newline";
+        return false;
+    }
+    if (header && header->type != VAL_BOOL) {
+        *err = "csv_open: \"header\" must be a bool";
+        return false;
+    }
+    if ((columns && columns->type != VAL_ARRAY) || (ints && ints->type != VAL_ARRAY)) {
+        *err = "csv_open: \"columns\" and \"ints\" must be arrays";
+        return false;
+    }
+
+    Value hv;
+    if (!io_open(path, "r", &hv, err)) {
+        return false;
+    }
+
+    CsvReader *r = calloc(1, sizeof(CsvReader));
+    if (!r) {
+        runtime_error("Out of memory");
+    }
+    r->fd = hv.as.handle_val->fd;
+    r->sep = sep ? sep->as.str_val.data[0] : ',';
+    r->block = value_string_len("", 0);
+    hv.as.handle_val->csv = r;   /* freed with the handle from here on */
+
+    refill(r);
+    size_t end;
+    size_t fields = first_record(r, &end);
+    bool named = !header || header->as.bool_val;
+
+    Value *names = NULL;
+    if (named && fields > 0) {
+        names = malloc(sizeof(Value) * fields);
+        if (!names) {
+            runtime_error("Out of memory");
+        }
+        size_t start = r->pos;
+        for (size_t i = 0; i < fields; i++) {
+            uint32_t bound = r->bounds[i];
+            size_t at = r->pos + (bound & ~NEWLINE_FLAG);
+            names[i] = field_string(r, start, at, (bound & NEWLINE_FLAG) != 0);
+            start = at + 1;
+        }
+    }
+
+    bool ok = select_columns(r, columns, ints, names, fields, err);
+    for (size_t i = 0; names && i < fields; i++) {
+        value_free(names[i]);
+    }
+    free(names);
+    if (!ok) {
+        value_free(hv);
+        return false;
+    }
+
+    if (named) {
+        r->pos += end < r->len - r->pos ? end : r->len - r->pos;
+        r->record = 1;
+    }
+    *out = hv;
+    return true;
+}
+
+bool csv_eof(const CsvReader *r) {
+    return r->at_end && r->pos >= r->len;
+}
+
+void csv_free(CsvReader *r) {
+    value_free(r->block);
+    free(r->cols);
+    free(r->ints);
+    free(r->slot);
+    free(r->blocks);
+    free(r->bounds);
+    free(r);
+}
@@ -0,0 +1,44 @@
+#ifndef CSV_H
+#define CSV_H
+
+#include "value.h"
+#include <stdbool.h>
+
+/* Streaming CSV reading (RFC 4180).
+
+   A CSV handle reads its file a block at a time straight into a string
+   buffer. Each block is classified 64 bytes at a time with the
+   vectorized scanner (quotes, separators, newlines), and the parity of
+   the quotes before each byte tells quoted regions apart, so separators
+   and line breaks inside quotes are data. The unquoted separators and
+   newlines become a list of field ends, and a second pass over that list
+   fills only the selected columns: int columns are parsed straight into
+   packed int arrays, string columns are views into the block (copied
+   only to undo doubled quotes). The record cut by the end of a block is
+   carried into the next one, so memory stays at a block or two however
+   large the file is, plus whatever the script keeps. */
+
+#define CSV_BLOCK (256 << 10)
+
+typedef struct CsvReader CsvReader;
+
+/* Opens path for csv_next. opts (borrowed) is a map or int 0 for none;
+   its keys are all optional:
+     "sep"      one-character string, default ","
+     "header"   bool, default true: the first record names the columns
+     "columns"  array of column names or 0-based indexes to return, in
+                that order; default every column of the first record
+     "ints"     array of names or indexes of returned columns to parse as
+                ints (an empty field is 0)
+   On failure returns false and sets *err to a static message. */
+bool  csv_open(const char *path, Value opts, Value *out, const char **err);
+
+/* The records of the next block: an array holding one array per
+   selected column. Short records read as empty fields and blank lines
+   are skipped. Every column is empty once the input is used up. */
+Value csv_next(Handle *h);
+
+bool  csv_eof(const CsvReader *r);
+void  csv_free(CsvReader *r);
+
+#endif
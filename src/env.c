@@ -1,4 +1,6 @@
 #include "env.h"
+#include "builtins.h"
+#include "io.h"
 #include <stdlib.h>
 #include <string.h>
 
@@ -84,6 +86,21 @@ int env_get(Env *env, const char *name, Value *out) {
     return 0;
 }
 
+/* Get a pointer to the stored value, for in-place updates. */
+
+Value *env_get_ref(Env *env, const char *name) {
+    for (Env *e = env; e != NULL; e = e->parent) {
+        EnvEntry *entry = e->head;
+        while (entry) {
+            if (strcmp(entry->name, name) == 0) {
+                return &entry->value;
+            }
+            entry = entry->next;
+        }
+    }
+    return NULL;
+}
+
 int env_has_local(Env *env, const char *name) {
     EnvEntry *entry = env->head;
     while (entry) {
@@ -95,37 +112,116 @@ int env_has_local(Env *env, const char *name) {
     return 0;
 }
 
+/* Reuse a call's environment for the next call: everything defined
+   after the first count bindings (the parameters) is dropped, and the
+   parameters take the new values, in the order they were defined. */
 
-extern Value builtin_print(Value *args, size_t argc);
-extern Value builtin_len(Value *args, size_t argc);
-extern Value builtin_read_file(Value *args, size_t argc);
-extern Value builtin_write_file(Value *args, size_t argc);
-Env *env_create_global(void) {
-    Env *env = env_create(NULL);
-
-    Value v;
-    v.type = VAL_BUILTIN;
-    v.as.builtin_val = builtin_print;
+void env_rebind(Env *env, size_t count, const Value *values) {
+    size_t total = 0;
+    for (EnvEntry *entry = env->head; entry; entry = entry->next) {
+        total++;
+    }
 
-    env_define(env, "print", v);
+    while (total > count) {
+        EnvEntry *entry = env->head;
+        env->head = entry->next;
+        free(entry->name);
+        value_free(entry->value);
+        free(entry);
+        total--;
+    }
 
-    Value v2;
-    v2.type = VAL_BUILTIN;
-    v2.as.builtin_val = builtin_len;
+    EnvEntry *entry = env->head;
+    for (size_t i = count; i-- > 0; entry = entry->next) {
+        value_free(entry->value);
+        entry->value = value_clone(values[i]);
+    }
+}
 
-    env_define(env, "len", v2);
 
-    Value v3;
-    v3.type = VAL_BUILTIN;
-    v3.as.builtin_val = builtin_read_file;
+static void define_builtin(Env *env, const char *name, BuiltinFn fn) {
+    Value v;
+    v.type = VAL_BUILTIN;
+    v.as.builtin_val = fn;
 
-    env_define(env, "read_file", v3);
+    env_define(env, name, v);
+}
 
-    Value v4;
-    v4.type = VAL_BUILTIN;
-    v4.as.builtin_val = builtin_write_file;
+Env *env_create_global(void) {
+    Env *env = env_create(NULL);
 
-    env_define(env, "write_file", v4);
+    define_builtin(env, "print", builtin_print);
+    define_builtin(env, "flush", builtin_flush);
+    define_builtin(env, "len", builtin_len);
+    define_builtin(env, "substr", builtin_substr);
+    define_builtin(env, "find", builtin_find);
+    define_builtin(env, "count", builtin_count);
+    define_builtin(env, "split", builtin_split);
+    define_builtin(env, "split_lines", builtin_split_lines);
+    define_builtin(env, "split_whitespace", builtin_split_whitespace);
+    define_builtin(env, "join", builtin_join);
+    define_builtin(env, "match", builtin_match);
+    define_builtin(env, "search", builtin_search);
+    define_builtin(env, "find_all", builtin_find_all);
+    define_builtin(env, "replace", builtin_replace);
+    define_builtin(env, "str", builtin_str);
+    define_builtin(env, "to_int", builtin_to_int);
+    define_builtin(env, "parse_ints", builtin_parse_ints);
+    define_builtin(env, "format", builtin_format);
+    define_builtin(env, "to_bytes", builtin_to_bytes);
+    define_builtin(env, "to_str", builtin_to_str);
+    define_builtin(env, "push", builtin_push);
+    define_builtin(env, "pop", builtin_pop);
+    define_builtin(env, "reserve", builtin_reserve);
+    define_builtin(env, "sort", builtin_sort);
+    define_builtin(env, "sort_desc", builtin_sort_desc);
+    define_builtin(env, "sort_by", builtin_sort_by);
+    define_builtin(env, "memo", builtin_memo);
+    define_builtin(env, "memo_stats", builtin_memo_stats);
+    define_builtin(env, "has", builtin_has);
+    define_builtin(env, "keys", builtin_keys);
+    define_builtin(env, "remove", builtin_remove);
+    define_builtin(env, "read_file", builtin_read_file);
+    define_builtin(env, "read_bytes", builtin_read_bytes);
+    define_builtin(env, "read_files", builtin_read_files);
+    define_builtin(env, "copy_file", builtin_copy_file);
+    define_builtin(env, "cat_to_stdout", builtin_cat_to_stdout);
+    define_builtin(env, "spawn", builtin_spawn);
+    define_builtin(env, "pipe_between", builtin_pipe_between);
+    define_builtin(env, "wait", builtin_wait);
+    define_builtin(env, "walk", builtin_walk);
+    define_builtin(env, "map_files", builtin_map_files);
+    define_builtin(env, "write_file", builtin_write_file);
+    define_builtin(env, "write_bytes", builtin_write_bytes);
+    define_builtin(env, "save_value", builtin_save_value);
+    define_builtin(env, "load_value", builtin_load_value);
+    define_builtin(env, "json_parse", builtin_json_parse);
+    define_builtin(env, "json_parse_lines", builtin_json_parse_lines);
+    define_builtin(env, "json_stringify", builtin_json_stringify);
+
+    define_builtin(env, "open", builtin_open);
+    define_builtin(env, "read_line", builtin_read_line);
+    define_builtin(env, "read_chunk", builtin_read_chunk);
+    define_builtin(env, "eof", builtin_eof);
+    define_builtin(env, "close", builtin_close);
+    define_builtin(env, "write", builtin_write);
+    define_builtin(env, "write_lines", builtin_write_lines);
+    define_builtin(env, "csv_open", builtin_csv_open);
+    define_builtin(env, "csv_next", builtin_csv_next);
+
+    define_builtin(env, "sum", builtin_sum);
+    define_builtin(env, "min", builtin_min);
+    define_builtin(env, "max", builtin_max);
+    define_builtin(env, "count_eq", builtin_count_eq);
+    define_builtin(env, "elem_add", builtin_elem_add);
+    define_builtin(env, "elem_mul", builtin_elem_mul);
+    define_builtin(env, "int_array", builtin_int_array);
+    define_builtin(env, "bool_array", builtin_bool_array);
+    define_builtin(env, "range", builtin_range);
+
+    Value in = io_stdin();
+    env_define(env, "stdin", in);
+    value_free(in);
 
     return env;
 }
@@ -11,6 +11,8 @@ void env_free(Env *env);
 void env_define(Env *env, const char *name, Value value);
 int  env_assign(Env *env, const char *name, Value value);
 int  env_get(Env *env, const char *name, Value *out);
+Value *env_get_ref(Env *env, const char *name);
 int env_has_local(Env *env, const char *name);
+void env_rebind(Env *env, size_t count, const Value *values);
 Env *env_create_global(void);
 #endif
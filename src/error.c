@@ -0,0 +1,22 @@
+#include "error.h"
+#include "output.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Errors go through the output buffer so they land after everything
+   printed before them; the exit handler flushes it. */
+
+void runtime_error(const char *msg) {
+    out_cstr(msg);
+    out_line_end();
+    exit(1);
+}
+
+void runtime_error_at(int line, int col, const char *msg) {
+    char prefix[64];
+    snprintf(prefix, sizeof(prefix), "[line %d, col %d] ", line, col);
+    out_cstr(prefix);
+    out_cstr(msg);
+    out_line_end();
+    exit(1);
+}
@@ -0,0 +1,8 @@
+#ifndef ERROR_H
+#define ERROR_H
+
+/* Report a fatal runtime error and exit. */
+void runtime_error(const char *msg);
+void runtime_error_at(int line, int col, const char *msg);
+
+#endif
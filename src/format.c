@@ -0,0 +1,518 @@
+#include "format.h"
+#include "bigint.h"
+#include "output.h"
+#include "simd.h"
+#include "error.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FORMAT_MAX_WIDTH (1 << 20)
+#define NO_FIELD SIZE_MAX
+#define INTS_WINDOW (64 << 10)   /* bytes classified per simd_csv_blocks call */
+
+/* Literal text (with doubled braces collapsed) followed by a field. */
+typedef struct {
+    size_t start;       /* literal is lit[start, start + len) */
+    size_t len;
+    size_t arg;         /* NO_FIELD after the last field */
+    size_t width;       /* 0: no padding */
+    char fill;
+    char align;         /* '<', '>', '^', or 0 for the default */
+    bool zero;
+} Piece;
+
+struct Format {
+    char *text;         /* the source, for format_is */
+    size_t text_len;
+    char *lit;
+    Piece *pieces;
+    size_t count;
+    size_t args;
+};
+
+/* =========================
+   Compiling
+   ========================= */
+
+static bool is_align(char c) {
+    return c == '<' || c == '>' || c == '^';
+}
+
+/* Parses the field that starts after the '{' at text[*i]; leaves *i
+   past its '}'. */
+static bool parse_field(const char *text, size_t len, size_t *i,
+                        size_t *next_arg, Piece *p, const char **err) {
+    size_t at = *i;
+
+    if (at < len && text[at] >= '0' && text[at] <= '9') {
+        p->arg = 0;
+        while (at < len && text[at] >= '0' && text[at] <= '9') {
+            p->arg = p->arg * 10 + (size_t)(text[at] - '0');
+            if (p->arg >= FORMAT_MAX_WIDTH) {
+                *err = "format: argument index too large";
+                return false;
+            }
+            at++;
+        }
+    } else {
+        p->arg = (*next_arg)++;
+    }
+
+    if (at < len && text[at] == ':') {
+        at++;
+        if (at + 1 < len && is_align(text[at + 1])) {
+            p->fill = text[at];
+            p->align = text[at + 1];
+            at += 2;
+        } else if (at < len && is_align(text[at])) {
+            p->align = text[at++];
+        }
+        if (at < len && text[at] == '0') {
+            p->zero = true;
+            at++;
+        }
+        while (at < len && text[at] >= '0' && text[at] <= '9') {
+            p->width = p->width * 10 + (size_t)(text[at] - '0');
+            if (p->width > FORMAT_MAX_WIDTH) {
+                *err = "format: width too large";
+                return false;
+            }
+            at++;
+        }
+    }
+
+    if (at >= len || text[at] != '}') {
+        *err = "format: malformed field (write {{ for a literal brace)";
+        return false;
+    }
+    *i = at + 1;
+    return true;
+}
+
+Format *format_compile(const char *text, size_t len, const char **err) {
+    Format *f = calloc(1, sizeof(Format));
+    if (!f) {
+        runtime_error("Out of memory");
+    }
+    /* at most one field per two bytes, plus the trailing literal */
+    f->text = malloc(len + 1);
+    f->lit = malloc(len + 1);
+    f->pieces = malloc(sizeof(Piece) * (len / 2 + 1));
+    if (!f->text || !f->lit || !f->pieces) {
+        runtime_error("Out of memory");
+    }
+    memcpy(f->text, text, len);
+    f->text_len = len;
+
+    size_t lit_len = 0;
+    size_t start = 0;
+    size_t next_arg = 0;
+    size_t i = 0;
+
+    while (i < len) {
+        char c = text[i];
+
+        if ((c == '{' || c == '}') && i + 1 < len && text[i + 1] == c) {
+            f->lit[lit_len++] = c;
+            i += 2;
+            continue;
+        }
+        if (c == '}') {
+            *err = "format: unmatched } (write }} for a literal brace)";
+            format_free(f);
+            return NULL;
+        }
+        if (c != '{') {
+            f->lit[lit_len++] = c;
+            i++;
+            continue;
+        }
+
+        Piece p = {start, lit_len - start, 0, 0, ' ', 0, false};
+        i++;
+        if (!parse_field(text, len, &i, &next_arg, &p, err)) {
+            format_free(f);
+            return NULL;
+        }
+        if (p.arg + 1 > f->args) {
+            f->args = p.arg + 1;
+        }
+        f->pieces[f->count++] = p;
+        start = lit_len;
+    }
+
+    if (lit_len > start || f->count == 0) {
+        Piece tail = {start, lit_len - start, NO_FIELD, 0, ' ', 0, false};
+        f->pieces[f->count++] = tail;
+    }
+    return f;
+}
+
+bool format_is(const Format *f, const char *text, size_t len) {
+    return f->text_len == len && memcmp(f->text, text, len) == 0;
+}
+
+size_t format_arg_count(const Format *f) {
+    return f->args;
+}
+
+void format_free(Format *f) {
+    if (!f) {
+        return;
+    }
+    free(f->text);
+    free(f->lit);
+    free(f->pieces);
+    free(f);
+}
+
+/* =========================
+   Applying
+   ========================= */
+
+/* The result is built on the stack and copied out once; only long
+   results move to the heap. */
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+    char local[256];
+} Text;
+
+static void grow(Text *t, size_t more) {
+    size_t cap = t->cap * 2;
+    while (cap - t->len < more) {
+        cap *= 2;
+    }
+    char *grown = malloc(cap);
+    if (!grown) {
+        runtime_error("Out of memory");
+    }
+    memcpy(grown, t->data, t->len);
+    if (t->data != t->local) {
+        free(t->data);
+    }
+    t->data = grown;
+    t->cap = cap;
+}
+
+static inline void reserve(Text *t, size_t more) {
+    if (t->cap - t->len < more) {
+        grow(t, more);
+    }
+}
+
+static inline void put(Text *t, const char *s, size_t n) {
+    reserve(t, n);
+    memcpy(t->data + t->len, s, n);
+    t->len += n;
+}
+
+static inline void pad(Text *t, char c, size_t n) {
+    reserve(t, n);
+    memset(t->data + t->len, c, n);
+    t->len += n;
+}
+
+/* Characters in UTF-8 text: bytes that do not continue a sequence. */
+static size_t utf8_length(const char *s, size_t n) {
+    size_t chars = 0;
+    for (size_t i = 0; i < n; i++) {
+        chars += ((unsigned char)s[i] & 0xC0) != 0x80;
+    }
+    return chars;
+}
+
+static void put_field(Text *t, const Piece *p, Value v) {
+    bool number = v.type == VAL_INT || v.type == VAL_BIGINT;
+
+    if (v.type == VAL_INT && p->width == 0) {
+        reserve(t, 20);
+        t->len += format_int(t->data + t->len, v.as.int_val);
+        return;
+    }
+
+    char digits[20];
+    char *big = NULL;
+    Value text;
+    bool owned = false;
+    const char *s;
+    size_t n;
+
+    switch (v.type) {
+        case VAL_INT:
+            s = digits;
+            n = format_int(digits, v.as.int_val);
+            break;
+        case VAL_STRING:
+            s = v.as.str_val.data;
+            n = v.as.str_val.len;
+            break;
+        case VAL_BOOL:
+            s = v.as.bool_val ? "true" : "false";
+            n = strlen(s);
+            break;
+        case VAL_BIGINT:
+            big = bigint_to_cstr(v.as.big_val);
+            s = big;
+            n = strlen(big);
+            break;
+        default:
+            text = value_text(v);
+            owned = true;
+            s = text.as.str_val.data;
+            n = text.as.str_val.len;
+            break;
+    }
+
+    /* width counts characters; only strings can hold multibyte ones */
+    size_t shown = v.type == VAL_STRING ? utf8_length(s, n) : n;
+    size_t fill = p->width > shown ? p->width - shown : 0;
+
+    if (fill == 0) {
+        put(t, s, n);
+    } else if (p->zero && number) {
+        if (s[0] == '-') {
+            put(t, "-", 1);
+            s++;
+            n--;
+        }
+        pad(t, '0', fill);
+        put(t, s, n);
+    } else {
+        char align = p->align ? p->align : number ? '>' : '<';
+        size_t left = align == '>' ? fill : align == '^' ? fill / 2 : 0;
+        pad(t, p->fill, left);
+        put(t, s, n);
+        pad(t, p->fill, fill - left);
+    }
+
+    free(big);
+    if (owned) {
+        value_free(text);
+    }
+}
+
+Value format_apply(const Format *f, const Value *args, size_t argc) {
+    (void)argc;
+
+    Text t;
+    t.data = t.local;
+    t.len = 0;
+    t.cap = sizeof(t.local);
+
+    for (size_t i = 0; i < f->count; i++) {
+        const Piece *p = &f->pieces[i];
+        put(&t, f->lit + p->start, p->len);
+        if (p->arg != NO_FIELD) {
+            put_field(&t, p, args[p->arg]);
+        }
+    }
+
+    Value out = value_string_len(t.data, t.len);
+    if (t.data != t.local) {
+        free(t.data);
+    }
+    return out;
+}
+
+/* =========================
+   Parsing ints
+   ========================= */
+
+/* The value of the n digits at p, 1 <= n <= 18 (so it cannot
+   overflow), where room bytes from p may be read. Digits go eight at a
+   time with SWAR: a first, partial chunk is loaded whole and its extra
+   bytes shifted out, then full chunks. Fewer than eight digits at the
+   very end of the text are taken one at a time. */
+static bool digits_value(const char *p, size_t n, size_t room, uint64_t *out) {
+    uint64_t v = 0;
+    size_t i = 0;
+
+    if (n < 8 && room < 8) {
+        for (; i < n; i++) {
+            unsigned d = (unsigned char)p[i] - '0';
+            if (d > 9) {
+                return false;
+            }
+            v = v * 10 + d;
+        }
+        *out = v;
+        return true;
+    }
+
+    size_t head = n % 8;
+    uint64_t x;
+
+    if (head > 0) {
+        memcpy(&x, p, 8);
+        x <<= 8 * (8 - head);
+        if (!simd_is_digits8(x | (0x3030303030303030u >> (8 * head)))) {
+            return false;
+        }
+        v = simd_digits8(x);
+        i = head;
+    }
+    for (; i < n; i += 8) {
+        memcpy(&x, p + i, 8);
+        if (!simd_is_digits8(x)) {
+            return false;
+        }
+        v = v * 100000000 + simd_digits8(x);
+    }
+    *out = v;
+    return true;
+}
+
+bool parse_int(const char *s, size_t len, Value *out) {
+    size_t i = 0;
+    bool neg = false;
+
+    if (len > 0 && (s[0] == '-' || s[0] == '+')) {
+        neg = s[0] == '-';
+        i = 1;
+    }
+
+    size_t digits = len - i;
+    if (digits == 0) {
+        return false;
+    }
+
+    if (digits <= 18) {
+        uint64_t v;
+        if (!digits_value(s + i, digits, digits, &v)) {
+            return false;
+        }
+        *out = value_int(neg ? -(int64_t)v : (int64_t)v);
+        return true;
+    }
+
+    for (size_t k = i; k < len; k++) {
+        unsigned d = (unsigned char)s[k] - '0';
+        if (d > 9) {
+            return false;
+        }
+    }
+    *out = bigint_from_digits(s + i, digits, neg);
+    return true;
+}
+
+/* One field of parse_ints, s[start, end) with any '\r' of a line end
+   already dropped, where the text goes on to s + len. */
+static bool list_field(const char *s, size_t start, size_t end, size_t len,
+                       int64_t *out) {
+    bool neg = false;
+
+    if (start < end && (s[start] == '-' || s[start] == '+')) {
+        neg = s[start] == '-';
+        start++;
+    }
+    /* leading zeros do not count against the 19-digit limit */
+    while (end - start > 19 && s[start] == '0') {
+        start++;
+    }
+
+    size_t digits = end - start;
+    uint64_t v;
+
+    if (digits == 0 || digits > 19 ||
+        !digits_value(s + start, digits < 19 ? digits : 18, len - start, &v)) {
+        return false;
+    }
+    if (digits == 19) {
+        unsigned d = (unsigned char)s[end - 1] - '0';
+        if (d > 9 || __builtin_mul_overflow(v, 10, &v) ||
+            __builtin_add_overflow(v, d, &v) || v > (uint64_t)INT64_MAX + neg) {
+            return false;
+        }
+    }
+    *out = neg ? (int64_t)(0 - v) : (int64_t)v;
+    return true;
+}
+
+typedef struct {
+    int64_t *xs;
+    size_t count;
+    size_t cap;
+    size_t start;       /* of the current field */
+    bool line_start;    /* the current field starts a line */
+} IntList;
+
+/* Ends the current field at s[end], a separator, a '\n' or the end of
+   the text. A line with nothing on it is skipped. */
+static bool end_field(IntList *l, const char *s, size_t len, size_t end) {
+    bool nl = end == len || s[end] == '\n';
+    size_t field_end = nl && end > l->start && s[end - 1] == '\r' ? end - 1 : end;
+
+    if (field_end == l->start && nl && l->line_start) {
+        l->start = end + 1;
+        return true;
+    }
+    if (l->count == l->cap) {
+        l->cap *= 2;
+        l->xs = realloc(l->xs, sizeof(int64_t) * l->cap);
+        if (!l->xs) {
+            runtime_error("Out of memory");
+        }
+    }
+    if (!list_field(s, l->start, field_end, len, &l->xs[l->count])) {
+        return false;
+    }
+    l->count++;
+    l->start = end + 1;
+    l->line_start = nl;
+    return true;
+}
+
+/* Field ends come from the vectorized CSV classifier (the separator and
+   '\n'), a window at a time; its quote bits go unused. */
+bool parse_ints(const char *s, size_t len, char sep, Value *out, size_t *bad) {
+    SimdCsvBlock blocks[INTS_WINDOW / 64];
+    IntList l;
+
+    l.cap = len / 2 + 1 < 4096 ? len / 2 + 1 : 4096;
+    l.xs = malloc(sizeof(int64_t) * l.cap);
+    l.count = 0;
+    l.start = 0;
+    l.line_start = true;
+    if (!l.xs) {
+        runtime_error("Out of memory");
+    }
+
+    bool ok = true;
+    for (size_t base = 0; ok && base < len; base += INTS_WINDOW) {
+        size_t n = len - base < INTS_WINDOW ? len - base : INTS_WINDOW;
+        simd_csv_blocks(s + base, n, sep, blocks);
+
+        for (size_t w = 0; ok && w * 64 < n; w++) {
+            uint64_t ends = blocks[w].sep | blocks[w].newline;
+            while (ok && ends) {
+                size_t end = base + w * 64 + (size_t)__builtin_ctzll(ends);
+                ok = end_field(&l, s, len, end);
+                ends &= ends - 1;
+            }
+        }
+    }
+
+    /* a last field without a line end; a separator at the very end of
+       the text does not start another one */
+    if (ok && l.start < len) {
+        ok = end_field(&l, s, len, len);
+    }
+    if (!ok) {
+        free(l.xs);
+        *bad = l.start;
+        return false;
+    }
+
+    *out = value_int_array(0);
+    if (l.count > 0) {
+        out->as.array_val->ints = l.xs;
+        out->as.array_val->count = l.count;
+        out->as.array_val->capacity = l.cap;
+    } else {
+        free(l.xs);
+    }
+    return true;
+}
@@ -0,0 +1,50 @@
+#ifndef FORMAT_H
+#define FORMAT_H
+
+#include "value.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/* format(fmt, args...), to_int(s) and parse_ints(text, sep).
+
+   A format string is text with replacement fields:
+     {}         the next argument
+     {N}        argument N, counting from 0
+     {:spec}    also {N:spec}; spec is [[fill]align][0][width] with align
+                '<', '>' or '^' and fill any one character (default a
+                space); '0' pads a number with zeros after its sign
+     {{ and }}  literal braces
+   Arguments are written the way print writes them, ints with the
+   digit-pair formatter. Numbers are right-aligned by default and
+   everything else left-aligned.
+
+   Compiling splits the string into literal runs and fields once. The
+   interpreter keeps the compiled form on each format() call site, so a
+   loop pays only for writing its arguments. */
+
+typedef struct Format Format;
+
+/* On a malformed string returns NULL and sets *err to a static message. */
+Format *format_compile(const char *text, size_t len, const char **err);
+/* Whether f was compiled from exactly this text. */
+bool    format_is(const Format *f, const char *text, size_t len);
+/* Arguments f takes: one past the highest field index. */
+size_t  format_arg_count(const Format *f);
+/* f filled in from args (borrowed); argc is format_arg_count(f). */
+Value   format_apply(const Format *f, const Value *args, size_t argc);
+/* Also called by the syntax tree on the forms cached there; NULL is a
+   no-op. */
+void    format_free(Format *f);
+
+/* The int that s[0, len) spells: an optional sign, then decimal digits
+   and nothing else. Past the int64_t range the result is a bigint. */
+bool    parse_int(const char *s, size_t len, Value *out);
+
+/* The ints in s[0, len) as a packed int array: fields of parse_int's
+   form (but within int64_t) separated by sep or by line ends ('\n' or
+   "\r\n"). Blank lines are skipped; any other empty field is an error.
+   The text is read in place, so a view or a mapped file costs nothing
+   extra. On failure returns false with *bad at the offending field. */
+bool    parse_ints(const char *s, size_t len, char sep, Value *out, size_t *bad);
+
+#endif
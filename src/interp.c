@@ -1,4 +1,11 @@
 #include "interp.h"
+#include "error.h"
+#include "builtins.h"
+#include "map.h"
+#include "bigint.h"
+#include "output.h"
+#include "format.h"
+#include "memo.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -6,282 +13,335 @@
 
 /* Forward (needed because eval_stmt uses it before definition) */
 static void eval_fn_def_stmt(Stmt *stmt, Env *env);
-static void runtime_error(const char *msg);
+static void eval_record_stmt(Stmt *stmt, Env *env);
 
 
 /* =========================
    Helpers
    ========================= */
 
- Value builtin_print(Value *args, size_t argc) {
-    if (argc != 1) {
-        runtime_error("print expects exactly one argument");
-    }
+static int is_bool(Value v) {
+    return v.type == VAL_BOOL;
+}
 
-    Value v = args[0];
+static int is_int(Value v) {
+    return v.type == VAL_INT;
+}
 
-    if (v.type == VAL_STRING) {
-        printf("%s\n", v.as.str_val.data);
-        return value_bool(true);
-    }
+static int is_number(Value v) {
+    return v.type == VAL_INT || v.type == VAL_BIGINT;
+}
 
-    if (v.type == VAL_INT) {
-        printf("%lld\n", (long long)v.as.int_val);
-        return value_bool(true);
-    }
 
-    if (v.type == VAL_BOOL) {
-        printf("%s\n", v.as.bool_val ? "true" : "false");
-        return value_bool(true);
-    }
-
-    if (v.type == VAL_ARRAY) {
-        printf("[");
+// static void runtime_error_stmt(Stmt *stmt, const char *msg) {
+//     printf("[line %d:%d] %s\n", stmt->line, stmt->col, msg);
+//     exit(1);
+// }
 
-        for (size_t i = 0; i < v.as.array_val.count; i++) {
-            Value item = v.as.array_val.items[i];
 
-            if (item.type == VAL_INT) {
-                printf("%lld", (long long)item.as.int_val);
-            } else if (item.type == VAL_STRING) {
-                printf("\"%s\"", item.as.str_val.data);
-            } else if (item.type == VAL_BOOL) {
-                printf("%s", item.as.bool_val ? "true" : "false");
-            } else {
-                printf("<unsupported>");
-            }
+/* =========================
+   Expr evaluation (split)
+   ========================= */
 
-            if (i + 1 < v.as.array_val.count)
-                printf(", ");
+static EvalResult eval_block(Stmt **stmts, size_t count, Env *env) {
+    for (size_t i = 0; i < count; i++) {
+        EvalResult r = eval_stmt(stmts[i], env);
+        if (r.has_return) {
+            return r;
         }
-
-        printf("]\n");
-        return value_bool(true);
     }
+    EvalResult ok = {0};
+    return ok;
+}
 
-    runtime_error("Unsupported type for print");
-    return value_bool(false);
+static Value eval_int_expr(Expr *expr) {
+    return value_int(expr->as.int_val);
 }
 
-Value builtin_write_file(Value *args, size_t argc) {
-    if (argc != 2) {
-        runtime_error("write_file expects exactly two arguments");
-    }
+static Value eval_bool_expr(Expr *expr) {
+    return value_bool(expr->as.bool_val);
+}
 
-    if (args[0].type != VAL_STRING ||
-        args[1].type != VAL_STRING) {
-        runtime_error("write_file expects (string path, string content)");
+/* Borrowed lookup: the result is owned by env and must not be freed. */
+static Value lookup_var(Expr *expr, Env *env) {
+    Value v;
+    if (!env_get(env, expr->as.var.name, &v)) {
+        runtime_error_at(expr->line, expr->col,
+                         "Undefined variable");
     }
+    return v;
+}
 
-    const char *path = args[0].as.str_val.data;
-    const char *content = args[1].as.str_val.data;
-
-    FILE *f = fopen(path, "wb");
-    if (!f) {
-        Value result = value_array();
-        result.as.array_val.count = 2;
-        result.as.array_val.capacity = 2;
-        result.as.array_val.items = malloc(sizeof(Value) * 2);
+static Value eval_var_expr(Expr *expr, Env *env) {
+    return value_clone(lookup_var(expr, env));
+}
 
-        result.as.array_val.items[0] = value_bool(false);
-        result.as.array_val.items[1] = value_string("Failed to open file for writing");
+/* base[index] as an owned value; consumes `index`, borrows `base`. */
+static Value index_into(Expr *expr, Value base, Value index) {
+    Value result;
 
+    /* Map lookup */
+    if (base.type == VAL_MAP) {
+        Value *found = map_find(base.as.map_val, index);
+        if (!found) {
+            runtime_error_at(expr->line, expr->col, "Key not found in map");
+        }
+        result = value_clone(*found);
+        value_free(index);
         return result;
     }
 
-    size_t written = fwrite(content, 1, strlen(content), f);
-    fclose(f);
+    if (index.type != VAL_INT) {
+        runtime_error("Index must be integer");
+    }
 
-    if (written != strlen(content)) {
-        Value result = value_array();
-        result.as.array_val.count = 2;
-        result.as.array_val.capacity = 2;
-        result.as.array_val.items = malloc(sizeof(Value) * 2);
+    int64_t i = index.as.int_val;
 
-        result.as.array_val.items[0] = value_bool(false);
-        result.as.array_val.items[1] = value_string("Failed to write full content");
+    /* Array indexing */
+    if (base.type == VAL_ARRAY) {
+        if (i < 0 || (size_t)i >= base.as.array_val->count) {
+            runtime_error("Array index out of bounds");
+        }
+        result = array_get(base.as.array_val, (size_t)i);
+    }
 
-        return result;
+    /* String indexing */
+    else if (base.type == VAL_STRING) {
+        if (i < 0 || (size_t)i >= base.as.str_val.len) {
+            runtime_error("String index out of bounds");
+        }
+
+        result = value_string_view(base, (size_t)i, 1);
     }
 
-    Value result = value_array();
-    result.as.array_val.count = 1;
-    result.as.array_val.capacity = 1;
-    result.as.array_val.items = malloc(sizeof(Value) * 1);
+    /* Bytes indexing: the byte as an int, 0 to 255 */
+    else if (base.type == VAL_BYTES) {
+        if (i < 0 || (size_t)i >= base.as.str_val.len) {
+            runtime_error("Bytes index out of bounds");
+        }
 
-    result.as.array_val.items[0] = value_bool(true);
+        result = value_int((unsigned char)base.as.str_val.data[i]);
+    }
+
+    else {
+        runtime_error("Indexing requires array, map, string or bytes");
+        return value_int(0);
+    }
 
     return result;
 }
 
+static Value eval_index_expr(Expr *expr, Env *env) {
+    /* Index first: a plain variable base is then only borrowed, which
+       keeps `a[i]` from copying `a` on every access. */
+    Value index = eval_expr(expr->as.index.index, env);
 
-Value builtin_len(Value *args, size_t argc) {
-    if (argc != 1) {
-        runtime_error("len expects exactly one argument");
+    if (expr->as.index.base->kind == EXPR_VAR) {
+        return index_into(expr, lookup_var(expr->as.index.base, env), index);
     }
 
-    Value v = args[0];
+    Value base = eval_expr(expr->as.index.base, env);
+    Value result = index_into(expr, base, index);
+    value_free(base);
+    return result;
+}
 
-    if (v.type != VAL_STRING) {
-        runtime_error("len expects a string");
+static Value eval_map_expr(Expr *expr, Env *env) {
+    Value map = value_map();
+
+    for (size_t i = 0; i < expr->as.map.count; i++) {
+        Value key = eval_expr(expr->as.map.keys[i], env);
+        if (!map_key_ok(key)) {
+            runtime_error_at(expr->line, expr->col,
+                             "Map keys must be int, bool, string or array");
+        }
+        Value value = eval_expr(expr->as.map.values[i], env);
+        map_set(map.as.map_val, key, value);
     }
 
-    return value_int((int64_t)v.as.str_val.len);
+    return map;
 }
 
-Value builtin_read_file(Value *args, size_t argc) {
-    if (argc != 1) {
-        runtime_error("read_file expects exactly one argument");
+/* Slot of field `expr->as.field.name` in records of `shape`. Each access
+   site remembers the last shape it saw, so a monomorphic site resolves
+   the name once and afterwards costs a pointer compare. */
+static size_t field_slot(Expr *expr, const Shape *shape) {
+    if (expr->as.field.cache_shape == shape) {
+        return expr->as.field.cache_slot;
     }
 
-    if (args[0].type != VAL_STRING) {
-        runtime_error("read_file expects a string path");
+    long slot = shape_find_field(shape, expr->as.field.name);
+    if (slot < 0) {
+        runtime_error_at(expr->line, expr->col, "Record has no such field");
     }
 
-    const char *path = args[0].as.str_val.data;
+    expr->as.field.cache_shape = shape;
+    expr->as.field.cache_slot = (size_t)slot;
+    return (size_t)slot;
+}
 
-    FILE *f = fopen(path, "rb");
-    if (!f) {
-        Value result = value_array();
-        result.as.array_val.count = 2;
-        result.as.array_val.capacity = 2;
-        result.as.array_val.items = malloc(sizeof(Value) * 2);
+/* Borrowed field of a record array element, or NULL when `base` is not
+   a dense record array. */
+static Value *record_row_field(Expr *expr, Value base, Value index) {
+    if (base.type != VAL_ARRAY || base.as.array_val->kind != ARRAY_RECORDS) {
+        return NULL;
+    }
+    if (index.type != VAL_INT) {
+        runtime_error("Index must be integer");
+    }
 
-        result.as.array_val.items[0] = value_bool(false);
-        result.as.array_val.items[1] = value_string("Failed to open file");
+    Array *arr = base.as.array_val;
+    int64_t i = index.as.int_val;
 
-        return result;
+    if (i < 0 || (size_t)i >= arr->count) {
+        runtime_error("Array index out of bounds");
     }
+    return &arr->items[(size_t)i * arr->shape->field_count +
+                       field_slot(expr, arr->shape)];
+}
 
-    fseek(f, 0, SEEK_END);
-    long size = ftell(f);
-    rewind(f);
+static Value eval_field_expr(Expr *expr, Env *env) {
+    Expr *base_expr = expr->as.field.base;
 
-    char *buffer = malloc(size + 1);
-    if (!buffer) {
-        fclose(f);
-        runtime_error("Out of memory");
-    }
+    int owned = base_expr->kind != EXPR_VAR;
+    Value base;
 
-    fread(buffer, 1, size, f);
-    buffer[size] = '\0';
-    fclose(f);
+    /* a[i].x on a dense record array reads the field in place instead of
+       materializing the element. */
+    if (base_expr->kind == EXPR_INDEX &&
+        base_expr->as.index.base->kind == EXPR_VAR) {
+        Value index = eval_expr(base_expr->as.index.index, env);
+        Value arr = lookup_var(base_expr->as.index.base, env);
+        Value *field = record_row_field(expr, arr, index);
 
-    Value result = value_array();
-    result.as.array_val.count = 2;
-    result.as.array_val.capacity = 2;
-    result.as.array_val.items = malloc(sizeof(Value) * 2);
+        if (field) {
+            return value_clone(*field);
+        }
+        base = index_into(base_expr, arr, index);
+    } else {
+        base = owned ? eval_expr(base_expr, env)
+                     : lookup_var(base_expr, env);
+    }
+
+    if (base.type != VAL_RECORD) {
+        runtime_error_at(expr->line, expr->col,
+                         "Field access requires a record");
+    }
 
-    result.as.array_val.items[0] = value_bool(true);
-    result.as.array_val.items[1] = value_string(buffer);
+    Record *rec = base.as.rec_val;
+    Value result = value_clone(rec->slots[field_slot(expr, rec->shape)]);
 
+    if (owned) {
+        value_free(base);
+    }
     return result;
 }
 
+static Value *eval_place(Expr *expr, Env *env);
 
-static int is_bool(Value v) {
-    return v.type == VAL_BOOL;
-}
+/* The element or map entry `index` of the unique container in *base. */
+static Value *element_place(Expr *expr, Value *base, Value index) {
+    if (base->type == VAL_MAP) {
+        Value *found = map_find(base->as.map_val, index);
+        if (!found) {
+            runtime_error_at(expr->line, expr->col, "Key not found in map");
+        }
+        value_free(index);
+        return found;
+    }
 
-static int is_int(Value v) {
-    return v.type == VAL_INT;
-}
+    if (base->type != VAL_ARRAY) {
+        runtime_error("Indexing requires array, map or string");
+    }
+    if (index.type != VAL_INT) {
+        runtime_error("Index must be integer");
+    }
 
+    Array *arr = base->as.array_val;
+    int64_t i = index.as.int_val;
 
-// static void runtime_error_stmt(Stmt *stmt, const char *msg) {
-//     printf("[line %d:%d] %s\n", stmt->line, stmt->col, msg);
-//     exit(1);
-// }
-    
+    if (i < 0 || (size_t)i >= arr->count) {
+        runtime_error("Array index out of bounds");
+    }
+    if (arr->kind != ARRAY_VALUES) {
+        /* packed elements are ints/bools, never containers, and records
+           are only reachable field by field (see field_place) */
+        runtime_error("Indexing requires array, map or string");
+    }
 
-static void runtime_error(const char *msg) {
-    printf("%s\n", msg);
-    exit(1);
+    return &arr->items[i];
 }
 
-static void runtime_error_at(int line, int col, const char *msg) {
-    printf("[line %d, col %d] %s\n", line, col, msg);
-    exit(1);
-}
+static Value *field_place(Expr *expr, Env *env) {
+    Expr *base_expr = expr->as.field.base;
+    Value *base;
 
+    if (base_expr->kind == EXPR_INDEX) {
+        Value index = eval_expr(base_expr->as.index.index, env);
+        Value *container = eval_place(base_expr->as.index.base, env);
 
-/* =========================
-   Expr evaluation (split)
-   ========================= */
+        value_make_unique(container);
 
-static EvalResult eval_block(Stmt **stmts, size_t count, Env *env) {
-    for (size_t i = 0; i < count; i++) {
-        EvalResult r = eval_stmt(stmts[i], env);
-        if (r.has_return) {
-            return r;
+        Value *field = record_row_field(expr, *container, index);
+        if (field) {
+            return field;
         }
+        base = element_place(base_expr, container, index);
+    } else {
+        base = eval_place(base_expr, env);
     }
-    EvalResult ok = {0};
-    return ok;
-}
 
-static Value eval_int_expr(Expr *expr) {
-    return value_int(expr->as.int_val);
-}
-
-static Value eval_bool_expr(Expr *expr) {
-    return value_bool(expr->as.bool_val);
-}
-
-static Value eval_var_expr(Expr *expr, Env *env) {
-    Value v;
-    if (!env_get(env, expr->as.var.name, &v)) {
+    if (base->type != VAL_RECORD) {
         runtime_error_at(expr->line, expr->col,
-                         "Undefined variable");
+                         "Field access requires a record");
     }
-    return v;
-}
 
-static Value eval_index_expr(Expr *expr, Env *env) {
-    Value base = eval_expr(expr->as.index.base, env);
-    Value index = eval_expr(expr->as.index.index, env);
-
-    if (index.type != VAL_INT) {
-        runtime_error("Index must be integer");
-    }
-
-    int64_t i = index.as.int_val;
+    value_make_unique(base);
+    Record *rec = base->as.rec_val;
+    return &rec->slots[field_slot(expr, rec->shape)];
+}
 
-    /* Array indexing */
-    if (base.type == VAL_ARRAY) {
-        if (i < 0 || (size_t)i >= base.as.array_val.count) {
-            runtime_error("Array index out of bounds");
+/* Resolves an assignable place (variable, element, map entry or record
+   field) to the slot that stores it. Containers along the path are made
+   unique first, so writing through the slot never shows through another
+   owner. */
+static Value *eval_place(Expr *expr, Env *env) {
+    if (expr->kind == EXPR_VAR) {
+        Value *slot = env_get_ref(env, expr->as.var.name);
+        if (!slot) {
+            runtime_error_at(expr->line, expr->col, "Undefined variable");
         }
-        return base.as.array_val.items[i];
+        return slot;
     }
 
-    /* String indexing */
-    if (base.type == VAL_STRING) {
-        if (i < 0 || (size_t)i >= base.as.str_val.len) {
-            runtime_error("String index out of bounds");
-        }
-
-        char buf[2];
-        buf[0] = base.as.str_val.data[i];
-        buf[1] = '\0';
-
-        return value_string(buf);
+    if (expr->kind == EXPR_FIELD) {
+        return field_place(expr, env);
     }
 
-    runtime_error("Indexing requires array or string");
-    return value_int(0);
-}
+    if (expr->kind != EXPR_INDEX) {
+        runtime_error_at(expr->line, expr->col, "Invalid assignment target");
+    }
 
+    Value index = eval_expr(expr->as.index.index, env);
+    Value *base = eval_place(expr->as.index.base, env);
 
+    value_make_unique(base);
+    return element_place(expr, base, index);
+}
 
 static Value eval_unary_expr(Expr *expr, Env *env) {
     Value right = eval_expr(expr->as.unary.rhs, env);
 
     if (expr->as.unary.op == UNOP_NEG) {
-        if (!is_int(right)) {
+        if (is_int(right) && right.as.int_val != INT64_MIN) {
+            return value_int(-right.as.int_val);
+        }
+        if (!is_number(right)) {
             runtime_error("Unary '-' requires integer");
         }
-        return value_int(-right.as.int_val);
+        Value result = bigint_neg(right);
+        value_free(right);
+        return result;
     }
 
     if (expr->as.unary.op == UNOP_NOT) {
@@ -296,24 +356,23 @@ static Value eval_unary_expr(Expr *expr, Env *env) {
 }
 
 static Value eval_array_expr(Expr *expr, Env *env) {
-    Value arr = value_array();
-
     size_t count = expr->as.array.count;
 
-    arr.as.array_val.items = malloc(sizeof(Value) * count);
-    if (!arr.as.array_val.items) {
-        runtime_error_at(expr->line, expr->col, "Out of memory");
+    if (count == 0) {
+        return value_array();
     }
 
-    arr.as.array_val.count = count;
-    arr.as.array_val.capacity = count;
+    Value *items = malloc(sizeof(Value) * count);
+    if (!items) {
+        runtime_error_at(expr->line, expr->col, "Out of memory");
+    }
 
     for (size_t i = 0; i < count; i++) {
-        arr.as.array_val.items[i] =
-            eval_expr(expr->as.array.items[i], env);
+        items[i] = eval_expr(expr->as.array.items[i], env);
     }
 
-    return arr;
+    /* Homogeneous int/bool literals come back packed. */
+    return value_array_from_values(items, count);
 }
 
 
@@ -363,35 +422,70 @@ static Value eval_logical_binary(Expr *expr, Env *env) {
     return value_bool(0);
 }
 
-static Value eval_arithmetic_binary(Expr *expr, Value left, Value right){
-    if (!is_int(left) || !is_int(right)) {
-        runtime_error("Arithmetic operators require integers");
+/* Arithmetic once an operand is a bigint or an int op overflowed.
+   Consumes both operands. */
+static Value eval_bigint_binary(Expr *expr, Value left, Value right) {
+    Value result;
+
+    switch (expr->as.binary.op) {
+        case BIN_ADD: result = bigint_add(left, right); break;
+        case BIN_SUB: result = bigint_sub(left, right); break;
+        case BIN_MUL: result = bigint_mul(left, right); break;
+        case BIN_DIV:
+            if (right.type == VAL_INT && right.as.int_val == 0) {
+                runtime_error_at(expr->line, expr->col, "Division by zero");
+            }
+            result = bigint_div(left, right);
+            break;
+        default:
+            runtime_error("Unsupported arithmetic operator");
+            return value_int(0);
     }
 
+    value_free(left);
+    value_free(right);
+    return result;
+}
+
+/* Int arithmetic without boxing. Returns 0 when the result does not
+   fit in int64_t; the caller then redoes the operation as a bigint. */
+static int int_arith(Expr *expr, int64_t a, int64_t b, int64_t *out) {
     switch (expr->as.binary.op) {
         case BIN_ADD:
-            return value_int(left.as.int_val + right.as.int_val);
+            return !__builtin_add_overflow(a, b, out);
         case BIN_SUB:
-            return value_int(left.as.int_val - right.as.int_val);
+            return !__builtin_sub_overflow(a, b, out);
         case BIN_MUL:
-            return value_int(left.as.int_val * right.as.int_val);
+            return !__builtin_mul_overflow(a, b, out);
         case BIN_DIV:
-            if (right.as.int_val == 0) {
+            if (b == 0) {
                runtime_error_at(expr->line, expr->col, "Division by zero");
             }
-            return value_int(left.as.int_val / right.as.int_val);
+            if (a == INT64_MIN && b == -1) {
+                return 0;
+            }
+            *out = a / b;
+            return 1;
         default:
             runtime_error("Unsupported arithmetic operator");
-            return value_int(0);
+            return 0;
+    }
+}
+
+/* Slow path: bigint operands or an overflowed int result. */
+static Value eval_arithmetic_binary(Expr *expr, Value left, Value right){
+    if (!is_number(left) || !is_number(right)) {
+        runtime_error("Arithmetic operators require integers");
     }
+    return eval_bigint_binary(expr, left, right);
 }
 
 static Value eval_comparison_binary(BinOp op, Value left, Value right) {
 
-    /* String equality */
+    /* String (and bytes) equality */
     if ((op == BIN_EQ || op == BIN_NEQ) &&
-        left.type == VAL_STRING &&
-        right.type == VAL_STRING) {
+        (left.type == VAL_STRING || left.type == VAL_BYTES) &&
+        right.type == left.type) {
 
         int equal = 0;
 
@@ -408,6 +502,24 @@ static Value eval_comparison_binary(BinOp op, Value left, Value right) {
             return value_bool(!equal);
     }
 
+    /* Big integer comparisons */
+    if ((left.type == VAL_BIGINT || right.type == VAL_BIGINT) &&
+        is_number(left) && is_number(right)) {
+        int c = bigint_cmp(left, right);
+
+        switch (op) {
+            case BIN_EQ:  return value_bool(c == 0);
+            case BIN_NEQ: return value_bool(c != 0);
+            case BIN_LT:  return value_bool(c <  0);
+            case BIN_LTE: return value_bool(c <= 0);
+            case BIN_GT:  return value_bool(c >  0);
+            case BIN_GTE: return value_bool(c >= 0);
+            default:
+                runtime_error("Invalid comparison operator");
+                return value_bool(false);
+        }
+    }
+
     /* Integer comparisons */
     if (left.type != VAL_INT || right.type != VAL_INT) {
         runtime_error("Comparison operators require integers");
@@ -471,34 +583,28 @@ static Value eval_binary_expr(Expr *expr, Env *env) {
     /* Non short-circuit: evaluate both sides */
     Value left = eval_expr(expr->as.binary.lhs, env);
     Value right = eval_expr(expr->as.binary.rhs, env);
+    Value result;
+    int64_t out;
 
     switch (op) {
         case BIN_ADD:
-            if (left.type == VAL_STRING && right.type == VAL_STRING) {
-                size_t len = left.as.str_val.len + right.as.str_val.len;
-
-                char *buffer = malloc(len + 1);
-                if (!buffer) {
-                    runtime_error_at(expr->line, expr->col, "Out of memory");
-                }
-
-                memcpy(buffer, left.as.str_val.data, left.as.str_val.len);
-                memcpy(buffer + left.as.str_val.len,
-                    right.as.str_val.data,
-                    right.as.str_val.len);
-
-                buffer[len] = '\0';
-
-                Value v;
-                v.type = VAL_STRING;
-                v.as.str_val.data = buffer;
-                v.as.str_val.len = len;
-                return v;
-            }
-            return eval_arithmetic_binary(expr, left, right);
         case BIN_SUB:
         case BIN_MUL:
         case BIN_DIV:
+            if (is_int(left) && is_int(right) &&
+                int_arith(expr, left.as.int_val, right.as.int_val, &out)) {
+                return value_int(out);
+            }
+            if (op == BIN_ADD && left.type == right.type &&
+                (left.type == VAL_STRING || left.type == VAL_BYTES)) {
+                /* Consumes left; appends in place when it can. */
+                result = value_string_append(left,
+                                             right.as.str_val.data,
+                                             right.as.str_val.len);
+                result.type = right.type;
+                value_free(right);
+                return result;
+            }
             return eval_arithmetic_binary(expr, left, right);
 
         case BIN_EQ:
@@ -507,7 +613,10 @@ static Value eval_binary_expr(Expr *expr, Env *env) {
         case BIN_LTE:
         case BIN_GT:
         case BIN_GTE:
-            return eval_comparison_binary(op, left, right);
+            result = eval_comparison_binary(op, left, right);
+            value_free(left);
+            value_free(right);
+            return result;
 
         default:
             runtime_error("Unsupported binary operator");
@@ -575,23 +684,167 @@ static EvalResult eval_return_stmt(Stmt *stmt, Env *env) {
     return r;
 }
 
+/* format(fmt, args...) at a call site: the compiled format string is
+   kept on the call node and reused while the string stays the same. A
+   literal format string is compiled from the source once and never
+   evaluated. */
+static Value eval_format_call(Expr *expr, Env *env) {
+    size_t argc = expr->as.call.argc;
+    if (argc == 0) {
+        runtime_error_at(expr->line, expr->col,
+                         "format expects (string format, values...)");
+    }
+
+    Expr *fmt = expr->as.call.args[0];
+    Format *f = expr->as.call.format;
+    const char *err;
+
+    if (fmt->kind == EXPR_STRING) {
+        if (!f) {
+            f = format_compile(fmt->as.string.data, fmt->as.string.len, &err);
+        }
+    } else {
+        Value text = eval_expr(fmt, env);
+        if (text.type != VAL_STRING) {
+            runtime_error_at(expr->line, expr->col,
+                             "format expects (string format, values...)");
+        }
+        if (!f || !format_is(f, text.as.str_val.data, text.as.str_val.len)) {
+            format_free(f);
+            f = format_compile(text.as.str_val.data, text.as.str_val.len, &err);
+        }
+        value_free(text);
+    }
+    expr->as.call.format = f;
+    if (!f) {
+        runtime_error_at(expr->line, expr->col, err);
+    }
+    if (format_arg_count(f) != argc - 1) {
+        runtime_error_at(expr->line, expr->col,
+                         "format: argument count does not match the format string");
+    }
+
+    Value args[argc];
+    for (size_t i = 1; i < argc; i++) {
+        args[i - 1] = eval_expr(expr->as.call.args[i], env);
+    }
+
+    Value result = format_apply(f, args, argc - 1);
+
+    for (size_t i = 1; i < argc; i++) {
+        value_free(args[i - 1]);
+    }
+    return result;
+}
+
+/* Runs fn on borrowed arguments in a fresh environment. */
+static Value call_function(Function *fn, Value *args) {
+    Env *local = env_create(fn->closure);
+    for (size_t i = 0; i < fn->param_count; i++) {
+        env_define(local, fn->params[i], args[i]);
+    }
+
+    EvalResult result = eval_block(fn->body, fn->body_count, local);
+
+    env_free(local);
+
+    if (!result.has_return) {
+        runtime_error("Function returned without value");
+    }
+    return result.value;
+}
+
+/* A function from memo(): the body only runs for arguments the table
+   has no result for. The table is held across the call because the body
+   may rebind the function's name and free fn along with its reference. */
+static Value call_memoized(Function *fn, Value *args) {
+    Memo *memo = fn->memo;
+    if (!memo_keys_ok(memo, args)) {
+        return call_function(fn, args);
+    }
+
+    uint64_t hash = memo_hash(memo, args);
+    Value result;
+    if (memo_find(memo, args, hash, &result)) {
+        return result;
+    }
+
+    memo_retain(memo);
+    result = call_function(fn, args);
+    memo_store(memo, args, hash, result);
+    memo_release(memo);
+    return result;
+}
+
 static Value eval_call_expr(Expr *expr, Env *env) {
 
     Value callee;
 
     if (!env_get(env, expr->as.call.callee, &callee)) {
-        printf("Undefined function: %s\n", expr->as.call.callee);
+        out_cstr("Undefined function: ");
+        out_cstr(expr->as.call.callee);
+        out_line_end();
         exit(1);
     }
 
-    if (callee.type != VAL_FUNCTION) {
-        Value args[expr->as.call.argc];
+    if (callee.type != VAL_FUNCTION && callee.type != VAL_BUILTIN &&
+        callee.type != VAL_SHAPE) {
+        runtime_error_at(expr->line, expr->col, "Value is not callable");
+    }
+
+    /* Record constructor: fields in declaration order. */
+    if (callee.type == VAL_SHAPE) {
+        const Shape *shape = callee.as.shape_val;
+
+        if (expr->as.call.argc != shape->field_count) {
+            runtime_error_at(expr->line, expr->col,
+                             "Argument count mismatch");
+        }
+
+        Value rec = value_record(shape);
+        for (size_t i = 0; i < shape->field_count; i++) {
+            rec.as.rec_val->slots[i] = eval_expr(expr->as.call.args[i], env);
+        }
+        return rec;
+    }
+
+    if (callee.type == VAL_BUILTIN && callee.as.builtin_val == builtin_format) {
+        return eval_format_call(expr, env);
+    }
+
+    if (callee.type == VAL_BUILTIN) {
+        size_t argc = expr->as.call.argc;
+        Value args[argc ? argc : 1];
+        int mutates = argc > 0 &&
+                      builtin_mutates_first_arg(callee.as.builtin_val);
 
-        for (size_t i = 0; i < expr->as.call.argc; i++) {
+        for (size_t i = mutates ? 1 : 0; i < argc; i++) {
             args[i] = eval_expr(expr->as.call.args[i], env);
         }
 
-        return callee.as.builtin_val(args, expr->as.call.argc);
+        /* A mutating builtin gets the caller's own storage as its first
+           argument. It is resolved last so no other argument can move it. */
+        Expr *target = mutates ? expr->as.call.args[0] : NULL;
+        int borrowed = target && (target->kind == EXPR_VAR ||
+                                  target->kind == EXPR_INDEX ||
+                                  target->kind == EXPR_FIELD);
+        if (borrowed) {
+            Value *slot = eval_place(target, env);
+            value_make_unique(slot);
+            args[0] = *slot;
+        } else if (mutates) {
+            args[0] = eval_expr(target, env);
+            value_make_unique(&args[0]);
+        }
+
+        /* Builtins borrow their arguments and return an owned value. */
+        Value result = callee.as.builtin_val(args, argc);
+
+        for (size_t i = borrowed ? 1 : 0; i < argc; i++) {
+            value_free(args[i]);
+        }
+
+        return result;
     }
 
 
@@ -602,28 +855,100 @@ static Value eval_call_expr(Expr *expr, Env *env) {
                         "Argument count mismatch");
     }
 
+    size_t argc = fn->param_count;
+    Value args[argc ? argc : 1];
+    for (size_t i = 0; i < argc; i++) {
+        args[i] = eval_expr(expr->as.call.args[i], env);
+    }
 
-    /* Create new environment for invocation */
-    Env *local = env_create(fn->closure);
+    Value result = fn->memo ? call_memoized(fn, args)
+                            : call_function(fn, args);
 
-    /* Bind parameters */
-    for (size_t i = 0; i < fn->param_count; i++) {
-        Value arg = eval_expr(expr->as.call.args[i], env);
-        env_define(local, fn->params[i], arg);
+    for (size_t i = 0; i < argc; i++) {
+        value_free(args[i]);
     }
+    return result;
+}
 
-    /* Execute function body */
-    EvalResult result = eval_block(fn->body, fn->body_count, local);
+Value interp_call(Value callee, Value *args, size_t argc) {
+    if (callee.type == VAL_BUILTIN) {
+        return callee.as.builtin_val(args, argc);
+    }
 
-    env_free(local);
+    if (callee.type == VAL_SHAPE) {
+        const Shape *shape = callee.as.shape_val;
+
+        if (argc != shape->field_count) {
+            runtime_error("Argument count mismatch");
+        }
+
+        Value rec = value_record(shape);
+        for (size_t i = 0; i < argc; i++) {
+            rec.as.rec_val->slots[i] = value_clone(args[i]);
+        }
+        return rec;
+    }
+
+    if (callee.type != VAL_FUNCTION) {
+        runtime_error("Value is not callable");
+    }
+
+    Function *fn = callee.as.fn_val;
+
+    if (argc != fn->param_count) {
+        runtime_error("Argument count mismatch");
+    }
+
+    return fn->memo ? call_memoized(fn, args) : call_function(fn, args);
+}
+
+void callback_init(Callback *cb, Value callee, size_t argc) {
+    cb->callee = callee;
+    cb->argc = argc;
+    cb->frame = NULL;
+
+    if (callee.type != VAL_FUNCTION) {
+        if (callee.type != VAL_BUILTIN && callee.type != VAL_SHAPE) {
+            runtime_error("Value is not callable");
+        }
+        return;
+    }
+
+    Function *fn = callee.as.fn_val;
+    if (argc != fn->param_count) {
+        runtime_error("Argument count mismatch");
+    }
+
+    /* A memoized function goes through interp_call and its table. */
+    if (fn->memo) {
+        return;
+    }
+
+    cb->frame = env_create(fn->closure);
+    for (size_t i = 0; i < argc; i++) {
+        env_define(cb->frame, fn->params[i], value_int(0));
+    }
+}
+
+Value callback_call(Callback *cb, Value *args) {
+    if (!cb->frame) {
+        return interp_call(cb->callee, args, cb->argc);
+    }
+
+    Function *fn = cb->callee.as.fn_val;
+    env_rebind(cb->frame, cb->argc, args);
 
-    if (result.has_return) {
-        return result.value;
+    EvalResult result = eval_block(fn->body, fn->body_count, cb->frame);
+    if (!result.has_return) {
+        runtime_error("Function returned without value");
     }
+    return result.value;
+}
 
-    /* No explicit return */
-    runtime_error("Function returned without value");
-    return value_int(0); /* unreachable */
+void callback_free(Callback *cb) {
+    if (cb->frame) {
+        env_free(cb->frame);
+    }
 }
 
 Value eval_expr(Expr *expr, Env *env) {
@@ -631,8 +956,13 @@ Value eval_expr(Expr *expr, Env *env) {
         case EXPR_INT:
             return eval_int_expr(expr);
 
+        case EXPR_BIGINT:
+            return bigint_from_digits(expr->as.string.data,
+                                      expr->as.string.len, false);
+
         case EXPR_STRING:
-            return value_string(expr->as.string.data);
+            return value_string_len(expr->as.string.data,
+                                    expr->as.string.len);
 
         case EXPR_BOOL:
             return eval_bool_expr(expr);
@@ -649,12 +979,18 @@ Value eval_expr(Expr *expr, Env *env) {
         case EXPR_ARRAY:
             return eval_array_expr(expr, env);
 
+        case EXPR_MAP:
+            return eval_map_expr(expr, env);
+
         case EXPR_CALL:
             return eval_call_expr(expr, env);
         
         case EXPR_INDEX:
             return eval_index_expr(expr, env);
 
+        case EXPR_FIELD:
+            return eval_field_expr(expr, env);
+
         default:
             runtime_error("Unsupported expression");
             return value_int(0);
@@ -671,60 +1007,83 @@ static void eval_assign_stmt(Stmt *stmt, Env *env) {
     if (!env_assign(env, stmt->as.assign.name, value)) {
         env_define(env, stmt->as.assign.name, value);
     }
+
+    /* env stores its own reference */
+    value_free(value);
 }
 
-static void eval_expr_stmt(Stmt *stmt, Env *env) {
+static int is_quiet_call(Expr *call, Env *env) {
+    Value callee;
+    return env_get(env, call->as.call.callee, &callee) &&
+           callee.type == VAL_BUILTIN &&
+           builtin_is_quiet(callee.as.builtin_val);
+}
 
-    Expr *expr = stmt->as.expr.expr;
+static void print_expr_result(Value value) {
+    out_write("=> ", 3);
+    out_value(value);
+    out_line_end();
+}
 
-    Value value = eval_expr(expr, env);
+static void eval_index_assign_stmt(Stmt *stmt, Env *env) {
+    Expr *target = stmt->as.index_assign.target;
+
+    /* Evaluate everything before resolving the slot, which any
+       evaluation could otherwise move. */
+    Value value = eval_expr(stmt->as.index_assign.value, env);
 
-    /* Do not print result of print() calls */
-    if (expr->kind == EXPR_CALL &&
-        strcmp(expr->as.call.callee, "print") == 0) {
+    if (target->kind == EXPR_FIELD) {
+        Value *field = eval_place(target, env);
+        value_free(*field);
+        *field = value;
         return;
     }
 
-    if (value.type == VAL_INT) {
-        printf("=> %lld\n", (long long)value.as.int_val);
+    Value index = eval_expr(target->as.index.index, env);
+
+    Value *slot = eval_place(target->as.index.base, env);
+
+    if (slot->type == VAL_MAP) {
+        if (!map_key_ok(index)) {
+            runtime_error_at(target->line, target->col,
+                             "Map keys must be int, bool, string or array");
+        }
+        value_make_unique(slot);
+        map_set(slot->as.map_val, index, value);
         return;
     }
 
-    if (value.type == VAL_BOOL) {
-        printf("=> %s\n", value.as.bool_val ? "true" : "false");
-        return;
+    if (slot->type != VAL_ARRAY) {
+        runtime_error_at(target->line, target->col,
+                         "Index assignment requires an array or map");
+    }
+    if (index.type != VAL_INT) {
+        runtime_error("Index must be integer");
     }
 
-    if (value.type == VAL_STRING) {
-        printf("=> %s\n", value.as.str_val.data);
-        return;
+    value_make_unique(slot);
+    Array *arr = slot->as.array_val;
+    int64_t i = index.as.int_val;
+
+    if (i < 0 || (size_t)i >= arr->count) {
+        runtime_error("Array index out of bounds");
     }
 
-    if (value.type == VAL_ARRAY) {
-        printf("=> [");
+    array_set(arr, (size_t)i, value);
+}
 
-        for (size_t i = 0; i < value.as.array_val.count; i++) {
-            Value item = value.as.array_val.items[i];
+static void eval_expr_stmt(Stmt *stmt, Env *env) {
 
-            if (item.type == VAL_INT) {
-                printf("%lld", (long long)item.as.int_val);
-            } else if (item.type == VAL_STRING) {
-                printf("\"%s\"", item.as.str_val.data);
-            } else if (item.type == VAL_BOOL) {
-                printf("%s", item.as.bool_val ? "true" : "false");
-            } else {
-                printf("<unsupported>");
-            }
+    Expr *expr = stmt->as.expr.expr;
 
-            if (i + 1 < value.as.array_val.count)
-                printf(", ");
-        }
+    Value value = eval_expr(expr, env);
 
-        printf("]\n");
-        return;
+    /* Do not echo calls made for their effect (print, push, ...) */
+    if (!(expr->kind == EXPR_CALL && is_quiet_call(expr, env))) {
+        print_expr_result(value);
     }
 
-    printf("=> <non-printable>\n");
+    value_free(value);
 }
 
 static EvalResult eval_if_stmt(Stmt *stmt, Env *env) {
@@ -753,6 +1112,10 @@ EvalResult eval_stmt(Stmt *stmt, Env *env) {
             eval_assign_stmt(stmt, env);
             break;
 
+        case STMT_INDEX_ASSIGN:
+            eval_index_assign_stmt(stmt, env);
+            break;
+
         case STMT_EXPR:
             eval_expr_stmt(stmt, env);
             break;
@@ -770,6 +1133,10 @@ EvalResult eval_stmt(Stmt *stmt, Env *env) {
             eval_fn_def_stmt(stmt, env);
             break;
 
+        case STMT_RECORD:
+            eval_record_stmt(stmt, env);
+            break;
+
         default:
             runtime_error("Unsupported statement");
             break;
@@ -781,7 +1148,11 @@ EvalResult eval_stmt(Stmt *stmt, Env *env) {
 
 static void eval_fn_def_stmt(Stmt *stmt, Env *env) {
     /* Create a temporary wrapper; env_define will clone it (heap-owning). */
-    if (env_has_local(env, stmt->as.fn_def.name)) {
+    /* User functions may shadow builtins, but not each other. */
+    Value existing;
+    if (env_has_local(env, stmt->as.fn_def.name) &&
+        env_get(env, stmt->as.fn_def.name, &existing) &&
+        existing.type != VAL_BUILTIN) {
         runtime_error_at(stmt->line, stmt->col,
                          "Function redefinition not allowed");
     }
@@ -791,6 +1162,7 @@ static void eval_fn_def_stmt(Stmt *stmt, Env *env) {
     tmp.body = stmt->as.fn_def.body;
     tmp.body_count = stmt->as.fn_def.body_count;
     tmp.closure = env;
+    tmp.memo = NULL;
 
     Value v;
     v.type = VAL_FUNCTION;
@@ -799,6 +1171,24 @@ static void eval_fn_def_stmt(Stmt *stmt, Env *env) {
     env_define(env, stmt->as.fn_def.name, v);
 }
 
+/* `record P(...)` binds P to its constructor. The shape is built the
+   first time the declaration runs and reused if it runs again. */
+static void eval_record_stmt(Stmt *stmt, Env *env) {
+    if (!stmt->as.record.shape) {
+        stmt->as.record.shape = shape_new(stmt->as.record.name,
+                                          stmt->as.record.fields,
+                                          stmt->as.record.field_count);
+    }
+
+    Value v;
+    v.type = VAL_SHAPE;
+    v.as.shape_val = stmt->as.record.shape;
+
+    if (!env_assign(env, stmt->as.record.name, v)) {
+        env_define(env, stmt->as.record.name, v);
+    }
+}
+
 EvalResult eval_program(Program *program, Env *env) {
     for (size_t i = 0; i < program->count; i++) {
         EvalResult r = eval_stmt(program->stmts[i], env);
@@ -15,4 +15,22 @@ Value eval_expr(Expr *expr, Env *env);
 EvalResult eval_stmt(Stmt *stmt, Env *env);
 EvalResult eval_program(Program *program, Env *env);
 
+/* Calls a function, builtin or record constructor with borrowed
+   arguments and returns an owned result. For builtins that take a
+   callback. */
+Value interp_call(Value callee, Value *args, size_t argc);
+
+/* A callee that one builtin calls many times, such as a sort
+   comparator. A function gets one environment that is rebound for each
+   call instead of being created and freed every time. */
+typedef struct {
+    Value callee;
+    size_t argc;
+    Env *frame;   /* NULL unless callee is a function without memo() */
+} Callback;
+
+void  callback_init(Callback *cb, Value callee, size_t argc);
+Value callback_call(Callback *cb, Value *args);
+void  callback_free(Callback *cb);
+
 #endif
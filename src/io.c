@@ -0,0 +1,583 @@
+#include "io.h"
+#include "csv.h"
+#include "error.h"
+#include "simd.h"
+#include "output.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define IO_IOV_MAX 1024
+#define IO_COPY_STEP (1 << 30)   /* bytes asked of one kernel copy call */
+
+static Handle *writers;   /* open writer handles */
+
+/* =========================
+   Handles
+   ========================= */
+
+static Value handle_value(int fd, bool owns_fd) {
+    Handle *h = (Handle *)malloc(sizeof(Handle));
+    if (!h) {
+        exit(1);
+    }
+
+    h->refcount = 1;
+    h->fd = fd;
+    h->owns_fd = owns_fd;
+    h->writable = false;
+    h->direct = false;
+    h->buf = NULL;   /* allocated on first read */
+    h->pos = 0;
+    h->end = 0;
+    h->cap = 0;
+    h->prev = NULL;
+    h->next = NULL;
+    h->csv = NULL;
+
+    Value v;
+    v.type = VAL_HANDLE;
+    v.as.handle_val = h;
+    return v;
+}
+
+static void flush_writers(void) {
+    for (Handle *h = writers; h; h = h->next) {
+        io_flush(h);
+    }
+}
+
+static Value writer_value(int fd, bool direct) {
+    static bool registered;
+
+    void *buf;
+    if (posix_memalign(&buf, IO_ALIGN, IO_BUF_SIZE) != 0) {
+        runtime_error("Out of memory");
+    }
+
+    Value v = handle_value(fd, true);
+    Handle *h = v.as.handle_val;
+    h->writable = true;
+    h->direct = direct;
+    h->buf = (char *)buf;
+    h->cap = IO_BUF_SIZE;
+
+    h->next = writers;
+    if (writers) {
+        writers->prev = h;
+    }
+    writers = h;
+
+    if (!registered) {
+        atexit(flush_writers);
+        registered = true;
+    }
+    return v;
+}
+
+static bool open_writer(const char *path, int flags, bool direct,
+                        Value *out, const char **err) {
+    int fd = -1;
+
+    if (direct) {
+        fd = open(path, flags | O_DIRECT, 0666);
+        direct = fd >= 0;
+    }
+    if (fd < 0) {
+        fd = open(path, flags, 0666);
+    }
+    if (fd < 0) {
+        *err = "Failed to open file for writing";
+        return false;
+    }
+
+    *out = writer_value(fd, direct);
+    return true;
+}
+
+bool io_open(const char *path, const char *mode, Value *out, const char **err) {
+    bool direct = mode[0] != '\0' && strcmp(mode + 1, "d") == 0;
+
+    if (strcmp(mode, "w") == 0 || (direct && mode[0] == 'w')) {
+        return open_writer(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                           direct, out, err);
+    }
+    if (strcmp(mode, "a") == 0 || (direct && mode[0] == 'a')) {
+        return open_writer(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+                           direct, out, err);
+    }
+    if (strcmp(mode, "r") != 0) {
+        *err = "open mode must be \"r\", \"w\", \"a\", \"wd\" or \"ad\"";
+        return false;
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        *err = "Failed to open file";
+        return false;
+    }
+
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    *out = handle_value(fd, true);
+    return true;
+}
+
+Value io_stdin(void) {
+    return handle_value(STDIN_FILENO, false);
+}
+
+Value io_fd_reader(int fd) {
+    return handle_value(fd, true);
+}
+
+Value io_fd_writer(int fd) {
+    return writer_value(fd, false);
+}
+
+int io_take_fd(Handle *h) {
+    int fd = h->fd;
+
+    h->fd = -1;   /* io_close must not close it now */
+    io_close(h);
+    return fd;
+}
+
+bool io_close(Handle *h) {
+    bool ok = true;
+
+    if (h->writable) {
+        ok = io_flush(h);
+
+        if (h->prev) {
+            h->prev->next = h->next;
+        } else if (writers == h) {
+            writers = h->next;
+        }
+        if (h->next) {
+            h->next->prev = h->prev;
+        }
+        h->prev = h->next = NULL;
+        h->writable = false;
+    }
+
+    if (h->fd >= 0 && h->owns_fd && close(h->fd) != 0) {
+        ok = false;
+    }
+    h->fd = -1;
+    free(h->buf);
+    h->buf = NULL;
+    h->pos = h->end = h->cap = 0;
+    if (h->csv) {
+        csv_free(h->csv);
+        h->csv = NULL;
+    }
+    return ok;
+}
+
+void handle_release(Handle *h) {
+    if (--h->refcount > 0) {
+        return;
+    }
+    io_close(h);
+    free(h);
+}
+
+/* =========================
+   Buffered reading
+   ========================= */
+
+/* Reads more input after the unread bytes, compacting or growing the
+   buffer as needed. Returns the number of bytes added; 0 at end of input. */
+static size_t fill(Handle *h) {
+    if (h->fd < 0) {
+        return 0;
+    }
+    if (!h->owns_fd) {
+        /* about to wait on stdin: show any pending prompt first */
+        out_flush();
+    }
+
+    if (!h->buf) {
+        h->cap = IO_BUF_SIZE;
+        h->buf = (char *)malloc(h->cap);
+        if (!h->buf) {
+            runtime_error("Out of memory");
+        }
+    }
+
+    if (h->pos > 0) {
+        memmove(h->buf, h->buf + h->pos, h->end - h->pos);
+        h->end -= h->pos;
+        h->pos = 0;
+    }
+
+    if (h->end == h->cap) {
+        /* a single line longer than the buffer */
+        h->cap *= 2;
+        h->buf = (char *)realloc(h->buf, h->cap);
+        if (!h->buf) {
+            runtime_error("Out of memory");
+        }
+    }
+
+    ssize_t n;
+    do {
+        n = read(h->fd, h->buf + h->end, h->cap - h->end);
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0) {
+        runtime_error("Failed to read from handle");
+    }
+
+    h->end += (size_t)n;
+    return (size_t)n;
+}
+
+bool io_read_line(Handle *h, Value *line) {
+    size_t scanned = 0;   /* bytes after pos already known to hold no '\n' */
+
+    for (;;) {
+        size_t avail = h->end - h->pos;
+
+        if (scanned < avail) {
+            size_t nl = scanned + simd_find_byte(h->buf + h->pos + scanned,
+                                                 avail - scanned, '\n');
+            if (nl < avail) {
+                *line = value_string_len(h->buf + h->pos, nl);
+                h->pos += nl + 1;
+                return true;
+            }
+        }
+
+        scanned = avail;
+        if (fill(h) == 0) {
+            break;
+        }
+    }
+
+    if (h->end == h->pos) {
+        return false;
+    }
+
+    /* last line without a trailing newline */
+    *line = value_string_len(h->buf + h->pos, h->end - h->pos);
+    h->pos = h->end;
+    return true;
+}
+
+Value io_read_chunk(Handle *h, size_t n) {
+    if (h->end == h->pos) {
+        fill(h);
+    }
+
+    size_t avail = h->end - h->pos;
+    if (n > avail) {
+        n = avail;
+    }
+
+    Value chunk = value_string_len(h->buf ? h->buf + h->pos : "", n);
+    h->pos += n;
+    return chunk;
+}
+
+bool io_eof(Handle *h) {
+    if (h->csv) {
+        return csv_eof(h->csv);
+    }
+    return h->end == h->pos && fill(h) == 0;
+}
+
+/* =========================
+   Buffered writing
+   ========================= */
+
+/* Writes all of iov[0, n), resuming after short writes. */
+static bool write_iov(int fd, struct iovec *iov, int n) {
+    while (n > 0) {
+        ssize_t w = writev(fd, iov, n);
+        if (w < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+
+        size_t done = (size_t)w;
+        while (n > 0 && done >= iov->iov_len) {
+            done -= iov->iov_len;
+            iov++;
+            n--;
+        }
+        if (n > 0) {
+            iov->iov_base = (char *)iov->iov_base + done;
+            iov->iov_len -= done;
+        }
+    }
+    return true;
+}
+
+/* Leaves direct mode for good, e.g. once the file offset is unaligned. */
+static void drop_direct(Handle *h) {
+    int flags = fcntl(h->fd, F_GETFL);
+    if (flags >= 0) {
+        fcntl(h->fd, F_SETFL, flags & ~O_DIRECT);
+    }
+    h->direct = false;
+}
+
+/* Writes the whole blocks at the front of the buffer and keeps the
+   partial block for later, as O_DIRECT needs. */
+static bool drain_direct(Handle *h) {
+    size_t whole = h->end - h->end % IO_ALIGN;
+    size_t done = 0;
+
+    while (done < whole) {
+        ssize_t w = write(h->fd, h->buf + done, whole - done);
+        if (w < 0 && errno == EINTR) {
+            continue;
+        }
+        if (w < 0 && errno == EINVAL) {
+            /* the filesystem or offset does not allow it after all */
+            drop_direct(h);
+            break;
+        }
+        if (w < 0) {
+            return false;
+        }
+        done += (size_t)w;
+    }
+
+    memmove(h->buf, h->buf + done, h->end - done);
+    h->end -= done;
+    return true;
+}
+
+/* Writes out everything buffered. A direct handle writes its whole
+   blocks first; the tail is unaligned, so it ends direct mode. */
+bool io_flush(Handle *h) {
+    if (h->fd < 0 || !h->writable) {
+        return true;
+    }
+    if (h->direct) {
+        if (!drain_direct(h)) {
+            return false;
+        }
+        if (h->end > 0) {
+            drop_direct(h);
+        }
+    }
+
+    struct iovec iov = { h->buf, h->end };
+    h->end = 0;
+    return write_iov(h->fd, &iov, 1);
+}
+
+bool io_write(Handle *h, const char *data, size_t len) {
+    if (len <= h->cap - h->end) {
+        memcpy(h->buf + h->end, data, len);
+        h->end += len;
+        return true;
+    }
+
+    if (h->direct) {
+        /* everything passes through the aligned buffer */
+        while (len > 0) {
+            size_t n = h->cap - h->end;
+            if (n > len) {
+                n = len;
+            }
+            memcpy(h->buf + h->end, data, n);
+            h->end += n;
+            data += n;
+            len -= n;
+            if (h->end == h->cap && !drain_direct(h)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /* buffer and data together, without copying the data */
+    struct iovec iov[2] = { { h->buf, h->end }, { (void *)data, len } };
+    h->end = 0;
+    return write_iov(h->fd, iov, 2);
+}
+
+/* Pending output of write_lines: buffer spans and long strings by
+   reference, in order. buf[mark, end) is not queued yet. */
+typedef struct {
+    struct iovec iov[IO_IOV_MAX];
+    int n;
+    size_t mark;
+} Gather;
+
+static void gather_buffer(Handle *h, Gather *g) {
+    if (h->end > g->mark) {
+        g->iov[g->n].iov_base = h->buf + g->mark;
+        g->iov[g->n].iov_len = h->end - g->mark;
+        g->n++;
+        g->mark = h->end;
+    }
+}
+
+static bool gather_send(Handle *h, Gather *g) {
+    gather_buffer(h, g);
+    bool ok = write_iov(h->fd, g->iov, g->n);
+    g->n = 0;
+    g->mark = 0;
+    h->end = 0;
+    return ok;
+}
+
+bool io_write_lines(Handle *h, const Value *items, size_t count) {
+    if (h->direct) {
+        for (size_t i = 0; i < count; i++) {
+            const String *s = &items[i].as.str_val;
+            if (!io_write(h, s->data, s->len) || !io_write(h, "\n", 1)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    Gather g;
+    g.n = 0;
+    g.mark = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        const String *s = &items[i].as.str_val;
+
+        if (g.n >= IO_IOV_MAX - 2 || h->end == h->cap ||
+            (s->len < IO_GATHER_MIN && s->len >= h->cap - h->end)) {
+            if (!gather_send(h, &g)) {
+                return false;
+            }
+        }
+
+        if (s->len >= IO_GATHER_MIN) {
+            gather_buffer(h, &g);
+            g.iov[g.n].iov_base = (void *)s->data;
+            g.iov[g.n].iov_len = s->len;
+            g.n++;
+        } else {
+            memcpy(h->buf + h->end, s->data, s->len);
+            h->end += s->len;
+        }
+        h->buf[h->end++] = '\n';
+    }
+
+    /* queued strings are only borrowed for this call */
+    if (g.n > 0) {
+        return gather_send(h, &g);
+    }
+    return true;
+}
+
+/* =========================
+   Copying
+   ========================= */
+
+/* The kernel-side copy calls share one shape: move up to `len` bytes,
+   returning the count, 0 at end of input, or -1 with errno set. */
+typedef ssize_t (*CopyStep)(int in, int out, size_t len);
+
+static ssize_t step_copy_file_range(int in, int out, size_t len) {
+    return copy_file_range(in, NULL, out, NULL, len, 0);
+}
+
+static ssize_t step_sendfile(int in, int out, size_t len) {
+    return sendfile(out, in, NULL, len);
+}
+
+static ssize_t step_splice(int in, int out, size_t len) {
+    return splice(in, NULL, out, NULL, len, SPLICE_F_MOVE | SPLICE_F_MORE);
+}
+
+/* Runs step until end of input. Returns 1 when done, 0 when the very
+   first call shows the method does not apply to these descriptors, and
+   -1 on a real error. */
+static int copy_with(CopyStep step, int in, int out, uint64_t *copied) {
+    bool started = false;
+
+    for (;;) {
+        ssize_t n = step(in, out, IO_COPY_STEP);
+
+        if (n > 0) {
+            *copied += (uint64_t)n;
+            started = true;
+            continue;
+        }
+        if (n == 0) {
+            return 1;
+        }
+        if (errno == EINTR || errno == EAGAIN) {
+            continue;
+        }
+        if (!started && (errno == EINVAL || errno == EXDEV || errno == ENOSYS ||
+                         errno == EOPNOTSUPP || errno == EBADF)) {
+            return 0;
+        }
+        return -1;
+    }
+}
+
+static bool copy_read_write(int in, int out, uint64_t *copied) {
+    char *buf = (char *)malloc(IO_BUF_SIZE);
+    if (!buf) {
+        runtime_error("Out of memory");
+    }
+
+    bool ok = true;
+    for (;;) {
+        ssize_t n = read(in, buf, IO_BUF_SIZE);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            ok = n == 0;
+            break;
+        }
+
+        struct iovec iov = { buf, (size_t)n };
+        if (!write_iov(out, &iov, 1)) {
+            ok = false;
+            break;
+        }
+        *copied += (uint64_t)n;
+    }
+
+    free(buf);
+    return ok;
+}
+
+bool io_copy_fd(int in, int out, uint64_t *copied) {
+    struct stat in_st = {0};
+    struct stat out_st = {0};
+    bool in_file = fstat(in, &in_st) == 0 && S_ISREG(in_st.st_mode);
+    bool out_file = fstat(out, &out_st) == 0 && S_ISREG(out_st.st_mode);
+    bool pipe_end = (!in_file && S_ISFIFO(in_st.st_mode)) ||
+                    (!out_file && S_ISFIFO(out_st.st_mode));
+    int r = 0;
+
+    if (in_file) {
+        posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+    if (in_file && out_file) {
+        r = copy_with(step_copy_file_range, in, out, copied);
+    }
+    if (r == 0 && in_file) {
+        r = copy_with(step_sendfile, in, out, copied);
+    }
+    if (r == 0 && pipe_end) {
+        r = copy_with(step_splice, in, out, copied);
+    }
+    if (r == 0) {
+        return copy_read_write(in, out, copied);
+    }
+    return r > 0;
+}
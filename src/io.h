@@ -0,0 +1,80 @@
+#ifndef IO_H
+#define IO_H
+
+#include "value.h"
+
+/* Streaming file handles.
+
+   A handle owns a file descriptor and a read buffer. Reads refill the
+   buffer with one read() of up to IO_BUF_SIZE bytes, and lines are found
+   with a vectorized newline search, so a file of any size streams through
+   a fixed amount of memory. Only a line longer than the buffer grows it.
+
+   Writer handles ("w" truncates, "a" appends) collect output in the same
+   kind of buffer. Small writes are copied into it; a string of at least
+   IO_GATHER_MIN bytes is not copied but queued by reference, and the
+   buffer and queued strings go out together in one writev(). With a
+   "d" suffix ("wd", "ad") the file is opened with O_DIRECT and written
+   in whole aligned blocks from an aligned buffer, skipping the page
+   cache; filesystems that refuse O_DIRECT fall back to normal writes.
+
+   Handles are refcounted; the descriptor is closed by close() or when the
+   last reference goes away. Unclosed writers are flushed at exit. The
+   stdin handle never closes fd 0. */
+
+#define IO_BUF_SIZE   (1 << 20)
+#define IO_GATHER_MIN 4096
+#define IO_ALIGN      4096
+
+struct Handle {
+    size_t refcount;
+    int fd;            /* -1 once closed */
+    bool owns_fd;
+    bool writable;
+    bool direct;       /* O_DIRECT is set on fd */
+
+    char *buf;
+    size_t pos;        /* unread bytes are buf[pos, end) */
+    size_t end;        /* writers: pending bytes are buf[0, end) */
+    size_t cap;
+
+    Handle *prev;      /* open writers, flushed at exit */
+    Handle *next;
+
+    struct CsvReader *csv;   /* csv_open handles read through this */
+};
+
+/* mode is "r", "w", "a", "wd" or "ad". On failure returns false and
+   sets *err. */
+bool  io_open(const char *path, const char *mode, Value *out, const char **err);
+Value io_stdin(void);
+/* Handles over an already open descriptor, which they then own. */
+Value io_fd_reader(int fd);
+Value io_fd_writer(int fd);
+/* Closes the handle but hands its descriptor to the caller. Flush a
+   writer first. */
+int   io_take_fd(Handle *h);
+
+/* Writers. These return false when the underlying write fails. */
+bool  io_write(Handle *h, const char *data, size_t len);
+/* Each string followed by '\n'; items must all be strings. */
+bool  io_write_lines(Handle *h, const Value *items, size_t count);
+bool  io_flush(Handle *h);
+
+/* Next line without its '\n'; false at end of input. */
+bool  io_read_line(Handle *h, Value *line);
+/* Up to n bytes; "" at end of input. */
+Value io_read_chunk(Handle *h, size_t n);
+bool  io_eof(Handle *h);   /* also for CSV handles */
+/* Flushes a writer, then closes. False if the final flush failed. */
+bool  io_close(Handle *h);
+
+void  handle_release(Handle *h);
+
+/* Copies from in's current offset to its end into out, inside the
+   kernel where possible: copy_file_range between files, sendfile from a
+   file to anything, splice when either side is a pipe, and a read/write
+   loop otherwise. Adds the bytes moved to *copied. */
+bool  io_copy_fd(int in, int out, uint64_t *copied);
+
+#endif
@@ -0,0 +1,880 @@
+#include "json.h"
+#include "bigint.h"
+#include "map.h"
+#include "output.h"
+#include "simd.h"
+#include "error.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define JSON_WINDOW     65536
+#define JSON_MAX_DEPTH  1024
+#define ESCAPES_FLAG    0x80000000u
+
+/* =========================
+   Stage one: structural index
+   ========================= */
+
+typedef struct {
+    const char *p;
+    size_t n;
+    Value text;
+
+    /* Stage one state, carried from block to block. */
+    size_t scanned;            /* input indexed so far */
+    uint64_t prev_escaped;     /* first byte of the next block is escaped */
+    uint64_t prev_in_string;   /* all ones while inside a string */
+    uint64_t prev_scalar;      /* last byte was part of a number or literal */
+    bool backslash_pending;    /* the open string has escapes */
+
+    SimdJsonBlock *blocks;
+    uint32_t *index;           /* window offsets, ESCAPES_FLAG on quotes */
+    size_t base;               /* input offset of the window */
+    size_t count;
+    size_t at;
+    bool escapes;              /* flag of the last token taken */
+
+    /* Items of the arrays and objects being parsed, innermost last. */
+    Value *stack;
+    size_t stack_len;
+    size_t stack_cap;
+
+    size_t end;                /* just past the last value parsed */
+
+    const char *err;
+    size_t err_pos;
+} Parser;
+
+static bool fail(Parser *ps, size_t pos, const char *msg) {
+    if (!ps->err || pos < ps->err_pos) {
+        ps->err = msg;
+        ps->err_pos = pos;
+    }
+    return false;
+}
+
+/* Running out of tokens is only the reason if stage one did not stop
+   early on an error of its own. */
+static bool fail_eof(Parser *ps, size_t pos, const char *msg) {
+    if (!ps->err) {
+        ps->err = msg;
+        ps->err_pos = pos;
+    }
+    return false;
+}
+
+/* The bytes escaped by a backslash: those after a run of odd length.
+   Runs are told apart by whether they start on an even or an odd bit;
+   adding the run starts to the backslashes carries each start through
+   its run and out one past the end. */
+static uint64_t find_escaped(uint64_t backslash, uint64_t *prev_escaped) {
+    const uint64_t even = 0x5555555555555555ULL;
+
+    backslash &= ~*prev_escaped;
+    uint64_t follows = backslash << 1 | *prev_escaped;
+    uint64_t odd_starts = backslash & ~even & ~follows;
+    uint64_t carried;
+    *prev_escaped = __builtin_add_overflow(odd_starts, backslash, &carried);
+    uint64_t invert = carried << 1;
+    return (even ^ invert) & follows;
+}
+
+static void scan_window(Parser *ps) {
+    size_t start = ps->scanned;
+    size_t len = ps->n - start < JSON_WINDOW ? ps->n - start : JSON_WINDOW;
+    uint32_t *index = ps->index;
+    size_t count = 0;
+
+    simd_json_blocks(ps->p + start, len, ps->blocks);
+    ps->base = start;
+    ps->scanned = start + len;
+
+    for (size_t w = 0; w * 64 < len; w++) {
+        const SimdJsonBlock *b = &ps->blocks[w];
+        uint64_t valid = len - w * 64 >= 64 ? ~0ULL
+                       : ((uint64_t)1 << (len - w * 64)) - 1;
+
+        uint64_t quote = b->quote & ~find_escaped(b->backslash, &ps->prev_escaped);
+        uint64_t in_string = simd_prefix_xor(quote) ^ ps->prev_in_string;
+        ps->prev_in_string = (uint64_t)((int64_t)in_string >> 63);
+        /* string contents and closing quotes */
+        uint64_t body = in_string ^ quote;
+
+        /* A number or literal starts at a byte that is neither
+           structural nor space and does not follow another such byte. */
+        uint64_t scalar = ~(b->op | b->space) & valid;
+        uint64_t plain = scalar & ~quote;
+        uint64_t follows = plain << 1 | ps->prev_scalar;
+        ps->prev_scalar = plain >> 63;
+
+        uint64_t structural = ((b->op | (scalar & ~follows)) & ~body) |
+                              (quote & body);
+        uint64_t backslashes = b->backslash & body;
+        uint64_t control = b->control & body;
+
+        /* nothing past a raw control byte in a string is indexed */
+        if (control) {
+            int at = __builtin_ctzll(control);
+            structural &= ((uint64_t)1 << at) - 1;
+            fail(ps, start + w * 64 + (size_t)at, "control character in string");
+            ps->scanned = ps->n;
+        }
+
+        while (structural) {
+            int at = __builtin_ctzll(structural);
+            uint64_t below = ((uint64_t)1 << at) - 1;
+            bool escapes = ps->backslash_pending || (backslashes & below);
+
+            index[count++] = (uint32_t)(w * 64 + (size_t)at) |
+                             (escapes ? ESCAPES_FLAG : 0);
+            backslashes &= ~below;
+            ps->backslash_pending = false;
+            structural &= structural - 1;
+        }
+        ps->backslash_pending |= backslashes != 0;
+
+        if (control) {
+            break;
+        }
+    }
+
+    ps->count = count;
+    ps->at = 0;
+}
+
+static bool next_token(Parser *ps, size_t *pos) {
+    while (ps->at == ps->count) {
+        if (ps->scanned >= ps->n) {
+            return false;
+        }
+        scan_window(ps);
+    }
+
+    uint32_t e = ps->index[ps->at++];
+    *pos = ps->base + (e & ~ESCAPES_FLAG);
+    ps->escapes = (e & ESCAPES_FLAG) != 0;
+    return true;
+}
+
+static void parser_init(Parser *ps, Value text) {
+    size_t window = text.as.str_val.len < JSON_WINDOW ? text.as.str_val.len
+                                                      : JSON_WINDOW;
+
+    memset(ps, 0, sizeof(*ps));
+    ps->p = text.as.str_val.data;
+    ps->n = text.as.str_val.len;
+    ps->text = text;
+    ps->blocks = malloc(sizeof(SimdJsonBlock) * ((window + 63) / 64 + 1));
+    ps->index = malloc(sizeof(uint32_t) * (window + 1));
+    if (!ps->blocks || !ps->index) {
+        runtime_error("Out of memory");
+    }
+}
+
+static void parser_free(Parser *ps) {
+    for (size_t i = 0; i < ps->stack_len; i++) {
+        value_free(ps->stack[i]);
+    }
+    free(ps->stack);
+    free(ps->index);
+    free(ps->blocks);
+}
+
+/* =========================
+   Stage two: values
+   ========================= */
+
+static void push(Parser *ps, Value v) {
+    if (ps->stack_len == ps->stack_cap) {
+        ps->stack_cap = ps->stack_cap ? ps->stack_cap * 2 : 64;
+        ps->stack = realloc(ps->stack, sizeof(Value) * ps->stack_cap);
+        if (!ps->stack) {
+            runtime_error("Out of memory");
+        }
+    }
+    ps->stack[ps->stack_len++] = v;
+}
+
+static void pop_to(Parser *ps, size_t mark) {
+    while (ps->stack_len > mark) {
+        value_free(ps->stack[--ps->stack_len]);
+    }
+}
+
+/* What may follow a number or literal. */
+static bool is_delimiter(const Parser *ps, size_t i) {
+    if (i >= ps->n) {
+        return true;
+    }
+    switch (ps->p[i]) {
+        case ' ': case '\t': case '\n': case '\r':
+        case ',': case ':': case '[': case ']': case '{': case '}':
+            return true;
+        default:
+            return false;
+    }
+}
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static int read_hex4(const char *p) {
+    int x = 0;
+    for (int i = 0; i < 4; i++) {
+        int d = hex_digit(p[i]);
+        if (d < 0) {
+            return -1;
+        }
+        x = x << 4 | d;
+    }
+    return x;
+}
+
+static size_t put_utf8(char *dst, uint32_t cp) {
+    if (cp < 0x80) {
+        dst[0] = (char)cp;
+        return 1;
+    }
+    if (cp < 0x800) {
+        dst[0] = (char)(0xc0 | cp >> 6);
+        dst[1] = (char)(0x80 | (cp & 0x3f));
+        return 2;
+    }
+    if (cp < 0x10000) {
+        dst[0] = (char)(0xe0 | cp >> 12);
+        dst[1] = (char)(0x80 | (cp >> 6 & 0x3f));
+        dst[2] = (char)(0x80 | (cp & 0x3f));
+        return 3;
+    }
+    dst[0] = (char)(0xf0 | cp >> 18);
+    dst[1] = (char)(0x80 | (cp >> 12 & 0x3f));
+    dst[2] = (char)(0x80 | (cp >> 6 & 0x3f));
+    dst[3] = (char)(0x80 | (cp & 0x3f));
+    return 4;
+}
+
+/* Decodes p[from, to), the contents of a string with escapes. Escapes
+   never decode to more bytes than they take up, so the result fits in a
+   buffer the size of the raw text. */
+static bool decode_string(Parser *ps, size_t from, size_t to, Value *out) {
+    const char *p = ps->p;
+    Value s = value_string_alloc(to - from);
+    char *dst = s.as.str_val.buf->bytes;
+    size_t len = 0;
+    size_t i = from;
+
+    for (;;) {
+        size_t run = simd_find_byte(p + i, to - i, '\\');
+        memcpy(dst + len, p + i, run);
+        len += run;
+        i += run;
+        if (i >= to) {
+            break;
+        }
+
+        /* an unescaped quote closes the string, so a backslash inside
+           it always has a byte after it */
+        char c = p[i + 1];
+        switch (c) {
+            case '"': case '\\': case '/': dst[len++] = c; break;
+            case 'b': dst[len++] = '\b'; break;
+            case 'f': dst[len++] = '\f'; break;
+            case 'n': dst[len++] = '\n'; break;
+            case 'r': dst[len++] = '\r'; break;
+            case 't': dst[len++] = '\t'; break;
+            case 'u': {
+                int cp = to - i >= 6 ? read_hex4(p + i + 2) : -1;
+                if (cp >= 0xdc00 && cp <= 0xdfff) {
+                    cp = -1;
+                } else if (cp >= 0xd800 && cp <= 0xdbff) {
+                    int lo = to - i >= 12 && p[i + 6] == '\\' && p[i + 7] == 'u'
+                           ? read_hex4(p + i + 8) : -1;
+                    if (lo >= 0xdc00 && lo <= 0xdfff) {
+                        cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+                        i += 6;
+                    } else {
+                        cp = -1;
+                    }
+                }
+                if (cp < 0) {
+                    value_free(s);
+                    return fail(ps, i, "invalid \\u escape");
+                }
+                len += put_utf8(dst + len, (uint32_t)cp);
+                i += 4;
+                break;
+            }
+            default:
+                value_free(s);
+                return fail(ps, i, "invalid escape");
+        }
+        i += 2;
+    }
+
+    dst[len] = '\0';
+    s.as.str_val.buf->used = len;
+    s.as.str_val.len = len;
+    *out = s;
+    return true;
+}
+
+static bool parse_string(Parser *ps, size_t open, Value *out) {
+    size_t close;
+
+    if (!next_token(ps, &close) || ps->p[close] != '"') {
+        return fail_eof(ps, open, "unterminated string");
+    }
+    ps->end = close + 1;
+
+    if (ps->escapes) {
+        return decode_string(ps, open + 1, close, out);
+    }
+    *out = value_string_view(ps->text, open + 1, close - open - 1);
+    return true;
+}
+
+static bool is_digit(const Parser *ps, size_t i) {
+    return i < ps->n && ps->p[i] >= '0' && ps->p[i] <= '9';
+}
+
+static bool parse_number(Parser *ps, size_t pos, Value *out) {
+    const char *p = ps->p;
+    size_t i = pos;
+    bool neg = p[i] == '-';
+
+    /* mag is only right up to 18 digits; it wraps harmlessly past that */
+    uint64_t mag = 0;
+    i += neg;
+    size_t digits = i;
+    if (i < ps->n && p[i] == '0') {
+        i++;
+    } else if (is_digit(ps, i)) {
+        while (is_digit(ps, i)) {
+            mag = mag * 10 + (uint64_t)(p[i] - '0');
+            i++;
+        }
+    } else {
+        return fail(ps, pos, "invalid number");
+    }
+    size_t digits_end = i;
+
+    bool integral = true;
+    if (i < ps->n && p[i] == '.') {
+        i++;
+        if (!is_digit(ps, i)) {
+            return fail(ps, pos, "invalid number");
+        }
+        while (is_digit(ps, i)) i++;
+        integral = false;
+    }
+    if (i < ps->n && (p[i] == 'e' || p[i] == 'E')) {
+        i++;
+        if (i < ps->n && (p[i] == '+' || p[i] == '-')) i++;
+        if (!is_digit(ps, i)) {
+            return fail(ps, pos, "invalid number");
+        }
+        while (is_digit(ps, i)) i++;
+        integral = false;
+    }
+    if (!is_delimiter(ps, i)) {
+        return fail(ps, pos, "invalid number");
+    }
+    ps->end = i;
+
+    if (!integral) {
+        *out = value_string_view(ps->text, pos, i - pos);
+        return true;
+    }
+
+    /* 19 or 20 digits might still fit */
+    size_t count = digits_end - digits;
+    bool over = count > 20;
+    if (count > 18 && !over) {
+        mag = 0;
+        for (size_t k = digits; k < digits_end && !over; k++) {
+            over = __builtin_mul_overflow(mag, 10, &mag) ||
+                   __builtin_add_overflow(mag, (uint64_t)(p[k] - '0'), &mag);
+        }
+    }
+    if (!over && mag <= (uint64_t)INT64_MAX + neg) {
+        *out = value_int(neg ? (int64_t)(0 - mag) : (int64_t)mag);
+        return true;
+    }
+    *out = bigint_from_digits(p + digits, digits_end - digits, neg);
+    return true;
+}
+
+static bool parse_literal(Parser *ps, size_t pos, const char *word, bool b,
+                          Value *out) {
+    size_t len = strlen(word);
+
+    if (ps->n - pos < len || memcmp(ps->p + pos, word, len) != 0 ||
+        !is_delimiter(ps, pos + len)) {
+        return fail(ps, pos, "invalid literal");
+    }
+    ps->end = pos + len;
+    *out = value_bool(b);
+    return true;
+}
+
+static bool parse_value(Parser *ps, size_t pos, int depth, Value *out);
+
+static bool parse_array(Parser *ps, size_t open, int depth, Value *out) {
+    size_t mark = ps->stack_len;
+    size_t pos;
+
+    if (!next_token(ps, &pos)) {
+        return fail_eof(ps, open, "unterminated array");
+    }
+    if (ps->p[pos] != ']') {
+        for (;;) {
+            Value v;
+            if (!parse_value(ps, pos, depth + 1, &v)) {
+                pop_to(ps, mark);
+                return false;
+            }
+            push(ps, v);
+
+            if (!next_token(ps, &pos)) {
+                pop_to(ps, mark);
+                return fail_eof(ps, open, "unterminated array");
+            }
+            if (ps->p[pos] == ']') {
+                break;
+            }
+            if (ps->p[pos] != ',') {
+                pop_to(ps, mark);
+                return fail(ps, pos, "expected ',' or ']'");
+            }
+            if (!next_token(ps, &pos)) {
+                pop_to(ps, mark);
+                return fail_eof(ps, open, "unterminated array");
+            }
+        }
+    }
+    ps->end = pos + 1;
+
+    size_t count = ps->stack_len - mark;
+    if (count == 0) {
+        *out = value_array();
+        return true;
+    }
+
+    Value *items = malloc(sizeof(Value) * count);
+    if (!items) {
+        runtime_error("Out of memory");
+    }
+    memcpy(items, ps->stack + mark, sizeof(Value) * count);
+    ps->stack_len = mark;
+    *out = value_array_from_values(items, count);
+    return true;
+}
+
+/* Keys and values go on the stack first so the map is built at its
+   final size. */
+static bool parse_object(Parser *ps, size_t open, int depth, Value *out) {
+    size_t mark = ps->stack_len;
+    size_t pos;
+
+    if (!next_token(ps, &pos)) {
+        return fail_eof(ps, open, "unterminated object");
+    }
+    if (ps->p[pos] != '}') {
+        for (;;) {
+            Value v;
+
+            if (ps->p[pos] != '"') {
+                pop_to(ps, mark);
+                return fail(ps, pos, "expected a string key");
+            }
+            if (!parse_string(ps, pos, &v)) {
+                pop_to(ps, mark);
+                return false;
+            }
+            push(ps, v);
+
+            if (!next_token(ps, &pos)) {
+                pop_to(ps, mark);
+                return fail_eof(ps, open, "unterminated object");
+            }
+            if (ps->p[pos] != ':') {
+                pop_to(ps, mark);
+                return fail(ps, pos, "expected ':'");
+            }
+            if (!next_token(ps, &pos)) {
+                pop_to(ps, mark);
+                return fail_eof(ps, open, "unterminated object");
+            }
+            if (!parse_value(ps, pos, depth + 1, &v)) {
+                pop_to(ps, mark);
+                return false;
+            }
+            push(ps, v);
+
+            if (!next_token(ps, &pos)) {
+                pop_to(ps, mark);
+                return fail_eof(ps, open, "unterminated object");
+            }
+            if (ps->p[pos] == '}') {
+                break;
+            }
+            if (ps->p[pos] != ',') {
+                pop_to(ps, mark);
+                return fail(ps, pos, "expected ',' or '}'");
+            }
+            if (!next_token(ps, &pos)) {
+                pop_to(ps, mark);
+                return fail_eof(ps, open, "unterminated object");
+            }
+        }
+    }
+    ps->end = pos + 1;
+
+    Value map;
+    map.type = VAL_MAP;
+    map.as.map_val = map_new_sized((ps->stack_len - mark) / 2);
+    for (size_t i = mark; i < ps->stack_len; i += 2) {
+        map_set(map.as.map_val, ps->stack[i], ps->stack[i + 1]);
+    }
+    ps->stack_len = mark;
+    *out = map;
+    return true;
+}
+
+static bool parse_value(Parser *ps, size_t pos, int depth, Value *out) {
+    if (depth > JSON_MAX_DEPTH) {
+        return fail(ps, pos, "nesting too deep");
+    }
+
+    switch (ps->p[pos]) {
+        case '{': return parse_object(ps, pos, depth, out);
+        case '[': return parse_array(ps, pos, depth, out);
+        case '"': return parse_string(ps, pos, out);
+        case 't': return parse_literal(ps, pos, "true", true, out);
+        case 'f': return parse_literal(ps, pos, "false", false, out);
+        case 'n': return parse_literal(ps, pos, "null", false, out);
+        case '-':
+            return parse_number(ps, pos, out);
+        default:
+            if (ps->p[pos] >= '0' && ps->p[pos] <= '9') {
+                return parse_number(ps, pos, out);
+            }
+            return fail(ps, pos, "expected a value");
+    }
+}
+
+static void format_error(const Parser *ps, char *err, size_t err_size) {
+    size_t line = 1;
+    size_t line_start = 0;
+
+    for (size_t i = 0; i < ps->err_pos; i++) {
+        if (ps->p[i] == '\n') {
+            line++;
+            line_start = i + 1;
+        }
+    }
+    snprintf(err, err_size, "Invalid JSON at line %zu, column %zu: %s",
+             line, ps->err_pos - line_start + 1, ps->err);
+}
+
+bool json_parse(Value text, Value *out, char *err, size_t err_size) {
+    Parser ps;
+    size_t pos;
+
+    parser_init(&ps, text);
+
+    if (!next_token(&ps, &pos)) {
+        fail_eof(&ps, ps.n, "no value");
+    } else if (parse_value(&ps, pos, 0, out)) {
+        if (next_token(&ps, &pos)) {
+            fail(&ps, pos, "unexpected data after the value");
+        }
+        if (ps.err) {
+            value_free(*out);
+        }
+    }
+
+    bool ok = ps.err == NULL;
+    if (!ok) {
+        format_error(&ps, err, err_size);
+    }
+    parser_free(&ps);
+    return ok;
+}
+
+bool json_parse_lines(Value text, Value *out, char *err, size_t err_size) {
+    Parser ps;
+    size_t pos;
+
+    parser_init(&ps, text);
+
+    while (next_token(&ps, &pos)) {
+        Value v;
+
+        if (ps.stack_len > 0 &&
+            !memchr(ps.p + ps.end, '\n', pos - ps.end)) {
+            fail(&ps, pos, "expected one value per line");
+            break;
+        }
+        if (!parse_value(&ps, pos, 0, &v)) {
+            break;
+        }
+        push(&ps, v);
+    }
+
+    bool ok = ps.err == NULL;
+    if (ok) {
+        size_t count = ps.stack_len;
+        if (count == 0) {
+            *out = value_array();
+        } else {
+            *out = value_array_from_values(ps.stack, count);
+            ps.stack = NULL;
+            ps.stack_len = 0;
+        }
+    } else {
+        format_error(&ps, err, err_size);
+    }
+    parser_free(&ps);
+    return ok;
+}
+
+/* =========================
+   Stringify
+   ========================= */
+
+/* Output collects in a small buffer and goes to the result string in
+   pieces; appends to a string at the end of its buffer land in place
+   and the buffer doubles when full. */
+typedef struct {
+    Value str;
+    size_t len;
+    const char *err;
+    char buf[4096];
+} Writer;
+
+static void flush(Writer *w) {
+    w->str = value_string_append(w->str, w->buf, w->len);
+    w->len = 0;
+}
+
+static void put(Writer *w, const char *data, size_t len) {
+    if (len > sizeof(w->buf) - w->len) {
+        flush(w);
+        if (len > sizeof(w->buf)) {
+            w->str = value_string_append(w->str, data, len);
+            return;
+        }
+    }
+    memcpy(w->buf + w->len, data, len);
+    w->len += len;
+}
+
+static void put_char(Writer *w, char c) {
+    if (w->len == sizeof(w->buf)) {
+        flush(w);
+    }
+    w->buf[w->len++] = c;
+}
+
+static void put_int(Writer *w, int64_t x) {
+    char digits[24];
+    put(w, digits, format_int(digits, x));
+}
+
+static void put_bigint(Writer *w, const BigInt *big) {
+    char *digits = bigint_to_cstr(big);
+    put(w, digits, strlen(digits));
+    free(digits);
+}
+
+static void put_string(Writer *w, const char *s, size_t len) {
+    static const char hex[] = "0123456789abcdef";
+    size_t run = 0;
+
+    put_char(w, '"');
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)s[i];
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+
+        put(w, s + run, i - run);
+        run = i + 1;
+        switch (c) {
+            case '"':  put(w, "\\\"", 2); break;
+            case '\\': put(w, "\\\\", 2); break;
+            case '\n': put(w, "\\n", 2); break;
+            case '\r': put(w, "\\r", 2); break;
+            case '\t': put(w, "\\t", 2); break;
+            case '\b': put(w, "\\b", 2); break;
+            case '\f': put(w, "\\f", 2); break;
+            default: {
+                char u[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 15]};
+                put(w, u, sizeof(u));
+                break;
+            }
+        }
+    }
+    put(w, s + run, len - run);
+    put_char(w, '"');
+}
+
+static void put_value(Writer *w, Value v, int depth);
+
+static void put_fields(Writer *w, const Shape *shape, const Value *slots,
+                       int depth) {
+    put_char(w, '{');
+    for (size_t i = 0; i < shape->field_count && !w->err; i++) {
+        if (i > 0) {
+            put_char(w, ',');
+        }
+        put_string(w, shape->fields[i], strlen(shape->fields[i]));
+        put_char(w, ':');
+        put_value(w, slots[i], depth + 1);
+    }
+    put_char(w, '}');
+}
+
+static void put_key(Writer *w, Value key) {
+    switch (key.type) {
+        case VAL_STRING:
+            put_string(w, key.as.str_val.data, key.as.str_val.len);
+            return;
+        case VAL_INT:
+            put_char(w, '"');
+            put_int(w, key.as.int_val);
+            put_char(w, '"');
+            return;
+        case VAL_BIGINT:
+            put_char(w, '"');
+            put_bigint(w, key.as.big_val);
+            put_char(w, '"');
+            return;
+        default:
+            w->err = "json_stringify needs string or int map keys";
+            return;
+    }
+}
+
+static void put_value(Writer *w, Value v, int depth) {
+    if (depth > JSON_MAX_DEPTH) {
+        w->err = "Value is nested too deeply to encode";
+        return;
+    }
+
+    switch (v.type) {
+        case VAL_INT:
+            put_int(w, v.as.int_val);
+            return;
+
+        case VAL_BIGINT:
+            put_bigint(w, v.as.big_val);
+            return;
+
+        case VAL_BOOL:
+            if (v.as.bool_val) {
+                put(w, "true", 4);
+            } else {
+                put(w, "false", 5);
+            }
+            return;
+
+        case VAL_STRING:
+            put_string(w, v.as.str_val.data, v.as.str_val.len);
+            return;
+
+        case VAL_ARRAY: {
+            const Array *arr = v.as.array_val;
+
+            put_char(w, '[');
+            for (size_t i = 0; i < arr->count && !w->err; i++) {
+                if (i > 0) {
+                    put_char(w, ',');
+                }
+                switch (arr->kind) {
+                    case ARRAY_INTS:
+                        put_int(w, arr->ints[i]);
+                        break;
+                    case ARRAY_BOOLS:
+                        if (array_get_bool(arr, i)) {
+                            put(w, "true", 4);
+                        } else {
+                            put(w, "false", 5);
+                        }
+                        break;
+                    case ARRAY_RECORDS:
+                        put_fields(w, arr->shape,
+                                   arr->items + i * arr->shape->field_count,
+                                   depth + 1);
+                        break;
+                    case ARRAY_VALUES:
+                        put_value(w, arr->items[i], depth + 1);
+                        break;
+                }
+            }
+            put_char(w, ']');
+            return;
+        }
+
+        case VAL_MAP: {
+            const Map *map = v.as.map_val;
+            bool first = true;
+
+            put_char(w, '{');
+            for (size_t i = 0; i < map->used && !w->err; i++) {
+                const MapEntry *e = &map->entries[i];
+                if (e->deleted) {
+                    continue;
+                }
+                if (!first) {
+                    put_char(w, ',');
+                }
+                first = false;
+                put_key(w, e->key);
+                put_char(w, ':');
+                put_value(w, e->value, depth + 1);
+            }
+            put_char(w, '}');
+            return;
+        }
+
+        case VAL_RECORD:
+            put_fields(w, v.as.rec_val->shape, v.as.rec_val->slots, depth);
+            return;
+
+        default:
+            w->err = "json_stringify supports ints, bools, strings, arrays, "
+                     "maps and records";
+            return;
+    }
+}
+
+bool json_stringify(Value v, Value *out, const char **err) {
+    Writer *w = malloc(sizeof(Writer));
+    if (!w) {
+        runtime_error("Out of memory");
+    }
+    w->str = value_string("");
+    w->len = 0;
+    w->err = NULL;
+
+    put_value(w, v, 0);
+    flush(w);
+
+    bool ok = w->err == NULL;
+    if (ok) {
+        *out = w->str;
+    } else {
+        *err = w->err;
+        value_free(w->str);
+    }
+    free(w);
+    return ok;
+}
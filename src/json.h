@@ -0,0 +1,43 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include "value.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/* JSON.
+
+   Parsing runs in two stages over 64 KB windows of the input. Stage one
+   classifies every byte of a window with the vectorized scanner (quotes,
+   backslashes, the six structural characters, whitespace) and turns the
+   bitmaps into a list of positions: every structural character outside
+   strings, both quotes of every string (the closing one flagged when the
+   string has escapes) and the first byte of every number or literal.
+   Backslash runs are resolved and in-string regions found with
+   branch-free bit arithmetic, 64 bytes at a time. Stage two is a
+   recursive descent over that list that never looks at the bytes between
+   positions except to read a number or decode an escaped string.
+
+   Values map onto Kite as: objects to maps with string keys (a repeated
+   key keeps the last value), arrays to arrays (packed when they hold
+   only ints or bools), strings to strings, integers to ints or bigints,
+   true/false to bools and null to false. Numbers with a fraction or an
+   exponent come back as a string holding their text, since Kite has no
+   floats. Strings without escapes are views into the input, so the
+   result shares its buffer; bytes are not checked to be UTF-8, but a
+   \u escape must encode a code point (a lone surrogate is an error). */
+
+/* Parses the one document in text (a string, borrowed). On failure
+   returns false and writes a message with the line and column to err. */
+bool json_parse(Value text, Value *out, char *err, size_t err_size);
+
+/* Newline-delimited JSON: one document per non-blank line, collected
+   into an array. */
+bool json_parse_lines(Value text, Value *out, char *err, size_t err_size);
+
+/* Encodes v (borrowed) as compact JSON. Maps need string or int keys
+   (ints are written as strings) and records become objects. On failure
+   returns false and sets *err to a static message. */
+bool json_stringify(Value v, Value *out, const char **err);
+
+#endif
@@ -86,6 +86,7 @@ static TokenType keyword_type(const char *start, size_t len) {
     if (len == 4 && strncmp(start, "true", 4) == 0) return TOK_TRUE;
     if (len == 5 && strncmp(start, "false", 5) == 0) return TOK_FALSE;
     if (len == 5 && strncmp(start, "until", 5) == 0) return TOK_UNTIL;
+    if (len == 6 && strncmp(start, "record", 6) == 0) return TOK_RECORD;
 
     return TOK_IDENT;
 }
@@ -188,7 +189,11 @@ Token lexer_next(Lexer *l) {
         case ')': return make_token(l, TOK_RPAREN, start);
         case '[': return make_token(l, TOK_LBRACK, start);
         case ']': return make_token(l, TOK_RBRACK, start);
+        case '{': return make_token(l, TOK_LBRACE, start);
+        case '}': return make_token(l, TOK_RBRACE, start);
+        case ':': return make_token(l, TOK_COLON, start);
         case ',': return make_token(l, TOK_COMMA, start);
+        case '.': return make_token(l, TOK_DOT, start);
     }
 
     return error_token(l, start);
@@ -25,6 +25,7 @@ typedef enum {
     TOK_TRUE,
     TOK_FALSE,
     TOK_UNTIL,
+    TOK_RECORD,
 
     /* Operators */
     TOK_ASSIGN,     // =
@@ -44,7 +45,11 @@ typedef enum {
     TOK_RPAREN,     // )
     TOK_LBRACK,     // [
     TOK_RBRACK,     // ]
+    TOK_LBRACE,     // {
+    TOK_RBRACE,     // }
+    TOK_COLON,      // :
     TOK_COMMA,      // ,
+    TOK_DOT,        // .
     TOK_NEWLINE,
 
     TOK_EOF,
@@ -3,6 +3,7 @@
 #include "interp.h"
 #include "env.h"
 #include "ast.h"
+#include "output.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -60,6 +61,8 @@ int main(int argc, char **argv) {
         return 1;
     }
 
+    out_init();
+
     char *source = read_all(fp);
 
     if (fp != stdin) {
@@ -0,0 +1,339 @@
+#include "map.h"
+#include "bigint.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define MAP_MIN_SLOTS 8
+
+/* =========================
+   Hashing
+   ========================= */
+
+static uint64_t mix64(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+static uint64_t hash_bytes(const char *p, size_t n) {
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ n;
+
+    while (n >= 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        h = (h ^ mix64(w)) * 0x100000001b3ULL;
+        p += 8;
+        n -= 8;
+    }
+
+    uint64_t tail = 0;
+    memcpy(&tail, p, n);
+    return mix64(h ^ tail);
+}
+
+/* Strings that cover their whole buffer cache the hash there, so a key
+   that is looked up repeatedly is only hashed once. */
+static uint64_t string_hash(const String *s) {
+    StrBuf *buf = s->buf;
+    bool cacheable = s->data == buf->bytes;
+
+    if (cacheable && buf->hashed_len == s->len) {
+        return buf->hash;
+    }
+
+    uint64_t h = hash_bytes(s->data, s->len);
+    if (cacheable) {
+        buf->hash = h;
+        buf->hashed_len = s->len;
+    }
+    return h;
+}
+
+uint64_t value_hash(Value v) {
+    switch (v.type) {
+        case VAL_INT:
+            return mix64((uint64_t)v.as.int_val);
+        case VAL_BOOL:
+            return v.as.bool_val ? 0x5bd1e995ULL : 0x27d4eb2fULL;
+        case VAL_STRING:
+            return string_hash(&v.as.str_val);
+        case VAL_BYTES:
+            return string_hash(&v.as.str_val) ^ 0x85ebca6bULL;
+        case VAL_ARRAY: {
+            const Array *arr = v.as.array_val;
+            uint64_t h = 0xcbf29ce484222325ULL ^ arr->count;
+            for (size_t i = 0; i < arr->count; i++) {
+                Value item = array_get(arr, i);
+                h = mix64(h ^ value_hash(item)) + i;
+                value_free(item);
+            }
+            return h;
+        }
+        case VAL_BIGINT: {
+            const BigInt *big = v.as.big_val;
+            return hash_bytes((const char *)big->limbs, big->len * sizeof(uint32_t)) ^
+                   (big->neg ? 0x9e3779b97f4a7c15ULL : 0);
+        }
+        case VAL_RECORD: {
+            const Record *rec = v.as.rec_val;
+            uint64_t h = (uint64_t)(uintptr_t)rec->shape;
+            for (size_t i = 0; i < rec->shape->field_count; i++) {
+                h = mix64(h ^ value_hash(rec->slots[i])) + i;
+            }
+            return h;
+        }
+        default:
+            return 0;
+    }
+}
+
+/* Maps and functions cannot be keys: maps are mutable and functions have
+   no useful equality. */
+bool map_key_ok(Value key) {
+    return key.type == VAL_INT || key.type == VAL_BOOL ||
+           key.type == VAL_STRING || key.type == VAL_BYTES ||
+           key.type == VAL_ARRAY ||
+           key.type == VAL_RECORD || key.type == VAL_BIGINT;
+}
+
+/* =========================
+   Index
+   ========================= */
+
+static void index_insert(Map *map, uint64_t hash, uint32_t entry) {
+    size_t mask = map->slot_cap - 1;
+    size_t i = hash & mask;
+    MapSlot cur = { 1, entry };
+
+    for (;;) {
+        MapSlot *slot = &map->slots[i];
+
+        if (slot->psl == 0) {
+            *slot = cur;
+            return;
+        }
+
+        /* Robin Hood: the richer (closer to home) slot gives way. */
+        if (slot->psl < cur.psl) {
+            MapSlot tmp = *slot;
+            *slot = cur;
+            cur = tmp;
+        }
+
+        i = (i + 1) & mask;
+        cur.psl++;
+    }
+}
+
+/* Returns the slot index holding key, or -1. */
+static long index_find(const Map *map, uint64_t hash, Value key) {
+    if (map->count == 0) {
+        return -1;
+    }
+
+    size_t mask = map->slot_cap - 1;
+    size_t i = hash & mask;
+    uint32_t psl = 1;
+
+    for (;;) {
+        const MapSlot *slot = &map->slots[i];
+
+        if (slot->psl < psl) {
+            /* empty, or an entry that would have been displaced by ours */
+            return -1;
+        }
+
+        const MapEntry *e = &map->entries[slot->entry];
+        if (e->hash == hash && value_equal(e->key, key)) {
+            return (long)i;
+        }
+
+        i = (i + 1) & mask;
+        psl++;
+    }
+}
+
+/* Compacts deleted entries away and rebuilds the index at slot_cap. */
+static void map_rebuild(Map *map, size_t slot_cap) {
+    size_t live = 0;
+    for (size_t i = 0; i < map->used; i++) {
+        if (!map->entries[i].deleted) {
+            map->entries[live++] = map->entries[i];
+        }
+    }
+    map->used = live;
+
+    size_t entry_cap = slot_cap - slot_cap / 8;   /* max load 7/8 */
+    MapEntry *entries = realloc(map->entries, sizeof(MapEntry) * entry_cap);
+    MapSlot *slots = calloc(slot_cap, sizeof(MapSlot));
+    if (!entries || !slots) {
+        exit(1);
+    }
+
+    free(map->slots);
+    map->entries = entries;
+    map->entry_cap = entry_cap;
+    map->slots = slots;
+    map->slot_cap = slot_cap;
+
+    for (size_t i = 0; i < map->used; i++) {
+        index_insert(map, map->entries[i].hash, (uint32_t)i);
+    }
+}
+
+/* =========================
+   Public API
+   ========================= */
+
+/* The smallest index that holds count entries under the load limit. */
+static size_t slots_for(size_t count) {
+    size_t slot_cap = MAP_MIN_SLOTS;
+    while (slot_cap - slot_cap / 8 < count) {
+        slot_cap *= 2;
+    }
+    return slot_cap;
+}
+
+Map *map_new(void) {
+    Map *map = malloc(sizeof(Map));
+    if (!map) {
+        exit(1);
+    }
+
+    map->refcount = 1;
+    map->entries = NULL;
+    map->used = 0;
+    map->count = 0;
+    map->entry_cap = 0;
+    map->slots = NULL;
+    map->slot_cap = 0;
+    return map;
+}
+
+Map *map_new_sized(size_t count) {
+    Map *map = map_new();
+    if (count > 0) {
+        map_rebuild(map, slots_for(count));
+    }
+    return map;
+}
+
+Map *map_copy(const Map *src) {
+    Map *map = map_new();
+    if (src->count == 0) {
+        return map;
+    }
+
+    size_t slot_cap = slots_for(src->count);
+
+    map->entries = malloc(sizeof(MapEntry) * (slot_cap - slot_cap / 8));
+    if (!map->entries) {
+        exit(1);
+    }
+
+    for (size_t i = 0; i < src->used; i++) {
+        const MapEntry *e = &src->entries[i];
+        if (e->deleted) {
+            continue;
+        }
+        MapEntry *d = &map->entries[map->used++];
+        d->hash = e->hash;
+        d->key = value_clone(e->key);
+        d->value = value_clone(e->value);
+        d->deleted = false;
+    }
+    map->count = map->used;
+
+    /* map_rebuild sizes the index and reinserts the copied entries */
+    map_rebuild(map, slot_cap);
+    return map;
+}
+
+void map_release(Map *map) {
+    if (--map->refcount > 0) {
+        return;
+    }
+
+    for (size_t i = 0; i < map->used; i++) {
+        if (!map->entries[i].deleted) {
+            value_free(map->entries[i].key);
+            value_free(map->entries[i].value);
+        }
+    }
+    free(map->entries);
+    free(map->slots);
+    free(map);
+}
+
+Value *map_find(const Map *map, Value key) {
+    long i = index_find(map, value_hash(key), key);
+    if (i < 0) {
+        return NULL;
+    }
+    return &map->entries[map->slots[i].entry].value;
+}
+
+void map_set(Map *map, Value key, Value value) {
+    uint64_t hash = value_hash(key);
+    long i = index_find(map, hash, key);
+
+    if (i >= 0) {
+        MapEntry *e = &map->entries[map->slots[i].entry];
+        value_free(e->value);
+        value_free(key);
+        e->value = value;
+        return;
+    }
+
+    if (map->used == map->entry_cap) {
+        /* grow when mostly live, otherwise just squeeze out deletions */
+        size_t slot_cap = map->slot_cap ? map->slot_cap : MAP_MIN_SLOTS;
+        if (map->count >= map->entry_cap / 2 && map->slot_cap) {
+            slot_cap *= 2;
+        }
+        map_rebuild(map, slot_cap);
+    }
+
+    MapEntry *e = &map->entries[map->used];
+    e->hash = hash;
+    e->key = key;
+    e->value = value;
+    e->deleted = false;
+
+    index_insert(map, hash, (uint32_t)map->used);
+    map->used++;
+    map->count++;
+}
+
+bool map_remove(Map *map, Value key) {
+    long found = index_find(map, value_hash(key), key);
+    if (found < 0) {
+        return false;
+    }
+
+    size_t mask = map->slot_cap - 1;
+    size_t i = (size_t)found;
+    MapEntry *e = &map->entries[map->slots[i].entry];
+
+    value_free(e->key);
+    value_free(e->value);
+    e->deleted = true;
+    map->count--;
+
+    /* Backward-shift the rest of the run into the hole. */
+    for (;;) {
+        size_t next = (i + 1) & mask;
+        if (map->slots[next].psl <= 1) {
+            break;
+        }
+        map->slots[i] = map->slots[next];
+        map->slots[i].psl--;
+        i = next;
+    }
+    map->slots[i].psl = 0;
+
+    return true;
+}
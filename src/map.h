@@ -0,0 +1,53 @@
+#ifndef MAP_H
+#define MAP_H
+
+#include "value.h"
+
+/* Insertion-ordered hash map.
+
+   Entries live in a dense array in insertion order, so iteration and
+   keys() are a linear walk. Lookups go through a separate open-addressing
+   index using Robin Hood probing: each slot records its probe length, a
+   probe stops as soon as it meets a slot that is closer to home than the
+   key being searched, and deletion shifts the run back instead of leaving
+   tombstones in the index. Every entry caches its key's hash so probes
+   and rehashes never rehash keys. */
+
+typedef struct {
+    uint64_t hash;
+    Value key;
+    Value value;
+    bool deleted;
+} MapEntry;
+
+typedef struct {
+    uint32_t psl;     /* probe length + 1; 0 marks an empty slot */
+    uint32_t entry;   /* index into entries */
+} MapSlot;
+
+struct Map {
+    size_t refcount;
+
+    MapEntry *entries;
+    size_t used;        /* entries written, including deleted ones */
+    size_t count;       /* live entries */
+    size_t entry_cap;
+
+    MapSlot *slots;
+    size_t slot_cap;    /* power of two */
+};
+
+Map  *map_new(void);
+Map  *map_new_sized(size_t count);   /* room for count entries */
+Map  *map_copy(const Map *src);
+void  map_release(Map *map);
+
+/* Returned pointers are borrowed and stay valid until the map changes. */
+Value *map_find(const Map *map, Value key);
+void   map_set(Map *map, Value key, Value value);  /* takes ownership */
+bool   map_remove(Map *map, Value key);
+
+bool map_key_ok(Value key);
+uint64_t value_hash(Value v);
+
+#endif
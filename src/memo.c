@@ -0,0 +1,223 @@
+#include "memo.h"
+#include "map.h"
+#include "error.h"
+#include <stdlib.h>
+
+#define MEMO_MIN_BUCKETS 16
+
+/* Entries are chained per bucket and also linked into one recency list,
+   newest first, which is only reordered when the table has a limit. */
+typedef struct MemoEntry {
+    struct MemoEntry *chain;
+    struct MemoEntry *newer;
+    struct MemoEntry *older;
+    uint64_t hash;
+    Value result;
+    Value args[];
+} MemoEntry;
+
+struct Memo {
+    size_t refcount;
+    size_t argc;
+    size_t limit;
+
+    MemoEntry **buckets;
+    size_t bucket_cap;   /* power of two */
+
+    MemoEntry *newest;
+    MemoEntry *oldest;
+
+    MemoStats stats;
+};
+
+Memo *memo_new(size_t argc, size_t limit) {
+    Memo *m = calloc(1, sizeof(Memo));
+    MemoEntry **buckets = calloc(MEMO_MIN_BUCKETS, sizeof(MemoEntry *));
+    if (!m || !buckets) {
+        runtime_error("Out of memory");
+    }
+
+    m->refcount = 1;
+    m->argc = argc;
+    m->limit = limit;
+    m->buckets = buckets;
+    m->bucket_cap = MEMO_MIN_BUCKETS;
+    return m;
+}
+
+void memo_retain(Memo *m) {
+    m->refcount++;
+}
+
+static void entry_free(const Memo *m, MemoEntry *e) {
+    for (size_t i = 0; i < m->argc; i++) {
+        value_free(e->args[i]);
+    }
+    value_free(e->result);
+    free(e);
+}
+
+void memo_release(Memo *m) {
+    if (!m || --m->refcount > 0) {
+        return;
+    }
+
+    MemoEntry *e = m->newest;
+    while (e) {
+        MemoEntry *older = e->older;
+        entry_free(m, e);
+        e = older;
+    }
+    free(m->buckets);
+    free(m);
+}
+
+/* =========================
+   Keys
+   ========================= */
+
+bool memo_keys_ok(const Memo *m, const Value *args) {
+    for (size_t i = 0; i < m->argc; i++) {
+        if (!map_key_ok(args[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint64_t memo_hash(const Memo *m, const Value *args) {
+    uint64_t h = 0x9e3779b97f4a7c15ULL;
+
+    for (size_t i = 0; i < m->argc; i++) {
+        h = (h ^ value_hash(args[i])) * 0x100000001b3ULL;
+        h ^= h >> 29;
+    }
+    return h;
+}
+
+static bool args_equal(const Memo *m, const MemoEntry *e, const Value *args) {
+    for (size_t i = 0; i < m->argc; i++) {
+        if (!value_equal(e->args[i], args[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* =========================
+   Recency list
+   ========================= */
+
+static void list_unlink(Memo *m, MemoEntry *e) {
+    if (e->newer) {
+        e->newer->older = e->older;
+    } else {
+        m->newest = e->older;
+    }
+    if (e->older) {
+        e->older->newer = e->newer;
+    } else {
+        m->oldest = e->newer;
+    }
+}
+
+static void list_push(Memo *m, MemoEntry *e) {
+    e->newer = NULL;
+    e->older = m->newest;
+    if (m->newest) {
+        m->newest->newer = e;
+    } else {
+        m->oldest = e;
+    }
+    m->newest = e;
+}
+
+/* =========================
+   Table
+   ========================= */
+
+static void grow(Memo *m) {
+    size_t cap = m->bucket_cap * 2;
+    MemoEntry **buckets = calloc(cap, sizeof(MemoEntry *));
+    if (!buckets) {
+        runtime_error("Out of memory");
+    }
+
+    for (MemoEntry *e = m->newest; e; e = e->older) {
+        MemoEntry **head = &buckets[e->hash & (cap - 1)];
+        e->chain = *head;
+        *head = e;
+    }
+
+    free(m->buckets);
+    m->buckets = buckets;
+    m->bucket_cap = cap;
+}
+
+static void evict_oldest(Memo *m) {
+    MemoEntry *e = m->oldest;
+    MemoEntry **link = &m->buckets[e->hash & (m->bucket_cap - 1)];
+
+    while (*link != e) {
+        link = &(*link)->chain;
+    }
+    *link = e->chain;
+
+    list_unlink(m, e);
+    entry_free(m, e);
+    m->stats.count--;
+    m->stats.evictions++;
+}
+
+bool memo_find(Memo *m, const Value *args, uint64_t hash, Value *out) {
+    MemoEntry *e = m->buckets[hash & (m->bucket_cap - 1)];
+
+    for (; e; e = e->chain) {
+        if (e->hash == hash && args_equal(m, e, args)) {
+            break;
+        }
+    }
+
+    if (!e) {
+        m->stats.misses++;
+        return false;
+    }
+
+    if (m->limit && e != m->newest) {
+        list_unlink(m, e);
+        list_push(m, e);
+    }
+    m->stats.hits++;
+    *out = value_clone(e->result);
+    return true;
+}
+
+void memo_store(Memo *m, const Value *args, uint64_t hash, Value result) {
+    if (m->limit && m->stats.count == m->limit) {
+        evict_oldest(m);
+    }
+    if (m->stats.count >= m->bucket_cap) {
+        grow(m);
+    }
+
+    MemoEntry *e = malloc(sizeof(MemoEntry) + m->argc * sizeof(Value));
+    if (!e) {
+        runtime_error("Out of memory");
+    }
+
+    for (size_t i = 0; i < m->argc; i++) {
+        e->args[i] = value_clone(args[i]);
+    }
+    e->hash = hash;
+    e->result = value_clone(result);
+
+    MemoEntry **head = &m->buckets[hash & (m->bucket_cap - 1)];
+    e->chain = *head;
+    *head = e;
+    list_push(m, e);
+    m->stats.count++;
+}
+
+MemoStats memo_stats(const Memo *m) {
+    return m->stats;
+}
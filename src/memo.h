@@ -0,0 +1,48 @@
+#ifndef MEMO_H
+#define MEMO_H
+
+#include "value.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Result tables for memoized functions: memo(f) and memo(f, limit).
+
+   A table maps a function's argument list to the result it returned.
+   Arguments are compared by content, as map keys are, so two equal
+   arrays or strings hit the same entry. A table is shared by every copy
+   of the function value it was made for (the copies stored in different
+   variables and environments), which is what lets `fib = memo(fib)`
+   catch the recursive calls inside fib.
+
+   With a limit the table keeps at most that many results and evicts the
+   least recently used one to make room; hits move an entry to the front
+   of the recency list. */
+
+typedef struct Memo Memo;
+
+typedef struct {
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+    size_t count;   /* results held */
+} MemoStats;
+
+/* A table for argc arguments; limit 0 means unbounded. */
+Memo *memo_new(size_t argc, size_t limit);
+void  memo_retain(Memo *m);
+void  memo_release(Memo *m);
+
+/* Whether args can be looked up: every argument must be a valid map
+   key. Calls with other arguments bypass the table and are not counted. */
+bool     memo_keys_ok(const Memo *m, const Value *args);
+uint64_t memo_hash(const Memo *m, const Value *args);
+
+/* On a hit sets *out to an owned copy of the stored result. */
+bool memo_find(Memo *m, const Value *args, uint64_t hash, Value *out);
+/* Records result (borrowed, as are args) for args. */
+void memo_store(Memo *m, const Value *args, uint64_t hash, Value result);
+
+MemoStats memo_stats(const Memo *m);
+
+#endif
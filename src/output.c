@@ -0,0 +1,357 @@
+#include "output.h"
+#include "map.h"
+#include "bigint.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static char out_main[OUT_BUF_SIZE];
+static char *out_buf = out_main;
+static size_t out_cap = OUT_BUF_SIZE;
+static size_t out_len;
+static bool out_tty;
+static Value *out_into;   /* set while value_text collects into a string */
+
+static const char digit_pairs[201] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+/* =========================
+   Buffer
+   ========================= */
+
+static void write_all(const char *data, size_t len) {
+    if (out_into) {
+        *out_into = value_string_append(*out_into, data, len);
+        return;
+    }
+    while (len > 0) {
+        ssize_t n = write(STDOUT_FILENO, data, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;   /* stdout is gone; nothing useful left to do */
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+}
+
+void out_flush(void) {
+    write_all(out_buf, out_len);
+    out_len = 0;
+}
+
+void out_init(void) {
+    out_tty = isatty(STDOUT_FILENO);
+    atexit(out_flush);
+}
+
+void out_write(const char *data, size_t len) {
+    if (len > out_cap - out_len) {
+        out_flush();
+        if (len >= out_cap) {
+            write_all(data, len);
+            return;
+        }
+    }
+    memcpy(out_buf + out_len, data, len);
+    out_len += len;
+}
+
+void out_cstr(const char *s) {
+    out_write(s, strlen(s));
+}
+
+void out_char(char c) {
+    if (out_len == out_cap) {
+        out_flush();
+    }
+    out_buf[out_len++] = c;
+}
+
+void out_line_end(void) {
+    out_char('\n');
+    if (out_tty) {
+        out_flush();
+    }
+}
+
+/* =========================
+   Integers
+   ========================= */
+
+/* Exactly eight digits of v < 10^8. The four pairs come from 32-bit
+   divisions that do not depend on each other. */
+static void put_8_digits(char *p, uint32_t v) {
+    uint32_t hi = v / 10000;
+    uint32_t lo = v % 10000;
+
+    memcpy(p, digit_pairs + (hi / 100) * 2, 2);
+    memcpy(p + 2, digit_pairs + (hi % 100) * 2, 2);
+    memcpy(p + 4, digit_pairs + (lo / 100) * 2, 2);
+    memcpy(p + 6, digit_pairs + (lo % 100) * 2, 2);
+}
+
+/* Digits are produced right to left into a scratch buffer, then copied
+   into place, so the length need not be counted first. */
+size_t format_int(char *buf, int64_t x) {
+    uint64_t m = x < 0 ? -(uint64_t)x : (uint64_t)x;
+    char tmp[20];
+    char *end = tmp + sizeof(tmp);
+    char *p = end;
+
+    /* whole groups of eight digits, then two at a time from the table */
+    while (m >= 100000000) {
+        uint64_t q = m / 100000000;
+        p -= 8;
+        put_8_digits(p, (uint32_t)(m - q * 100000000));
+        m = q;
+    }
+
+    uint32_t v = (uint32_t)m;
+    while (v >= 100) {
+        p -= 2;
+        memcpy(p, digit_pairs + (v % 100) * 2, 2);
+        v /= 100;
+    }
+    if (v >= 10) {
+        p -= 2;
+        memcpy(p, digit_pairs + v * 2, 2);
+    } else {
+        *--p = (char)('0' + v);
+    }
+    if (x < 0) {
+        *--p = '-';
+    }
+
+    size_t len = (size_t)(end - p);
+    memcpy(buf, p, len);
+    return len;
+}
+
+void out_int(int64_t x) {
+    if (out_cap - out_len < 20) {
+        out_flush();
+    }
+    out_len += format_int(out_buf + out_len, x);
+}
+
+/* =========================
+   Values
+   ========================= */
+
+static void out_item(Value v, bool quote);
+
+static void out_record(const Record *rec) {
+    const Shape *shape = rec->shape;
+
+    out_cstr(shape->name);
+    out_char('(');
+    for (size_t i = 0; i < shape->field_count; i++) {
+        if (i > 0) {
+            out_write(", ", 2);
+        }
+        out_cstr(shape->fields[i]);
+        out_write(": ", 2);
+        out_item(rec->slots[i], true);
+    }
+    out_char(')');
+}
+
+static void out_array(const Array *arr) {
+    out_char('[');
+
+    switch (arr->kind) {
+        case ARRAY_INTS:
+            for (size_t i = 0; i < arr->count; i++) {
+                if (i > 0) {
+                    out_write(", ", 2);
+                }
+                out_int(arr->ints[i]);
+            }
+            break;
+
+        case ARRAY_VALUES:
+            for (size_t i = 0; i < arr->count; i++) {
+                if (i > 0) {
+                    out_write(", ", 2);
+                }
+                out_item(arr->items[i], true);
+            }
+            break;
+
+        default:
+            /* bools and inline records are boxed one at a time */
+            for (size_t i = 0; i < arr->count; i++) {
+                if (i > 0) {
+                    out_write(", ", 2);
+                }
+                Value item = array_get(arr, i);
+                out_item(item, true);
+                value_free(item);
+            }
+            break;
+    }
+
+    out_char(']');
+}
+
+static void out_map(const Map *map) {
+    size_t written = 0;
+
+    out_char('{');
+    for (size_t i = 0; i < map->used; i++) {
+        const MapEntry *e = &map->entries[i];
+        if (e->deleted) {
+            continue;
+        }
+        if (written++ > 0) {
+            out_write(", ", 2);
+        }
+        out_item(e->key, true);
+        out_write(": ", 2);
+        out_item(e->value, true);
+    }
+    out_char('}');
+}
+
+/* b"..." with printable ASCII as is and every other byte as \xHH. */
+static void out_bytes(const String *s) {
+    static const char hex[] = "0123456789abcdef";
+    size_t run = 0;
+
+    out_write("b\"", 2);
+    for (size_t i = 0; i < s->len; i++) {
+        unsigned char c = (unsigned char)s->data[i];
+        if (c >= 0x20 && c < 0x7f && c != '"' && c != '\\') {
+            continue;
+        }
+
+        out_write(s->data + run, i - run);
+        run = i + 1;
+        if (c == '"' || c == '\\') {
+            char esc[2] = { '\\', (char)c };
+            out_write(esc, 2);
+        } else {
+            char esc[4] = { '\\', 'x', hex[c >> 4], hex[c & 15] };
+            out_write(esc, 4);
+        }
+    }
+    out_write(s->data + run, s->len - run);
+    out_char('"');
+}
+
+static void out_item(Value v, bool quote) {
+    switch (v.type) {
+        case VAL_INT:
+            out_int(v.as.int_val);
+            break;
+
+        case VAL_BOOL:
+            if (v.as.bool_val) {
+                out_write("true", 4);
+            } else {
+                out_write("false", 5);
+            }
+            break;
+
+        case VAL_STRING:
+            if (quote) {
+                out_char('"');
+            }
+            out_write(v.as.str_val.data, v.as.str_val.len);
+            if (quote) {
+                out_char('"');
+            }
+            break;
+
+        case VAL_BYTES:
+            out_bytes(&v.as.str_val);
+            break;
+
+        case VAL_BIGINT: {
+            char *digits = bigint_to_cstr(v.as.big_val);
+            out_cstr(digits);
+            free(digits);
+            break;
+        }
+
+        case VAL_ARRAY:
+            out_array(v.as.array_val);
+            break;
+
+        case VAL_MAP:
+            out_map(v.as.map_val);
+            break;
+
+        case VAL_RECORD:
+            out_record(v.as.rec_val);
+            break;
+
+        case VAL_SHAPE:
+            out_write("<record ", 8);
+            out_cstr(v.as.shape_val->name);
+            out_char('>');
+            break;
+
+        case VAL_FUNCTION:
+        case VAL_BUILTIN:
+            out_write("<function>", 10);
+            break;
+
+        case VAL_HANDLE:
+            out_write("<handle>", 8);
+            break;
+
+        default:
+            out_write("<unsupported>", 13);
+            break;
+    }
+}
+
+void out_value(Value v) {
+    out_item(v, false);
+}
+
+/* Runs the writers above against a local buffer whose flushes append to
+   the result instead of going to stdout. */
+Value value_text(Value v) {
+    if (v.type == VAL_STRING) {
+        return value_clone(v);
+    }
+    if (v.type == VAL_INT) {
+        char digits[20];
+        return value_string_len(digits, format_int(digits, v.as.int_val));
+    }
+
+    char local[1024];
+    char *saved_buf = out_buf;
+    size_t saved_cap = out_cap;
+    size_t saved_len = out_len;
+    Value text = value_string_len("", 0);
+
+    out_buf = local;
+    out_cap = sizeof(local);
+    out_len = 0;
+    out_into = &text;
+    out_item(v, false);
+
+    if (text.as.str_val.len == 0) {
+        value_free(text);
+        text = value_string_len(local, out_len);
+    } else {
+        out_flush();
+    }
+
+    out_into = NULL;
+    out_buf = saved_buf;
+    out_cap = saved_cap;
+    out_len = saved_len;
+    return text;
+}
@@ -0,0 +1,35 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include "value.h"
+
+/* Buffered standard output.
+
+   Everything the interpreter prints goes through one OUT_BUF_SIZE buffer
+   that is written with write(2) when it fills, on flush(), and at exit.
+   When stdout is a terminal the buffer is also flushed at every line end,
+   so interactive output appears as it is printed. */
+
+#define OUT_BUF_SIZE (1 << 18)
+
+void out_init(void);
+
+void out_write(const char *data, size_t len);
+void out_cstr(const char *s);
+void out_char(char c);
+void out_int(int64_t x);
+void out_line_end(void);   /* '\n', flushed right away on a terminal */
+void out_flush(void);
+
+/* Writes any value. Top-level strings are written raw; strings inside
+   containers are quoted. Containers nest to any depth. */
+void out_value(Value v);
+
+/* The text out_value would write for v, as a new string. */
+Value value_text(Value v);
+
+/* Formats x in decimal into buf (at least 20 bytes, not NUL-terminated)
+   and returns the length. */
+size_t format_int(char *buf, int64_t x);
+
+#endif
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
 
 /* Forward declarations */
 
@@ -23,6 +24,7 @@ static Stmt *parse_expr_statement(Parser *p);
 static Stmt *new_stmt(StmtKind kind);
 static Stmt *parse_do(Parser *p);
 static Stmt *parse_fn_def(Parser *p);
+static Stmt *parse_record(Parser *p);
 static Stmt *parse_return(Parser *p);
 static Expr *parse_postfix(Parser *p);
 
@@ -245,6 +247,24 @@ static Expr *parse_postfix(Parser *p) {
             continue;
         }
 
+        /* Field access: expr '.' IDENT */
+        if (match(p, TOK_DOT)) {
+            if (p->current.type != TOK_IDENT) {
+                parser_error(p, "Expected field name after '.'");
+            }
+
+            Expr *field_node = new_expr(p, EXPR_FIELD);
+            field_node->as.field.base = expr;
+            field_node->as.field.name = strndup(p->current.start,
+                                                p->current.length);
+            field_node->as.field.cache_shape = NULL;
+            field_node->as.field.cache_slot = 0;
+            advance(p);  // consume field name
+
+            expr = field_node;
+            continue;
+        }
+
         break;
     }
 
@@ -274,14 +294,25 @@ static Expr *parse_unary(Parser *p) {
 
 static Expr *parse_primary(Parser *p) {
     if (match(p, TOK_INT)) {
-        Expr *expr = new_expr(p,EXPR_INT);
-
+        const char *digits = p->previous.start;
+        size_t len = p->previous.length;
         char buffer[64];
-        snprintf(buffer, sizeof(buffer), "%.*s",
-                 (int)p->previous.length,
-                 p->previous.start);
 
-        expr->as.int_val = atoll(buffer);
+        if (len < sizeof(buffer)) {
+            snprintf(buffer, sizeof(buffer), "%.*s", (int)len, digits);
+            errno = 0;
+            long long n = strtoll(buffer, NULL, 10);
+            if (errno != ERANGE) {
+                Expr *expr = new_expr(p, EXPR_INT);
+                expr->as.int_val = n;
+                return expr;
+            }
+        }
+
+        /* Past int64_t: kept as digits and evaluated as a bigint */
+        Expr *expr = new_expr(p, EXPR_BIGINT);
+        expr->as.string.data = strndup(digits, len);
+        expr->as.string.len = len;
         return expr;
     }
 
@@ -325,6 +356,49 @@ static Expr *parse_primary(Parser *p) {
     }
 
 
+    /* map literal: '{' (expr ':' expr (',' expr ':' expr)*)? '}'
+       Newlines are allowed between entries. */
+    if (match(p, TOK_LBRACE)) {
+        Expr *expr = new_expr(p, EXPR_MAP);
+
+        Expr **keys = NULL;
+        Expr **values = NULL;
+        size_t count = 0;
+
+        while (p->current.type == TOK_NEWLINE)
+            advance(p);
+
+        if (!check(p, TOK_RBRACE)) {
+            do {
+                while (p->current.type == TOK_NEWLINE)
+                    advance(p);
+
+                keys = realloc(keys, sizeof(Expr*) * (count + 1));
+                values = realloc(values, sizeof(Expr*) * (count + 1));
+                if (!keys || !values) {
+                    parser_error(p, "Out of memory");
+                }
+
+                keys[count] = parse_expression(p);
+                consume(p, TOK_COLON, "Expected ':' after map key");
+                values[count] = parse_expression(p);
+                count++;
+
+                while (p->current.type == TOK_NEWLINE)
+                    advance(p);
+
+            } while (match(p, TOK_COMMA));
+        }
+
+        consume(p, TOK_RBRACE, "Expected '}'");
+
+        expr->as.map.keys = keys;
+        expr->as.map.values = values;
+        expr->as.map.count = count;
+
+        return expr;
+    }
+
     if (match(p, TOK_TRUE)) {
         Expr *expr = new_expr(p, EXPR_BOOL);
         expr->as.bool_val = 1;
@@ -372,6 +446,7 @@ static Expr *parse_primary(Parser *p) {
             expr->as.call.callee = name;
             expr->as.call.args = args;
             expr->as.call.argc = argc;
+            expr->as.call.format = NULL;
             return expr;
         }
 
@@ -551,6 +626,56 @@ static Stmt *parse_fn_def(Parser *p) {
     return stmt;
 }
 
+/* record Name(field, ...) */
+static Stmt *parse_record(Parser *p) {
+    advance(p);  // consume 'record'
+
+    if (p->current.type != TOK_IDENT) {
+        parser_error(p, "Expected record name after record");
+    }
+
+    Token name_tok = p->current;
+    advance(p);  // consume name
+
+    consume(p, TOK_LPAREN, "Expected '(' after record name");
+
+    char **fields = NULL;
+    size_t field_count = 0;
+
+    if (p->current.type != TOK_RPAREN) {
+        while (1) {
+            if (p->current.type != TOK_IDENT) {
+                parser_error(p, "Expected field name");
+            }
+
+            for (size_t i = 0; i < field_count; i++) {
+                if (strlen(fields[i]) == p->current.length &&
+                    strncmp(fields[i], p->current.start, p->current.length) == 0) {
+                    parser_error(p, "Duplicate field name in record");
+                }
+            }
+
+            fields = realloc(fields, sizeof(char *) * (field_count + 1));
+            fields[field_count++] = strndup(p->current.start, p->current.length);
+            advance(p);  // consume field
+
+            if (match(p, TOK_COMMA)) {
+                continue;
+            }
+            break;
+        }
+    }
+
+    consume(p, TOK_RPAREN, "Expected ')' after record fields");
+
+    Stmt *stmt = new_stmt(STMT_RECORD);
+    stmt->as.record.name = strndup(name_tok.start, name_tok.length);
+    stmt->as.record.fields = fields;
+    stmt->as.record.field_count = field_count;
+    stmt->as.record.shape = NULL;
+    return stmt;
+}
+
 static Stmt *parse_return(Parser *p) {
     advance(p);  // consume 'return'
 
@@ -679,6 +804,20 @@ static Stmt *parse_assignment(Parser *p) {
 static Stmt *parse_expr_statement(Parser *p) {
     Expr *expr = parse_expression(p);
 
+    /* element or field assignment: a[i] = v, p.x = v */
+    if (match(p, TOK_ASSIGN)) {
+        if (expr->kind != EXPR_INDEX && expr->kind != EXPR_FIELD) {
+            parser_error(p, "Invalid assignment target");
+        }
+
+        Expr *value = parse_expression(p);
+
+        Stmt *stmt = new_stmt(STMT_INDEX_ASSIGN);
+        stmt->as.index_assign.target = expr;
+        stmt->as.index_assign.value = value;
+        return stmt;
+    }
+
     Stmt *stmt = new_stmt(STMT_EXPR);
     stmt->as.expr.expr = expr;
 
@@ -691,6 +830,7 @@ static Stmt *parse_statement(Parser *p) {
         case TOK_IF:     return parse_if(p);
         case TOK_DO:     return parse_do(p);
         case TOK_FN:     return parse_fn_def(p);
+        case TOK_RECORD: return parse_record(p);
         case TOK_RETURN: return parse_return(p);
         default: break;
     }
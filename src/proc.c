@@ -0,0 +1,111 @@
+#include "proc.h"
+#include "io.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+bool proc_spawn(char *const *argv, Proc *out, const char **err) {
+    int to_child[2];
+    int from_child[2];
+
+    if (pipe2(to_child, O_CLOEXEC) != 0) {
+        *err = "Failed to create pipe";
+        return false;
+    }
+    if (pipe2(from_child, O_CLOEXEC) != 0) {
+        close(to_child[0]);
+        close(to_child[1]);
+        *err = "Failed to create pipe";
+        return false;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, to_child[0], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, from_child[1], STDOUT_FILENO);
+
+    posix_spawnattr_t attr;
+    sigset_t defaults;
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGPIPE);
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF);
+
+    pid_t pid;
+    int rc = posix_spawnp(&pid, argv[0], &actions, &attr, argv, environ);
+
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    close(to_child[0]);
+    close(from_child[1]);
+
+    if (rc != 0) {
+        close(to_child[1]);
+        close(from_child[0]);
+        *err = "Failed to start process";
+        return false;
+    }
+
+    out->pid = pid;
+    out->in = to_child[1];
+    out->out = from_child[0];
+    return true;
+}
+
+static void *pump(void *arg) {
+    int *fds = (int *)arg;
+    uint64_t moved = 0;
+
+    io_copy_fd(fds[0], fds[1], &moved);
+    close(fds[0]);
+    close(fds[1]);
+    free(fds);
+    return NULL;
+}
+
+bool proc_pump(int from, int to) {
+    int *fds = (int *)malloc(sizeof(int) * 2);
+    if (!fds) {
+        return false;
+    }
+    fds[0] = from;
+    fds[1] = to;
+
+    pthread_attr_t attr;
+    pthread_t thread;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int rc = pthread_create(&thread, &attr, pump, fds);
+    pthread_attr_destroy(&attr);
+
+    if (rc != 0) {
+        free(fds);
+        return false;
+    }
+    return true;
+}
+
+int proc_wait(pid_t pid) {
+    int status;
+
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+    if (WIFSIGNALED(status)) {
+        return 128 + WTERMSIG(status);
+    }
+    return WEXITSTATUS(status);
+}
@@ -0,0 +1,35 @@
+#ifndef PROC_H
+#define PROC_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+/* Child processes.
+
+   proc_spawn starts argv[0] (looked up in PATH) with posix_spawnp, which
+   glibc runs on a vfork-style clone, so starting a child costs about the
+   same however large the interpreter's heap is. The child's stdin and
+   stdout are pipes back to us; stderr is shared. Once anything has been
+   spawned SIGPIPE is ignored here, so writing to a child that exited is
+   an ordinary write error; children get the default action back.
+
+   proc_pump moves everything from one descriptor to another on a
+   detached thread with io_copy_fd, which splices pipe to pipe, then
+   closes both. */
+
+typedef struct {
+    pid_t pid;
+    int in;     /* write end of the child's stdin */
+    int out;    /* read end of the child's stdout */
+} Proc;
+
+/* argv is NULL-terminated. On failure returns false and sets *err. */
+bool proc_spawn(char *const *argv, Proc *out, const char **err);
+
+bool proc_pump(int from, int to);
+
+/* The exit code, or 128 + the signal number if it was killed; -1 if pid
+   cannot be waited for. */
+int  proc_wait(pid_t pid);
+
+#endif
@@ -0,0 +1,1207 @@
+#include "regex.h"
+#include "simd.h"
+#include "error.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_INSTS       65536
+#define MAX_REPEAT      1000
+#define MAX_DEPTH       200
+#define DFA_MAX_STATES  4096
+#define CACHE_SLOTS     64
+
+/* =========================
+   Syntax tree
+   ========================= */
+
+typedef enum {
+    N_EMPTY,
+    N_BYTE,
+    N_SET,
+    N_ANY,
+    N_BOL,
+    N_EOL,
+    N_CAT,
+    N_ALT,
+    N_REPEAT
+} NodeKind;
+
+typedef struct {
+    NodeKind kind;
+    uint8_t byte;
+    bool greedy;
+    int set;         /* N_SET: index into sets */
+    int min, max;    /* N_REPEAT: max is -1 for no limit */
+    int a, b;        /* children by index */
+} Node;
+
+typedef uint64_t ByteSet[4];
+
+typedef struct {
+    const char *p;
+    const char *end;
+    const char *err;
+    int depth;
+
+    Node *nodes;
+    int node_count;
+    int node_cap;
+
+    ByteSet *sets;
+    int set_count;
+    int set_cap;
+} Parser;
+
+static int new_node(Parser *ps, NodeKind kind) {
+    if (ps->node_count == ps->node_cap) {
+        ps->node_cap = ps->node_cap ? ps->node_cap * 2 : 64;
+        ps->nodes = (Node *)realloc(ps->nodes, sizeof(Node) * ps->node_cap);
+        if (!ps->nodes) {
+            runtime_error("Out of memory");
+        }
+    }
+
+    Node *n = &ps->nodes[ps->node_count];
+    memset(n, 0, sizeof(*n));
+    n->kind = kind;
+    n->a = n->b = -1;
+    return ps->node_count++;
+}
+
+static int new_set(Parser *ps) {
+    if (ps->set_count == ps->set_cap) {
+        ps->set_cap = ps->set_cap ? ps->set_cap * 2 : 8;
+        ps->sets = (ByteSet *)realloc(ps->sets, sizeof(ByteSet) * ps->set_cap);
+        if (!ps->sets) {
+            runtime_error("Out of memory");
+        }
+    }
+    memset(ps->sets[ps->set_count], 0, sizeof(ByteSet));
+    return ps->set_count++;
+}
+
+static void set_add(uint64_t *set, unsigned lo, unsigned hi) {
+    for (unsigned c = lo; c <= hi; c++) {
+        set[c >> 6] |= (uint64_t)1 << (c & 63);
+    }
+}
+
+static bool set_has(const uint64_t *set, unsigned c) {
+    return (set[c >> 6] >> (c & 63)) & 1;
+}
+
+static void set_negate(uint64_t *set) {
+    for (int i = 0; i < 4; i++) {
+        set[i] = ~set[i];
+    }
+}
+
+static int binary(Parser *ps, NodeKind kind, int a, int b) {
+    int n = new_node(ps, kind);
+    ps->nodes[n].a = a;
+    ps->nodes[n].b = b;
+    return n;
+}
+
+/* \d \w \s and friends into set; false if c names no class. */
+static bool class_escape(char c, uint64_t *set) {
+    switch (c) {
+        case 'd': case 'D':
+            set_add(set, '0', '9');
+            break;
+        case 'w': case 'W':
+            set_add(set, '0', '9');
+            set_add(set, 'a', 'z');
+            set_add(set, 'A', 'Z');
+            set_add(set, '_', '_');
+            break;
+        case 's': case 'S':
+            set_add(set, ' ', ' ');
+            set_add(set, '\t', '\r');
+            break;
+        default:
+            return false;
+    }
+    if (c == 'D' || c == 'W' || c == 'S') {
+        set_negate(set);
+    }
+    return true;
+}
+
+/* The byte an escape such as \n or \. stands for. */
+static bool byte_escape(Parser *ps, char c, uint8_t *out) {
+    switch (c) {
+        case 'n': *out = '\n'; return true;
+        case 't': *out = '\t'; return true;
+        case 'r': *out = '\r'; return true;
+        case 'f': *out = '\f'; return true;
+        case 'v': *out = '\v'; return true;
+        case '0': *out = '\0'; return true;
+        default:
+            break;
+    }
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')) {
+        ps->err = "unknown escape";
+        return false;
+    }
+    *out = (uint8_t)c;
+    return true;
+}
+
+static int parse_alt(Parser *ps);
+
+static int parse_class(Parser *ps) {
+    int s = new_set(ps);
+    bool negate = false;
+    bool first = true;
+
+    if (ps->p < ps->end && *ps->p == '^') {
+        negate = true;
+        ps->p++;
+    }
+
+    for (;;) {
+        if (ps->p >= ps->end) {
+            ps->err = "missing ]";
+            return -1;
+        }
+        if (*ps->p == ']' && !first) {
+            ps->p++;
+            break;
+        }
+        first = false;
+
+        uint8_t lo;
+        char c = *ps->p++;
+        if (c == '\\') {
+            if (ps->p >= ps->end) {
+                ps->err = "trailing backslash";
+                return -1;
+            }
+            c = *ps->p++;
+            if (class_escape(c, ps->sets[s])) {
+                continue;
+            }
+            if (!byte_escape(ps, c, &lo)) {
+                return -1;
+            }
+        } else {
+            lo = (uint8_t)c;
+        }
+
+        uint8_t hi = lo;
+        if (ps->p + 1 < ps->end && ps->p[0] == '-' && ps->p[1] != ']') {
+            ps->p++;
+            c = *ps->p++;
+            if (c == '\\') {
+                if (ps->p >= ps->end || !byte_escape(ps, *ps->p++, &hi)) {
+                    if (!ps->err) {
+                        ps->err = "trailing backslash";
+                    }
+                    return -1;
+                }
+            } else {
+                hi = (uint8_t)c;
+            }
+            if (hi < lo) {
+                ps->err = "bad range in class";
+                return -1;
+            }
+        }
+        set_add(ps->sets[s], lo, hi);
+    }
+
+    if (negate) {
+        set_negate(ps->sets[s]);
+    }
+
+    int n = new_node(ps, N_SET);
+    ps->nodes[n].set = s;
+    return n;
+}
+
+static int parse_atom(Parser *ps) {
+    char c = *ps->p++;
+    int n;
+
+    switch (c) {
+        case '(':
+            if (ps->end - ps->p >= 2 && ps->p[0] == '?' && ps->p[1] == ':') {
+                ps->p += 2;
+            }
+            if (++ps->depth > MAX_DEPTH) {
+                ps->err = "groups nested too deeply";
+                return -1;
+            }
+            n = parse_alt(ps);
+            ps->depth--;
+            if (n < 0) {
+                return -1;
+            }
+            if (ps->p >= ps->end || *ps->p != ')') {
+                ps->err = "missing )";
+                return -1;
+            }
+            ps->p++;
+            return n;
+
+        case '[':
+            return parse_class(ps);
+
+        case '.':
+            return new_node(ps, N_ANY);
+
+        case '^':
+            return new_node(ps, N_BOL);
+
+        case '$':
+            return new_node(ps, N_EOL);
+
+        case '\\': {
+            if (ps->p >= ps->end) {
+                ps->err = "trailing backslash";
+                return -1;
+            }
+            c = *ps->p++;
+
+            ByteSet set = {0};
+            if (class_escape(c, set)) {
+                int s = new_set(ps);
+                memcpy(ps->sets[s], set, sizeof(ByteSet));
+                n = new_node(ps, N_SET);
+                ps->nodes[n].set = s;
+                return n;
+            }
+
+            uint8_t b;
+            if (!byte_escape(ps, c, &b)) {
+                return -1;
+            }
+            n = new_node(ps, N_BYTE);
+            ps->nodes[n].byte = b;
+            return n;
+        }
+
+        case '*':
+        case '+':
+        case '?':
+            ps->err = "nothing to repeat";
+            return -1;
+
+        default:
+            n = new_node(ps, N_BYTE);
+            ps->nodes[n].byte = (uint8_t)c;
+            return n;
+    }
+}
+
+static bool parse_count(Parser *ps, int *out) {
+    int v = 0;
+    const char *start = ps->p;
+
+    while (ps->p < ps->end && *ps->p >= '0' && *ps->p <= '9') {
+        v = v * 10 + (*ps->p++ - '0');
+        if (v > MAX_REPEAT) {
+            v = MAX_REPEAT + 1;
+        }
+    }
+    *out = v;
+    return ps->p > start;
+}
+
+/* {m}, {m,}, {,n} or {m,n} after an atom. Anything else leaves `{` to be read
+   as a literal. */
+static bool parse_braces(Parser *ps, int *min, int *max) {
+    const char *save = ps->p;
+
+    ps->p++;
+    bool has_min = parse_count(ps, min);
+    *max = *min;
+    if (ps->p < ps->end && *ps->p == ',') {
+        ps->p++;
+        if (!parse_count(ps, max)) {
+            *max = -1;
+        }
+    }
+    if (!has_min) {
+        *min = 0;   /* {,n} */
+        if (*max < 0) {
+            ps->p = save;
+            return false;
+        }
+    }
+    if (ps->p >= ps->end || *ps->p != '}') {
+        ps->p = save;
+        return false;
+    }
+    ps->p++;
+    return true;
+}
+
+static int parse_repeat(Parser *ps) {
+    int n = parse_atom(ps);
+
+    while (n >= 0 && ps->p < ps->end) {
+        int min, max;
+        char c = *ps->p;
+
+        if (c == '*') {
+            min = 0, max = -1;
+            ps->p++;
+        } else if (c == '+') {
+            min = 1, max = -1;
+            ps->p++;
+        } else if (c == '?') {
+            min = 0, max = 1;
+            ps->p++;
+        } else if (c != '{' || !parse_braces(ps, &min, &max)) {
+            break;
+        }
+
+        if (min > MAX_REPEAT || max > MAX_REPEAT || (max >= 0 && max < min)) {
+            ps->err = "bad repetition count";
+            return -1;
+        }
+
+        int r = new_node(ps, N_REPEAT);
+        ps->nodes[r].a = n;
+        ps->nodes[r].min = min;
+        ps->nodes[r].max = max;
+        ps->nodes[r].greedy = true;
+        if (ps->p < ps->end && *ps->p == '?') {
+            ps->nodes[r].greedy = false;
+            ps->p++;
+        }
+        n = r;
+    }
+    return n;
+}
+
+static int parse_cat(Parser *ps) {
+    int n = -1;
+
+    while (ps->p < ps->end && *ps->p != '|' && *ps->p != ')') {
+        int next = parse_repeat(ps);
+        if (next < 0) {
+            return -1;
+        }
+        n = n < 0 ? next : binary(ps, N_CAT, n, next);
+    }
+    return n < 0 ? new_node(ps, N_EMPTY) : n;
+}
+
+static int parse_alt(Parser *ps) {
+    int n = parse_cat(ps);
+
+    while (n >= 0 && ps->p < ps->end && *ps->p == '|') {
+        ps->p++;
+        int next = parse_cat(ps);
+        if (next < 0) {
+            return -1;
+        }
+        n = binary(ps, N_ALT, n, next);
+    }
+    return n;
+}
+
+/* The operands of a run of concatenations, left to right. Long
+   literals make deep trees, so this walks them without recursion. */
+static int *cat_leaves(const Parser *ps, int node, int *count) {
+    int cap = 16;
+    int *stack = (int *)malloc(sizeof(int) * cap);
+    int *leaves = (int *)malloc(sizeof(int) * cap);
+    int top = 0;
+    int n = 0;
+
+    if (!stack || !leaves) {
+        runtime_error("Out of memory");
+    }
+
+    stack[top++] = node;
+    while (top > 0) {
+        const Node *nd = &ps->nodes[stack[--top]];
+        if (top + 2 > cap || n + 1 > cap) {
+            cap *= 2;
+            stack = (int *)realloc(stack, sizeof(int) * cap);
+            leaves = (int *)realloc(leaves, sizeof(int) * cap);
+            if (!stack || !leaves) {
+                runtime_error("Out of memory");
+            }
+        }
+        if (nd->kind == N_CAT) {
+            stack[top++] = nd->b;
+            stack[top++] = nd->a;
+        } else {
+            leaves[n++] = (int)(nd - ps->nodes);
+        }
+    }
+
+    free(stack);
+    *count = n;
+    return leaves;
+}
+
+/* =========================
+   NFA programs
+   ========================= */
+
+typedef enum {
+    I_BYTE,
+    I_SET,
+    I_ANY,      /* any byte but '\n' */
+    I_ANYBYTE,  /* any byte at all; the search loop */
+    I_SPLIT,    /* x preferred over y */
+    I_JMP,
+    I_BOL,
+    I_EOL,
+    I_MATCH
+} Op;
+
+typedef struct {
+    uint8_t op;
+    uint8_t byte;
+    int x, y;    /* jump targets; x is the set index for I_SET */
+} Inst;
+
+typedef struct {
+    Inst *insts;
+    int count;
+    int cap;
+    const ByteSet *sets;
+    bool too_big;
+} Prog;
+
+static int emit(Prog *pg, Op op) {
+    if (pg->count == pg->cap) {
+        if (pg->cap >= MAX_INSTS) {
+            pg->too_big = true;
+            return pg->count - 1;   /* keep writing over the last slot */
+        }
+        pg->cap = pg->cap ? pg->cap * 2 : 64;
+        pg->insts = (Inst *)realloc(pg->insts, sizeof(Inst) * pg->cap);
+        if (!pg->insts) {
+            runtime_error("Out of memory");
+        }
+    }
+
+    Inst *in = &pg->insts[pg->count];
+    memset(in, 0, sizeof(*in));
+    in->op = (uint8_t)op;
+    return pg->count++;
+}
+
+static void split(Prog *pg, int at, int preferred, int other, bool greedy) {
+    pg->insts[at].x = greedy ? preferred : other;
+    pg->insts[at].y = greedy ? other : preferred;
+}
+
+/* Whether node can match the empty string. */
+static bool nullable(const Parser *ps, int node) {
+    const Node *n = &ps->nodes[node];
+
+    switch (n->kind) {
+        case N_EMPTY:
+        case N_BOL:
+        case N_EOL:
+            return true;
+        case N_BYTE:
+        case N_SET:
+        case N_ANY:
+            return false;
+        case N_CAT: {
+            int count;
+            int *leaves = cat_leaves(ps, node, &count);
+            bool all = true;
+            for (int i = 0; i < count && all; i++) {
+                all = nullable(ps, leaves[i]);
+            }
+            free(leaves);
+            return all;
+        }
+        case N_ALT:
+            return nullable(ps, n->a) || nullable(ps, n->b);
+        case N_REPEAT:
+            return n->min == 0 || nullable(ps, n->a);
+    }
+    return false;
+}
+
+/* Emits code for node; with `reverse` the program matches the reversed
+   language, so concatenations run backwards and ^ and $ trade places. */
+static void compile(Prog *pg, const Parser *ps, int node, bool reverse) {
+    const Node *n = &ps->nodes[node];
+
+    if (pg->too_big) {
+        return;
+    }
+
+    switch (n->kind) {
+        case N_EMPTY:
+            return;
+
+        case N_BYTE: {
+            int at = emit(pg, I_BYTE);
+            pg->insts[at].byte = n->byte;
+            return;
+        }
+
+        case N_SET: {
+            int at = emit(pg, I_SET);
+            pg->insts[at].x = n->set;
+            return;
+        }
+
+        case N_ANY:
+            emit(pg, I_ANY);
+            return;
+
+        case N_BOL:
+            emit(pg, reverse ? I_EOL : I_BOL);
+            return;
+
+        case N_EOL:
+            emit(pg, reverse ? I_BOL : I_EOL);
+            return;
+
+        case N_CAT: {
+            int count;
+            int *leaves = cat_leaves(ps, node, &count);
+            for (int i = 0; i < count; i++) {
+                compile(pg, ps, leaves[reverse ? count - 1 - i : i], reverse);
+            }
+            free(leaves);
+            return;
+        }
+
+        case N_ALT: {
+            int fork = emit(pg, I_SPLIT);
+            compile(pg, ps, n->a, reverse);
+            int jump = emit(pg, I_JMP);
+            split(pg, fork, fork + 1, pg->count, true);
+            compile(pg, ps, n->b, reverse);
+            pg->insts[jump].x = pg->count;
+            return;
+        }
+
+        case N_REPEAT: {
+            /* x{n,} is x{n-1}x+, and x* is (x+)? when x can match
+               empty (as RE2 compiles them): an iteration that matched
+               empty then reaches the loop's own fork again, which the
+               NFA drops as a repeat, so it leaves the loop. With the
+               plain x* loop, x's own alternatives would run first. */
+            bool plus = n->max < 0 && (n->min > 0 || nullable(ps, n->a));
+            int copies = plus && n->min > 0 ? n->min - 1 : n->min;
+
+            for (int i = 0; i < copies; i++) {
+                compile(pg, ps, n->a, reverse);
+            }
+
+            if (plus) {
+                /* (split L, out)? when min is 0, then L: body; split L, out */
+                int skip = n->min == 0 ? emit(pg, I_SPLIT) : -1;
+                int body = pg->count;
+                compile(pg, ps, n->a, reverse);
+                int fork = emit(pg, I_SPLIT);
+                split(pg, fork, body, pg->count, n->greedy);
+                if (skip >= 0) {
+                    split(pg, skip, skip + 1, pg->count, n->greedy);
+                }
+                return;
+            }
+
+            if (n->max < 0) {
+                /* L: split body, out; body; jmp L */
+                int fork = emit(pg, I_SPLIT);
+                compile(pg, ps, n->a, reverse);
+                int jump = emit(pg, I_JMP);
+                pg->insts[jump].x = fork;
+                split(pg, fork, fork + 1, pg->count, n->greedy);
+                return;
+            }
+
+            /* optional copies nest, (x(x)?)?, and all skip to the end */
+            int optional = n->max - n->min;
+            int *forks = (int *)malloc(sizeof(int) * (optional ? optional : 1));
+            if (!forks) {
+                runtime_error("Out of memory");
+            }
+            for (int i = 0; i < optional; i++) {
+                forks[i] = emit(pg, I_SPLIT);
+                compile(pg, ps, n->a, reverse);
+            }
+            for (int i = 0; i < optional; i++) {
+                split(pg, forks[i], forks[i] + 1, pg->count, n->greedy);
+            }
+            free(forks);
+            return;
+        }
+    }
+}
+
+/* =========================
+   Lazy DFA
+   ========================= */
+
+#define SYM_BOT   256   /* virtual symbol: the start of the text */
+#define SYM_EOT   257   /* virtual symbol: the end of the text */
+#define SYM_BOTH  258   /* virtual symbol: both, for an empty text */
+#define DFA_SYMS  259
+#define MATCH_COL DFA_SYMS           /* after the symbols: is it matching */
+#define DFA_STRIDE (DFA_SYMS + 1)
+#define DEAD      0     /* the state with no threads */
+#define UNKNOWN   (-1)
+
+/* States are named by the offset of their row in trans, so following a
+   transition is one load and one add. */
+
+typedef struct {
+    const Prog *prog;
+    int start_pc;
+    bool first;          /* leftmost-first: cut threads behind a match */
+
+    int32_t *trans;      /* DFA_STRIDE entries per state */
+    int **lists;         /* each state's threads, length first */
+    int count;
+    int cap;
+
+    int *table;          /* open addressing over state lists: index + 1 */
+    int table_cap;
+
+    int start[2];        /* start state, [1] at the start of the text */
+
+    /* scratch for building a state */
+    int *buf;
+    int *stack;
+    uint32_t *mark;
+    uint32_t gen;
+} Dfa;
+
+static uint64_t hash_list(const int *list, int n) {
+    uint64_t h = 1469598103934665603ULL;
+    for (int i = 0; i < n; i++) {
+        h = (h ^ (uint32_t)list[i]) * 1099511628211ULL;
+    }
+    return h;
+}
+
+static void dfa_clear(Dfa *d) {
+    for (int i = 0; i < d->count; i++) {
+        free(d->lists[i]);
+    }
+    d->count = 0;
+    memset(d->table, 0, sizeof(int) * d->table_cap);
+    d->start[0] = d->start[1] = UNKNOWN;
+}
+
+static int intern(Dfa *d, const int *list, int n, bool matching);
+
+static void dfa_init(Dfa *d, const Prog *prog, int start_pc, bool first) {
+    memset(d, 0, sizeof(*d));
+    d->prog = prog;
+    d->start_pc = start_pc;
+    d->first = first;
+    d->table_cap = DFA_MAX_STATES * 2;
+    d->table = (int *)calloc(d->table_cap, sizeof(int));
+    d->buf = (int *)malloc(sizeof(int) * (prog->count + 1));
+    d->stack = (int *)malloc(sizeof(int) * (prog->count + 1) * 2);
+    d->mark = (uint32_t *)calloc(prog->count, sizeof(uint32_t));
+    if (!d->table || !d->buf || !d->stack || !d->mark) {
+        runtime_error("Out of memory");
+    }
+    d->start[0] = d->start[1] = UNKNOWN;
+    intern(d, NULL, 0, false);   /* DEAD */
+}
+
+static void dfa_free(Dfa *d) {
+    dfa_clear(d);
+    free(d->trans);
+    free(d->lists);
+    free(d->table);
+    free(d->buf);
+    free(d->stack);
+    free(d->mark);
+}
+
+static int intern(Dfa *d, const int *list, int n, bool matching) {
+    uint64_t h = hash_list(list, n);
+    size_t mask = (size_t)d->table_cap - 1;
+
+    for (size_t i = h & mask;; i = (i + 1) & mask) {
+        int at = d->table[i];
+        if (at == 0) {
+            break;
+        }
+        const int *other = d->lists[at - 1];
+        if (other[0] == n && memcmp(other + 1, list, sizeof(int) * n) == 0) {
+            return (at - 1) * DFA_STRIDE;
+        }
+    }
+
+    if (d->count == d->cap) {
+        d->cap = d->cap ? d->cap * 2 : 16;
+        d->trans = (int32_t *)realloc(d->trans, sizeof(int32_t) * DFA_STRIDE * d->cap);
+        d->lists = (int **)realloc(d->lists, sizeof(int *) * d->cap);
+        if (!d->trans || !d->lists) {
+            runtime_error("Out of memory");
+        }
+    }
+
+    int id = d->count++;
+    int *copy = (int *)malloc(sizeof(int) * (n + 1));
+    if (!copy) {
+        runtime_error("Out of memory");
+    }
+    copy[0] = n;
+    if (n > 0) {
+        memcpy(copy + 1, list, sizeof(int) * n);
+    }
+    d->lists[id] = copy;
+    int32_t *row = d->trans + (size_t)id * DFA_STRIDE;
+    for (int s = 0; s < DFA_SYMS; s++) {
+        row[s] = UNKNOWN;
+    }
+    row[MATCH_COL] = matching;
+
+    for (size_t i = h & mask;; i = (i + 1) & mask) {
+        if (d->table[i] == 0) {
+            d->table[i] = id + 1;
+            break;
+        }
+    }
+    return id * DFA_STRIDE;
+}
+
+static bool inst_takes(const Prog *pg, const Inst *in, int sym) {
+    switch (in->op) {
+        case I_BYTE:    return sym == in->byte;
+        case I_SET:     return sym < 256 && set_has(pg->sets[in->x], (unsigned)sym);
+        case I_ANY:     return sym < 256 && sym != '\n';
+        case I_ANYBYTE: return sym < 256;
+        case I_BOL:     return sym == SYM_BOT || sym == SYM_BOTH;
+        case I_EOL:     return sym == SYM_EOT || sym == SYM_BOTH;
+        default:        return false;
+    }
+}
+
+/* Appends the threads reachable from pc without consuming input, in
+   priority order; while reading a virtual symbol, assertions it
+   satisfies are passed through too. Returns true once a match has been
+   added in leftmost-first mode, meaning everything after it is cut. */
+static bool closure(Dfa *d, int pc, int sym, int *n, bool *matching) {
+    const Inst *insts = d->prog->insts;
+    int top = 0;
+
+    d->stack[top++] = pc;
+    while (top > 0) {
+        pc = d->stack[--top];
+        if (d->mark[pc] == d->gen) {
+            continue;
+        }
+        d->mark[pc] = d->gen;
+
+        switch (insts[pc].op) {
+            case I_JMP:
+                d->stack[top++] = insts[pc].x;
+                break;
+
+            case I_SPLIT:
+                d->stack[top++] = insts[pc].y;
+                d->stack[top++] = insts[pc].x;
+                break;
+
+            case I_BOL:
+            case I_EOL:
+                if (inst_takes(d->prog, &insts[pc], sym)) {
+                    d->stack[top++] = pc + 1;
+                } else {
+                    d->buf[(*n)++] = pc;
+                }
+                break;
+
+            case I_MATCH:
+                d->buf[(*n)++] = pc;
+                *matching = true;
+                if (d->first) {
+                    return true;
+                }
+                break;
+
+            default:
+                d->buf[(*n)++] = pc;
+                break;
+        }
+    }
+    return false;
+}
+
+static void next_gen(Dfa *d) {
+    if (++d->gen == 0) {
+        memset(d->mark, 0, sizeof(uint32_t) * d->prog->count);
+        d->gen = 1;
+    }
+}
+
+/* The state after `from` reads sym. On the virtual symbols only the
+   matching assertions move; every other thread stays where it is. */
+static int step(Dfa *d, int from, int sym) {
+    const int *list = d->lists[from / DFA_STRIDE];
+    int count = list[0];
+    const Inst *insts = d->prog->insts;
+    bool virtual_sym = sym >= 256;
+    bool matching = false;
+    int n = 0;
+
+    next_gen(d);
+    for (int i = 0; i < count; i++) {
+        int pc = list[1 + i];
+        const Inst *in = &insts[pc];
+
+        if (inst_takes(d->prog, in, sym)) {
+            if (closure(d, pc + 1, sym, &n, &matching)) {
+                break;
+            }
+        } else if (virtual_sym && d->mark[pc] != d->gen) {
+            d->mark[pc] = d->gen;
+            d->buf[n++] = pc;
+            if (in->op == I_MATCH) {
+                matching = true;
+                if (d->first) {
+                    break;
+                }
+            }
+        }
+    }
+
+    if (d->count >= DFA_MAX_STATES) {
+        /* over budget: start the cache again; only `to` is needed now */
+        int *keep = (int *)malloc(sizeof(int) * (n ? n : 1));
+        if (!keep) {
+            runtime_error("Out of memory");
+        }
+        memcpy(keep, d->buf, sizeof(int) * n);
+        dfa_clear(d);
+        intern(d, NULL, 0, false);
+        int to = intern(d, keep, n, matching);
+        free(keep);
+        return to;
+    }
+
+    int to = intern(d, d->buf, n, matching);
+    d->trans[from + sym] = to;
+    return to;
+}
+
+static int start_state(Dfa *d, bool at_text_start) {
+    int *slot = &d->start[at_text_start];
+
+    if (*slot == UNKNOWN) {
+        bool matching = false;
+        int n = 0;
+
+        next_gen(d);
+        closure(d, d->start_pc, -1, &n, &matching);
+        int s = intern(d, d->buf, n, matching);
+        if (at_text_start) {
+            s = step(d, s, SYM_BOT);
+        }
+        /* step may have flushed the cache and the other start with it */
+        d->start[at_text_start] = s;
+    }
+    return *slot;
+}
+
+static inline int advance(Dfa *d, int s, int sym) {
+    int32_t to = d->trans[s + sym];
+    return to != UNKNOWN ? to : step(d, s, sym);
+}
+
+static inline bool is_match(const Dfa *d, int s) {
+    return d->trans[s + MATCH_COL];
+}
+
+/* =========================
+   Compiled patterns
+   ========================= */
+
+struct Regex {
+    char *pattern;
+    size_t pattern_len;
+
+    ByteSet *sets;
+    Prog fwd;        /* [0, 3) is the unanchored `.*?` loop */
+    Prog rev;
+
+    /* a required literal prefix; the whole pattern if `literal` */
+    uint8_t *prefix;
+    size_t prefix_len;
+    bool literal;
+
+    Dfa search;      /* fwd, unanchored, leftmost-first */
+    Dfa whole;       /* fwd, anchored, any match */
+    Dfa back;        /* rev, anchored, any match */
+    bool built;
+};
+
+/* Leading bytes every match must start with: the plain bytes at the
+   front of the top-level concatenation. */
+static void find_prefix(Regex *re, const Parser *ps, int root) {
+    int count;
+    int *leaves = cat_leaves(ps, root, &count);
+
+    re->prefix = (uint8_t *)malloc((size_t)count + 1);
+    re->prefix_len = 0;
+    re->literal = true;
+    if (!re->prefix) {
+        runtime_error("Out of memory");
+    }
+
+    for (int i = 0; i < count; i++) {
+        const Node *n = &ps->nodes[leaves[i]];
+        if (n->kind == N_BYTE) {
+            re->prefix[re->prefix_len++] = n->byte;
+        } else if (n->kind != N_EMPTY) {
+            re->literal = false;
+            break;
+        }
+    }
+    free(leaves);
+}
+
+static void regex_free(Regex *re) {
+    if (re->built) {
+        dfa_free(&re->search);
+        dfa_free(&re->whole);
+        dfa_free(&re->back);
+    }
+    free(re->pattern);
+    free(re->sets);
+    free(re->fwd.insts);
+    free(re->rev.insts);
+    free(re->prefix);
+    free(re);
+}
+
+static Regex *regex_compile(const char *pattern, size_t len, const char **err) {
+    Parser ps;
+    memset(&ps, 0, sizeof(ps));
+    ps.p = pattern;
+    ps.end = pattern + len;
+
+    int root = parse_alt(&ps);
+    if (root >= 0 && ps.p < ps.end) {
+        ps.err = "unmatched )";
+    }
+    if (ps.err || root < 0) {
+        *err = ps.err ? ps.err : "invalid pattern";
+        free(ps.nodes);
+        free(ps.sets);
+        return NULL;
+    }
+
+    Regex *re = (Regex *)calloc(1, sizeof(Regex));
+    if (!re) {
+        runtime_error("Out of memory");
+    }
+    re->sets = ps.sets;
+    re->fwd.sets = ps.sets;
+    re->rev.sets = ps.sets;
+
+    /* 0: split 3, 1   1: anybyte   2: jmp 0   3: pattern */
+    emit(&re->fwd, I_SPLIT);
+    emit(&re->fwd, I_ANYBYTE);
+    emit(&re->fwd, I_JMP);
+    re->fwd.insts[0].x = 3;
+    re->fwd.insts[0].y = 1;
+    re->fwd.insts[2].x = 0;
+    compile(&re->fwd, &ps, root, false);
+    emit(&re->fwd, I_MATCH);
+
+    compile(&re->rev, &ps, root, true);
+    emit(&re->rev, I_MATCH);
+
+    find_prefix(re, &ps, root);
+    free(ps.nodes);
+
+    if (re->fwd.too_big || re->rev.too_big) {
+        *err = "pattern too large";
+        regex_free(re);
+        return NULL;
+    }
+
+    re->pattern = (char *)malloc(len + 1);
+    if (!re->pattern) {
+        runtime_error("Out of memory");
+    }
+    memcpy(re->pattern, pattern, len);
+    re->pattern_len = len;
+    return re;
+}
+
+/* DFAs are only set up once a pattern is actually run through them. */
+static void regex_build(Regex *re) {
+    if (!re->built) {
+        dfa_init(&re->search, &re->fwd, 0, true);
+        dfa_init(&re->whole, &re->fwd, 3, false);
+        dfa_init(&re->back, &re->rev, 0, false);
+        re->built = true;
+    }
+}
+
+static Regex *cache[CACHE_SLOTS];
+
+Regex *regex_get(const char *pattern, size_t len, const char **err) {
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (uint8_t)pattern[i]) * 1099511628211ULL;
+    }
+
+    Regex **slot = &cache[h % CACHE_SLOTS];
+    Regex *re = *slot;
+    if (re && re->pattern_len == len && memcmp(re->pattern, pattern, len) == 0) {
+        return re;
+    }
+
+    re = regex_compile(pattern, len, err);
+    if (!re) {
+        return NULL;
+    }
+    if (*slot) {
+        regex_free(*slot);
+    }
+    *slot = re;
+    return re;
+}
+
+/* =========================
+   Matching
+   ========================= */
+
+/* End of the leftmost-first match at or after from, or -1. */
+static long search_end(Regex *re, const uint8_t *t, size_t n, size_t from) {
+    Dfa *d = &re->search;
+
+    if (n == 0) {
+        return is_match(d, advance(d, start_state(d, false), SYM_BOTH)) ? 0 : -1;
+    }
+
+    int s = start_state(d, from == 0);
+    int idle = re->prefix_len > 0 ? start_state(d, false) : UNKNOWN;
+    const int32_t *trans = d->trans;
+    long end = is_match(d, s) ? (long)from : -1;
+    size_t i = from;
+
+    while (i < n) {
+        if (s == idle && end < 0) {
+            /* nothing can start before the next prefix */
+            size_t at = simd_find_substr((const char *)t + i, n - i,
+                                         (const char *)re->prefix, re->prefix_len);
+            if (at + re->prefix_len > n - i) {
+                return -1;
+            }
+            i += at;
+        }
+
+        int to = trans[s + t[i]];
+        if (to == UNKNOWN) {
+            to = step(d, s, t[i]);
+            /* the table may have moved or been flushed */
+            trans = d->trans;
+            idle = re->prefix_len > 0 ? start_state(d, false) : UNKNOWN;
+        }
+        s = to;
+        i++;
+        if (s == DEAD) {
+            return end;
+        }
+        if (trans[s + MATCH_COL]) {
+            end = (long)i;
+        }
+    }
+
+    s = advance(d, s, SYM_EOT);
+    if (is_match(d, s)) {
+        end = (long)n;
+    }
+    return end;
+}
+
+/* Leftmost start of a match ending at end: the longest reverse match. */
+static size_t search_start(Regex *re, const uint8_t *t, size_t n, size_t from,
+                           size_t end) {
+    Dfa *d = &re->back;
+
+    if (n == 0) {
+        return 0;
+    }
+
+    int s = start_state(d, end == n);
+    size_t start = end;
+    size_t i = end;
+
+    while (i > from) {
+        s = advance(d, s, t[i - 1]);
+        i--;
+        if (s == DEAD) {
+            return start;
+        }
+        if (is_match(d, s)) {
+            start = i;
+        }
+    }
+
+    if (from == 0 && is_match(d, advance(d, s, SYM_EOT))) {
+        start = 0;
+    }
+    return start;
+}
+
+bool regex_search(Regex *re, const char *text, size_t n, size_t from,
+                  size_t *start, size_t *end) {
+    if (re->literal) {
+        size_t at = simd_find_substr(text + from, n - from,
+                                     (const char *)re->prefix, re->prefix_len);
+        if (at + re->prefix_len > n - from) {
+            return false;
+        }
+        *start = from + at;
+        *end = from + at + re->prefix_len;
+        return true;
+    }
+
+    regex_build(re);
+
+    long e = search_end(re, (const uint8_t *)text, n, from);
+    if (e < 0) {
+        return false;
+    }
+    *end = (size_t)e;
+    *start = search_start(re, (const uint8_t *)text, n, from, (size_t)e);
+    return true;
+}
+
+bool regex_full_match(Regex *re, const char *text, size_t n) {
+    if (re->literal) {
+        return n == re->prefix_len && memcmp(text, re->prefix, n) == 0;
+    }
+
+    regex_build(re);
+
+    Dfa *d = &re->whole;
+    const uint8_t *t = (const uint8_t *)text;
+
+    if (n == 0) {
+        return is_match(d, advance(d, start_state(d, false), SYM_BOTH));
+    }
+
+    int s = start_state(d, true);
+
+    for (size_t i = 0; i < n; i++) {
+        s = advance(d, s, t[i]);
+        if (s == DEAD) {
+            return false;
+        }
+    }
+    s = advance(d, s, SYM_EOT);
+    return is_match(d, s);
+}
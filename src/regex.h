@@ -0,0 +1,54 @@
+#ifndef REGEX_H
+#define REGEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Regular expressions without backtracking.
+
+   A pattern is parsed once and compiled to two Thompson NFA programs,
+   one for the pattern and one for its reverse. Matching runs them as
+   lazily built DFAs: a DFA state is the ordered list of NFA threads
+   alive at a position, created the first time a transition reaches it
+   and cached, so every byte costs one table lookup and no input is ever
+   looked at twice by the same DFA. The state cache has a fixed budget
+   and is simply flushed when it runs out.
+
+   Matches are leftmost-first, like Perl and Python: the leftmost start,
+   and from there the match preferred by greedy/lazy quantifiers and by
+   the order of alternatives. Unbounded repeats of a body that can match
+   empty are compiled as RE2 and Go compile them, so an iteration that
+   consumes nothing ends the loop: "(.*?)+" matches empty, as it does in
+   Python. Where empty iterations or ^ and $ sit inside such a loop the
+   result can still differ from a backtracking engine's; "((c*)?|b)*" on
+   "cbb" matches all three bytes, as in Go, where Python stops after
+   one. A search runs the forward DFA with an
+   implicit lazy `.*?` in front to find where that match ends, then the
+   reverse DFA back from the end to find where it starts.
+
+   Patterns that are plain literals are matched with the vectorized
+   substring search alone. Patterns that begin with a literal use it to
+   skip ahead whenever the DFA is idle in its start state.
+
+   Syntax: literals, `.` (any byte but newline), [classes] with ranges
+   and negation, \d \w \s and their negations, escaped punctuation, \n
+   \t \r, groups (...) and (?:...) (nothing is captured), alternation |,
+   the anchors ^ and $ (start and end of the text), and the quantifiers
+   * + ? {m} {m,} {m,n}, each optionally lazy with a trailing ?. */
+
+typedef struct Regex Regex;
+
+/* The compiled form of pattern, from a small cache keyed by the pattern
+   text; NULL with *err set if it does not parse. Valid until the next
+   regex_get call. */
+Regex *regex_get(const char *pattern, size_t len, const char **err);
+
+/* Leftmost-first match in text[from, n) (anchors still refer to the
+   whole text). */
+bool regex_search(Regex *re, const char *text, size_t n, size_t from,
+                  size_t *start, size_t *end);
+
+/* Whether the pattern matches all of text. */
+bool regex_full_match(Regex *re, const char *text, size_t n);
+
+#endif
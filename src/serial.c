@@ -0,0 +1,409 @@
+#include "serial.h"
+#include "map.h"
+#include "bigint.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SERIAL_MAGIC     "KITEVAL"
+#define SERIAL_VERSION   1
+#define SERIAL_HEADER    8
+#define SERIAL_MAX_DEPTH 4096
+
+/* =========================
+   Saving
+   ========================= */
+
+typedef struct {
+    FILE *f;
+    uint64_t offset;
+    const char *err;
+} Writer;
+
+static void put(Writer *w, const void *data, size_t len) {
+    if (w->err) {
+        return;
+    }
+    if (fwrite(data, 1, len, w->f) != len) {
+        w->err = "Failed to write value file";
+        return;
+    }
+    w->offset += len;
+}
+
+static void put_tag(Writer *w, char tag) {
+    put(w, &tag, 1);
+}
+
+static void put_u64(Writer *w, uint64_t x) {
+    put(w, &x, sizeof(x));
+}
+
+static void put_align(Writer *w) {
+    static const char zeros[8] = {0};
+    put(w, zeros, (size_t)(-w->offset & 7));
+}
+
+static void put_value(Writer *w, Value v, int depth) {
+    if (depth > SERIAL_MAX_DEPTH) {
+        w->err = "Value is nested too deeply to save";
+        return;
+    }
+
+    switch (v.type) {
+        case VAL_INT:
+            put_tag(w, 'i');
+            put(w, &v.as.int_val, sizeof(int64_t));
+            return;
+
+        case VAL_BOOL: {
+            uint8_t b = v.as.bool_val;
+            put_tag(w, 'b');
+            put(w, &b, 1);
+            return;
+        }
+
+        case VAL_STRING:
+            put_tag(w, 's');
+            put_u64(w, v.as.str_val.len);
+            put(w, v.as.str_val.data, v.as.str_val.len);
+            return;
+
+        case VAL_BIGINT: {
+            const BigInt *big = v.as.big_val;
+            uint8_t neg = big->neg;
+            put_tag(w, 'n');
+            put(w, &neg, 1);
+            put_u64(w, big->len);
+            put_align(w);
+            put(w, big->limbs, sizeof(uint32_t) * big->len);
+            return;
+        }
+
+        case VAL_BYTES:
+            put_tag(w, 'y');
+            put_u64(w, v.as.str_val.len);
+            put(w, v.as.str_val.data, v.as.str_val.len);
+            return;
+
+        case VAL_ARRAY: {
+            const Array *arr = v.as.array_val;
+
+            if (arr->kind == ARRAY_INTS) {
+                put_tag(w, 'I');
+                put_u64(w, arr->count);
+                put_align(w);
+                put(w, arr->ints, sizeof(int64_t) * arr->count);
+                return;
+            }
+            if (arr->kind == ARRAY_BOOLS) {
+                put_tag(w, 'B');
+                put_u64(w, arr->count);
+                put_align(w);
+                put(w, arr->bits, sizeof(uint64_t) * ((arr->count + 63) / 64));
+                return;
+            }
+            if (arr->kind != ARRAY_VALUES) {
+                w->err = "save_value cannot save records";
+                return;
+            }
+
+            put_tag(w, 'a');
+            put_u64(w, arr->count);
+            for (size_t i = 0; i < arr->count && !w->err; i++) {
+                put_value(w, arr->items[i], depth + 1);
+            }
+            return;
+        }
+
+        case VAL_MAP: {
+            const Map *map = v.as.map_val;
+
+            put_tag(w, 'm');
+            put_u64(w, map->count);
+            for (size_t i = 0; i < map->used && !w->err; i++) {
+                const MapEntry *e = &map->entries[i];
+                if (e->deleted) {
+                    continue;
+                }
+                put_value(w, e->key, depth + 1);
+                put_value(w, e->value, depth + 1);
+            }
+            return;
+        }
+
+        default:
+            w->err = "save_value supports ints, bigints, bools, strings, bytes, arrays and maps";
+            return;
+    }
+}
+
+bool serial_save(const char *path, Value v, const char **err) {
+    Writer w = {0};
+    char header[SERIAL_HEADER] = SERIAL_MAGIC;
+
+    w.f = fopen(path, "wbe");
+    if (!w.f) {
+        *err = "Failed to open file for writing";
+        return false;
+    }
+    setvbuf(w.f, NULL, _IOFBF, 1 << 20);
+
+    header[SERIAL_HEADER - 1] = SERIAL_VERSION;
+    put(&w, header, sizeof(header));
+    put_value(&w, v, 0);
+
+    if (fclose(w.f) != 0 && !w.err) {
+        w.err = "Failed to write value file";
+    }
+    if (w.err) {
+        *err = w.err;
+        return false;
+    }
+    return true;
+}
+
+/* =========================
+   Loading
+   ========================= */
+
+typedef struct {
+    const char *base;
+    size_t len;
+    size_t pos;
+    Value whole;   /* string over the mapping; loaded strings are views */
+    const char *err;
+} Reader;
+
+static bool need(Reader *r, size_t n) {
+    if (r->len - r->pos < n) {
+        r->err = "Value file is truncated";
+        return false;
+    }
+    return true;
+}
+
+static bool get_u64(Reader *r, uint64_t *x) {
+    if (!need(r, sizeof(*x))) {
+        return false;
+    }
+    memcpy(x, r->base + r->pos, sizeof(*x));
+    r->pos += sizeof(*x);
+    return true;
+}
+
+/* Skips alignment padding, then checks that `count` elements of `size`
+   bytes follow. */
+static bool get_packed(Reader *r, uint64_t count, size_t size) {
+    r->pos += (size_t)(-r->pos & 7);
+    if (r->pos > r->len || count > (r->len - r->pos) / size) {
+        r->err = "Value file is truncated";
+        return false;
+    }
+    return true;
+}
+
+static bool get_value(Reader *r, Value *out, int depth) {
+    uint64_t count;
+
+    if (depth > SERIAL_MAX_DEPTH) {
+        r->err = "Value file is nested too deeply";
+        return false;
+    }
+    if (!need(r, 1)) {
+        return false;
+    }
+
+    char tag = r->base[r->pos++];
+
+    switch (tag) {
+        case 'i': {
+            int64_t x;
+            if (!need(r, sizeof(x))) {
+                return false;
+            }
+            memcpy(&x, r->base + r->pos, sizeof(x));
+            r->pos += sizeof(x);
+            *out = value_int(x);
+            return true;
+        }
+
+        case 'b':
+            if (!need(r, 1)) {
+                return false;
+            }
+            *out = value_bool(r->base[r->pos++] != 0);
+            return true;
+
+        case 's':
+            if (!get_u64(r, &count) || !need(r, count)) {
+                return false;
+            }
+            *out = value_string_view(r->whole, r->pos, count);
+            r->pos += count;
+            return true;
+
+        case 'y':
+            if (!get_u64(r, &count) || !need(r, count)) {
+                return false;
+            }
+            *out = value_string_view(r->whole, r->pos, count);
+            out->type = VAL_BYTES;
+            r->pos += count;
+            return true;
+
+        case 'n': {
+            if (!need(r, 1)) {
+                return false;
+            }
+            bool neg = r->base[r->pos++] != 0;
+            if (!get_u64(r, &count) || !get_packed(r, count, sizeof(uint32_t))) {
+                return false;
+            }
+            *out = bigint_from_limbs((const uint32_t *)(r->base + r->pos),
+                                     count, neg);
+            r->pos += sizeof(uint32_t) * count;
+            return true;
+        }
+
+        case 'I':
+            if (!get_u64(r, &count) || !get_packed(r, count, sizeof(int64_t))) {
+                return false;
+            }
+            *out = value_int_array(count);
+            if (count > 0) {
+                memcpy(out->as.array_val->ints, r->base + r->pos,
+                       sizeof(int64_t) * count);
+            }
+            r->pos += sizeof(int64_t) * count;
+            return true;
+
+        case 'B': {
+            size_t words;
+            if (!get_u64(r, &count)) {
+                return false;
+            }
+            words = count / 64 + (count % 64 != 0);
+            if (!get_packed(r, words, sizeof(uint64_t))) {
+                return false;
+            }
+            *out = value_bool_array(count);
+            if (count > 0) {
+                memcpy(out->as.array_val->bits, r->base + r->pos,
+                       sizeof(uint64_t) * words);
+            }
+            if (count % 64) {
+                /* bits past the end must stay clear */
+                out->as.array_val->bits[words - 1] &=
+                    ((uint64_t)1 << (count % 64)) - 1;
+            }
+            r->pos += sizeof(uint64_t) * words;
+            return true;
+        }
+
+        case 'a': {
+            /* every element takes at least one byte */
+            if (!get_u64(r, &count) || !need(r, count)) {
+                return false;
+            }
+
+            Value *items = malloc(sizeof(Value) * (count ? count : 1));
+            if (!items) {
+                exit(1);
+            }
+            for (size_t i = 0; i < count; i++) {
+                if (!get_value(r, &items[i], depth + 1)) {
+                    for (size_t j = 0; j < i; j++) {
+                        value_free(items[j]);
+                    }
+                    free(items);
+                    return false;
+                }
+            }
+            *out = value_array_from_values(items, count);
+            return true;
+        }
+
+        case 'm': {
+            if (!get_u64(r, &count) || !need(r, count)) {
+                return false;
+            }
+
+            Value map = value_map();
+            for (size_t i = 0; i < count; i++) {
+                Value key, value;
+                if (!get_value(r, &key, depth + 1)) {
+                    value_free(map);
+                    return false;
+                }
+                if (!map_key_ok(key) || !get_value(r, &value, depth + 1)) {
+                    if (!r->err) {
+                        r->err = "Value file has an invalid map key";
+                    }
+                    value_free(key);
+                    value_free(map);
+                    return false;
+                }
+                map_set(map.as.map_val, key, value);
+            }
+            *out = map;
+            return true;
+        }
+
+        default:
+            r->err = "Value file is corrupt";
+            return false;
+    }
+}
+
+bool serial_load(const char *path, Value *out, const char **err) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        *err = "Failed to open file";
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < SERIAL_HEADER) {
+        close(fd);
+        *err = "Not a Kite value file";
+        return false;
+    }
+
+    size_t len = (size_t)st.st_size;
+    void *addr = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        *err = "Failed to map file";
+        return false;
+    }
+    madvise(addr, len, MADV_WILLNEED);
+
+    Reader r;
+    r.base = (const char *)addr;
+    r.len = len;
+    r.pos = SERIAL_HEADER;
+    r.whole = value_string_mapped(addr, len);
+    r.err = NULL;
+
+    if (memcmp(r.base, SERIAL_MAGIC, SERIAL_HEADER - 1) != 0 ||
+        r.base[SERIAL_HEADER - 1] != SERIAL_VERSION) {
+        r.err = "Not a Kite value file";
+    } else if (get_value(&r, out, 0) && r.pos != r.len) {
+        value_free(*out);
+        r.err = "Value file has trailing data";
+    }
+
+    /* strings still pointing into the mapping keep it alive */
+    value_free(r.whole);
+
+    if (r.err) {
+        *err = r.err;
+        return false;
+    }
+    return true;
+}
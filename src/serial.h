@@ -0,0 +1,37 @@
+#ifndef SERIAL_H
+#define SERIAL_H
+
+#include "value.h"
+
+/* Binary value files, used by save_value / load_value.
+
+   A file is the 8-byte header "KITEVAL" + version, then one encoded
+   value. Each value is a one-byte tag followed by its payload, in host
+   byte order:
+
+     'i'  int64
+     'n'  bigint: uint8 sign (1 if negative), uint64 limb count, zero
+          padding to 8-byte alignment, uint32[count] magnitude limbs,
+          least significant first
+     'b'  uint8
+     's'  uint64 length, bytes
+     'y'  as 's', for a bytes value
+     'a'  uint64 count, count values
+     'I'  uint64 count, zero padding to 8-byte alignment, int64[count]
+     'B'  uint64 count, zero padding to 8-byte alignment,
+          uint64[(count + 63) / 64] (bit i of word i / 64)
+     'm'  uint64 count, count key/value pairs in insertion order
+
+   Packed payloads are aligned so the file can be mapped and read in
+   place. Loading maps the file: strings and bytes become views into the
+   mapping (their pages are only read when touched) and packed arrays
+   are copied out in one memcpy, so nothing is parsed per element.
+
+   Records, functions, shapes and handles have no encoding and make
+   save_value fail. */
+
+/* On failure both return false and set *err to a static message. */
+bool serial_save(const char *path, Value v, const char **err);
+bool serial_load(const char *path, Value *out, const char **err);
+
+#endif
@@ -0,0 +1,633 @@
+#include "simd.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KITE_X86 1
+#endif
+
+int simd_has_avx2(void) {
+#ifdef KITE_X86
+    static int cached = -1;
+    if (cached < 0) {
+        __builtin_cpu_init();
+        cached = __builtin_cpu_supports("avx2") ? 1 : 0;
+    }
+    return cached;
+#else
+    return 0;
+#endif
+}
+
+/* =========================
+   Scalar fallbacks
+   ========================= */
+
+static bool sum_scalar(const int64_t *xs, size_t n, int64_t *sum) {
+    int64_t acc = 0;
+    bool ovf = false;
+    for (size_t i = 0; i < n; i++) {
+        ovf |= __builtin_add_overflow(acc, xs[i], &acc);
+    }
+    *sum = acc;
+    return !ovf;
+}
+
+static int64_t min_scalar(const int64_t *xs, size_t n) {
+    int64_t m = xs[0];
+    for (size_t i = 1; i < n; i++) {
+        if (xs[i] < m) m = xs[i];
+    }
+    return m;
+}
+
+static int64_t max_scalar(const int64_t *xs, size_t n) {
+    int64_t m = xs[0];
+    for (size_t i = 1; i < n; i++) {
+        if (xs[i] > m) m = xs[i];
+    }
+    return m;
+}
+
+static size_t count_eq_scalar(const int64_t *xs, size_t n, int64_t x) {
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++) {
+        count += xs[i] == x;
+    }
+    return count;
+}
+
+static bool add_scalar(int64_t *out, const int64_t *a, const int64_t *b,
+                       size_t n) {
+    bool ovf = false;
+    for (size_t i = 0; i < n; i++) {
+        ovf |= __builtin_add_overflow(a[i], b[i], &out[i]);
+    }
+    return !ovf;
+}
+
+static bool mul_scalar(int64_t *out, const int64_t *a, const int64_t *b,
+                       size_t n) {
+    bool ovf = false;
+    for (size_t i = 0; i < n; i++) {
+        ovf |= __builtin_mul_overflow(a[i], b[i], &out[i]);
+    }
+    return !ovf;
+}
+
+static size_t find_byte_scalar(const char *p, size_t n, char c) {
+    const char *hit = memchr(p, c, n);
+    return hit ? (size_t)(hit - p) : n;
+}
+
+static size_t count_byte_scalar(const char *p, size_t n, char c) {
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++) {
+        count += p[i] == c;
+    }
+    return count;
+}
+
+static size_t find_substr_scalar(const char *p, size_t n,
+                                 const char *needle, size_t m) {
+    const char *hit = memmem(p, n, needle, m);
+    return hit ? (size_t)(hit - p) : n;
+}
+
+static inline int is_space(unsigned char c) {
+    return c == ' ' || (unsigned char)(c - '\t') <= '\r' - '\t';
+}
+
+static void space_bits_scalar(const char *p, size_t n, uint64_t *bits) {
+    for (size_t w = 0; w * 64 < n; w++) {
+        size_t end = n - w * 64 < 64 ? n - w * 64 : 64;
+        uint64_t word = 0;
+        for (size_t i = 0; i < end; i++) {
+            word |= (uint64_t)is_space((unsigned char)p[w * 64 + i]) << i;
+        }
+        bits[w] = word;
+    }
+}
+
+enum {
+    JSON_QUOTE = 1,
+    JSON_BACKSLASH = 2,
+    JSON_OP = 4,
+    JSON_SPACE = 8,
+    JSON_CONTROL = 16
+};
+
+static unsigned char json_class(unsigned char c) {
+    unsigned char k = c < 0x20 ? JSON_CONTROL : 0;
+
+    switch (c) {
+        case '"':  return k | JSON_QUOTE;
+        case '\\': return k | JSON_BACKSLASH;
+        case '{': case '}': case '[': case ']': case ':': case ',':
+            return k | JSON_OP;
+        case ' ': case '\t': case '\n': case '\r':
+            return k | JSON_SPACE;
+        default:
+            return k;
+    }
+}
+
+static void json_blocks_scalar(const char *p, size_t n, SimdJsonBlock *blocks) {
+    static unsigned char table[256];
+    static int ready;
+
+    if (!ready) {
+        for (int c = 0; c < 256; c++) {
+            table[c] = json_class((unsigned char)c);
+        }
+        ready = 1;
+    }
+
+    for (size_t w = 0; w * 64 < n; w++) {
+        size_t end = n - w * 64 < 64 ? n - w * 64 : 64;
+        SimdJsonBlock b = {0};
+        for (size_t i = 0; i < end; i++) {
+            unsigned k = table[(unsigned char)p[w * 64 + i]];
+            b.quote |= (uint64_t)((k & JSON_QUOTE) != 0) << i;
+            b.backslash |= (uint64_t)((k & JSON_BACKSLASH) != 0) << i;
+            b.op |= (uint64_t)((k & JSON_OP) != 0) << i;
+            b.space |= (uint64_t)((k & JSON_SPACE) != 0) << i;
+            b.control |= (uint64_t)((k & JSON_CONTROL) != 0) << i;
+        }
+        blocks[w] = b;
+    }
+}
+
+static void csv_blocks_scalar(const char *p, size_t n, char sep,
+                              SimdCsvBlock *blocks) {
+    for (size_t w = 0; w * 64 < n; w++) {
+        size_t end = n - w * 64 < 64 ? n - w * 64 : 64;
+        SimdCsvBlock b = {0};
+        for (size_t i = 0; i < end; i++) {
+            char c = p[w * 64 + i];
+            b.quote |= (uint64_t)(c == '"') << i;
+            b.sep |= (uint64_t)(c == sep) << i;
+            b.newline |= (uint64_t)(c == '\n') << i;
+        }
+        blocks[w] = b;
+    }
+}
+
+/* =========================
+   AVX2 bodies
+   ========================= */
+
+#ifdef KITE_X86
+
+/* r = a + b overflowed where a and b agree in sign and r does not:
+   the sign bit of (a ^ r) & (b ^ r). */
+__attribute__((target("avx2")))
+static inline __m256i add_overflow_bits(__m256i a, __m256i b, __m256i r) {
+    return _mm256_and_si256(_mm256_xor_si256(a, r), _mm256_xor_si256(b, r));
+}
+
+/* Lane sums that overflow are flagged even when the total would fit;
+   the caller's exact path sorts that out. */
+__attribute__((target("avx2")))
+static bool sum_avx2(const int64_t *xs, size_t n, int64_t *sum) {
+    __m256i acc0 = _mm256_setzero_si256();
+    __m256i acc1 = _mm256_setzero_si256();
+    __m256i ovf = _mm256_setzero_si256();
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m256i v0 = _mm256_loadu_si256((const __m256i *)(xs + i));
+        __m256i v1 = _mm256_loadu_si256((const __m256i *)(xs + i + 4));
+        __m256i r0 = _mm256_add_epi64(acc0, v0);
+        __m256i r1 = _mm256_add_epi64(acc1, v1);
+        ovf = _mm256_or_si256(ovf, add_overflow_bits(acc0, v0, r0));
+        ovf = _mm256_or_si256(ovf, add_overflow_bits(acc1, v1, r1));
+        acc0 = r0;
+        acc1 = r1;
+    }
+
+    __m256i acc = _mm256_add_epi64(acc0, acc1);
+    ovf = _mm256_or_si256(ovf, add_overflow_bits(acc0, acc1, acc));
+
+    int64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+
+    int64_t tail;
+    bool exact = sum_scalar(xs + i, n - i, &tail) &&
+                 _mm256_movemask_pd(_mm256_castsi256_pd(ovf)) == 0;
+    for (int k = 0; k < 4; k++) {
+        exact &= !__builtin_add_overflow(tail, lanes[k], &tail);
+    }
+    *sum = tail;
+    return exact;
+}
+
+__attribute__((target("avx2")))
+static int64_t minmax_avx2(const int64_t *xs, size_t n, int want_max) {
+    if (n < 4) {
+        return want_max ? max_scalar(xs, n) : min_scalar(xs, n);
+    }
+
+    __m256i m = _mm256_loadu_si256((const __m256i *)xs);
+    size_t i = 4;
+
+    for (; i + 4 <= n; i += 4) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(xs + i));
+        /* take v where it beats m */
+        __m256i take = want_max ? _mm256_cmpgt_epi64(v, m)
+                                : _mm256_cmpgt_epi64(m, v);
+        m = _mm256_blendv_epi8(m, v, take);
+    }
+
+    int64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, m);
+
+    int64_t best = lanes[0];
+    for (int k = 1; k < 4; k++) {
+        if (want_max ? lanes[k] > best : lanes[k] < best) best = lanes[k];
+    }
+    for (; i < n; i++) {
+        if (want_max ? xs[i] > best : xs[i] < best) best = xs[i];
+    }
+    return best;
+}
+
+__attribute__((target("avx2")))
+static size_t count_eq_avx2(const int64_t *xs, size_t n, int64_t x) {
+    __m256i needle = _mm256_set1_epi64x(x);
+    /* Matching lanes are -1, so subtracting counts them. */
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(xs + i));
+        acc = _mm256_sub_epi64(acc, _mm256_cmpeq_epi64(v, needle));
+    }
+
+    int64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+
+    return (size_t)(lanes[0] + lanes[1] + lanes[2] + lanes[3]) +
+           count_eq_scalar(xs + i, n - i, x);
+}
+
+__attribute__((target("avx2")))
+static bool add_avx2(int64_t *out, const int64_t *a, const int64_t *b,
+                     size_t n) {
+    __m256i ovf = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+        __m256i r = _mm256_add_epi64(va, vb);
+        ovf = _mm256_or_si256(ovf, add_overflow_bits(va, vb, r));
+        _mm256_storeu_si256((__m256i *)(out + i), r);
+    }
+    bool tail = add_scalar(out + i, a + i, b + i, n - i);
+    return _mm256_movemask_pd(_mm256_castsi256_pd(ovf)) == 0 && tail;
+}
+
+/* AVX2 has no 64-bit mullo; build it from 32x32->64 products:
+   a*b = lo(a)*lo(b) + ((lo(a)*hi(b) + hi(a)*lo(b)) << 32)  (mod 2^64).
+   Overflow is ruled out cheaply: x + 2^31 has no high bits exactly when
+   x fits in int32_t, and a product of two such values fits in int64_t. */
+__attribute__((target("avx2")))
+static bool mul_avx2(int64_t *out, const int64_t *a, const int64_t *b,
+                     size_t n) {
+    const __m256i bias = _mm256_set1_epi64x(INT64_C(1) << 31);
+    __m256i wide = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+
+        __m256i lo = _mm256_mul_epu32(va, vb);
+        __m256i c1 = _mm256_mul_epu32(va, _mm256_srli_epi64(vb, 32));
+        __m256i c2 = _mm256_mul_epu32(_mm256_srli_epi64(va, 32), vb);
+        __m256i cross = _mm256_slli_epi64(_mm256_add_epi64(c1, c2), 32);
+
+        wide = _mm256_or_si256(wide,
+                   _mm256_or_si256(_mm256_add_epi64(va, bias),
+                                   _mm256_add_epi64(vb, bias)));
+
+        _mm256_storeu_si256((__m256i *)(out + i),
+                            _mm256_add_epi64(lo, cross));
+    }
+    bool tail = mul_scalar(out + i, a + i, b + i, n - i);
+    return _mm256_testz_si256(wide, _mm256_set1_epi64x((int64_t)~UINT64_C(0xffffffff))) &&
+           tail;
+}
+
+/* 64 bytes per step: two compares folded into one mask test, so the
+   common no-match case costs one branch per cache line. */
+__attribute__((target("avx2")))
+static size_t find_byte_avx2(const char *p, size_t n, char c) {
+    __m256i needle = _mm256_set1_epi8(c);
+    size_t i = 0;
+
+    for (; i + 64 <= n; i += 64) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(p + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(p + i + 32));
+        __m256i ea = _mm256_cmpeq_epi8(a, needle);
+        __m256i eb = _mm256_cmpeq_epi8(b, needle);
+
+        if (!_mm256_testz_si256(_mm256_or_si256(ea, eb),
+                                _mm256_or_si256(ea, eb))) {
+            uint32_t ma = (uint32_t)_mm256_movemask_epi8(ea);
+            if (ma) {
+                return i + (size_t)__builtin_ctz(ma);
+            }
+            uint32_t mb = (uint32_t)_mm256_movemask_epi8(eb);
+            return i + 32 + (size_t)__builtin_ctz(mb);
+        }
+    }
+
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+        uint32_t m = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle));
+        if (m) {
+            return i + (size_t)__builtin_ctz(m);
+        }
+    }
+
+    return i + find_byte_scalar(p + i, n - i, c);
+}
+
+/* Byte counters are bumped by subtracting the all-ones compare result
+   and folded into 64-bit totals before any of them can wrap. */
+__attribute__((target("avx2")))
+static size_t count_byte_avx2(const char *p, size_t n, char c) {
+    __m256i needle = _mm256_set1_epi8(c);
+    __m256i zero = _mm256_setzero_si256();
+    __m256i total = zero;
+    size_t i = 0;
+
+    while (i + 32 <= n) {
+        __m256i counts = zero;
+        size_t stop = n - i >= 255 * 32 ? i + 255 * 32 : n - (n - i) % 32;
+
+        for (; i < stop; i += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+            counts = _mm256_sub_epi8(counts, _mm256_cmpeq_epi8(v, needle));
+        }
+        total = _mm256_add_epi64(total, _mm256_sad_epu8(counts, zero));
+    }
+
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, total);
+    return (size_t)(lanes[0] + lanes[1] + lanes[2] + lanes[3]) +
+           count_byte_scalar(p + i, n - i, c);
+}
+
+/* Candidates are positions where both the first and the last byte of
+   the needle match, 32 at a time; only those are compared in full. */
+__attribute__((target("avx2")))
+static size_t find_substr_avx2(const char *p, size_t n,
+                               const char *needle, size_t m) {
+    __m256i first = _mm256_set1_epi8(needle[0]);
+    __m256i last = _mm256_set1_epi8(needle[m - 1]);
+    size_t i = 0;
+
+    for (; i + m - 1 + 32 <= n; i += 32) {
+        __m256i bf = _mm256_loadu_si256((const __m256i *)(p + i));
+        __m256i bl = _mm256_loadu_si256((const __m256i *)(p + i + m - 1));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(bf, first),
+                             _mm256_cmpeq_epi8(bl, last)));
+
+        while (mask) {
+            size_t at = i + (size_t)__builtin_ctz(mask);
+            if (memcmp(p + at + 1, needle + 1, m - 2) == 0) {
+                return at;
+            }
+            mask &= mask - 1;
+        }
+    }
+
+    return i + find_substr_scalar(p + i, n - i, needle, m);
+}
+
+__attribute__((target("avx2")))
+static void space_bits_avx2(const char *p, size_t n, uint64_t *bits) {
+    __m256i space = _mm256_set1_epi8(' ');
+    __m256i tab = _mm256_set1_epi8('\t');
+    __m256i span = _mm256_set1_epi8('\r' - '\t');
+    size_t w = 0;
+
+    for (; (w + 1) * 64 <= n; w++) {
+        uint64_t word = 0;
+        for (int half = 0; half < 2; half++) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(p + w * 64 + half * 32));
+            __m256i t = _mm256_sub_epi8(v, tab);
+            /* \t..\r: unsigned t <= 4, i.e. min(t, 4) == t */
+            __m256i ctl = _mm256_cmpeq_epi8(_mm256_min_epu8(t, span), t);
+            __m256i ws = _mm256_or_si256(ctl, _mm256_cmpeq_epi8(v, space));
+            word |= (uint64_t)(uint32_t)_mm256_movemask_epi8(ws) << (half * 32);
+        }
+        bits[w] = word;
+    }
+
+    if (w * 64 < n) {
+        space_bits_scalar(p + w * 64, n - w * 64, bits + w);
+    }
+}
+
+__attribute__((target("avx2")))
+static void json_blocks_avx2(const char *p, size_t n, SimdJsonBlock *blocks) {
+    __m256i quote = _mm256_set1_epi8('"');
+    __m256i backslash = _mm256_set1_epi8('\\');
+    __m256i lower = _mm256_set1_epi8(0x20);
+    __m256i open = _mm256_set1_epi8('{');
+    __m256i close = _mm256_set1_epi8('}');
+    __m256i colon = _mm256_set1_epi8(':');
+    __m256i comma = _mm256_set1_epi8(',');
+    __m256i space = _mm256_set1_epi8(' ');
+    __m256i tab = _mm256_set1_epi8('\t');
+    __m256i lf = _mm256_set1_epi8('\n');
+    __m256i cr = _mm256_set1_epi8('\r');
+    __m256i ctl = _mm256_set1_epi8(0x1f);
+    size_t w = 0;
+
+    for (; (w + 1) * 64 <= n; w++) {
+        SimdJsonBlock b = {0};
+        for (int half = 0; half < 2; half++) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(p + w * 64 + half * 32));
+            /* [ and ] are { and } with the 0x20 bit clear */
+            __m256i folded = _mm256_or_si256(v, lower);
+            __m256i op = _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(folded, open),
+                                _mm256_cmpeq_epi8(folded, close)),
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, colon),
+                                _mm256_cmpeq_epi8(v, comma)));
+            __m256i ws = _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, space),
+                                _mm256_cmpeq_epi8(v, tab)),
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, lf),
+                                _mm256_cmpeq_epi8(v, cr)));
+            __m256i control = _mm256_cmpeq_epi8(_mm256_min_epu8(v, ctl), v);
+            int shift = half * 32;
+
+            b.quote |= (uint64_t)(uint32_t)_mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(v, quote)) << shift;
+            b.backslash |= (uint64_t)(uint32_t)_mm256_movemask_epi8(
+                _mm256_cmpeq_epi8(v, backslash)) << shift;
+            b.op |= (uint64_t)(uint32_t)_mm256_movemask_epi8(op) << shift;
+            b.space |= (uint64_t)(uint32_t)_mm256_movemask_epi8(ws) << shift;
+            b.control |= (uint64_t)(uint32_t)_mm256_movemask_epi8(control) << shift;
+        }
+        blocks[w] = b;
+    }
+
+    if (w * 64 < n) {
+        json_blocks_scalar(p + w * 64, n - w * 64, blocks + w);
+    }
+}
+
+__attribute__((target("avx2")))
+static void csv_blocks_avx2(const char *p, size_t n, char sep,
+                            SimdCsvBlock *blocks) {
+    __m256i quote = _mm256_set1_epi8('"');
+    __m256i delim = _mm256_set1_epi8(sep);
+    __m256i lf = _mm256_set1_epi8('\n');
+    size_t w = 0;
+
+    for (; (w + 1) * 64 <= n; w++) {
+        __m256i lo = _mm256_loadu_si256((const __m256i *)(p + w * 64));
+        __m256i hi = _mm256_loadu_si256((const __m256i *)(p + w * 64 + 32));
+        SimdCsvBlock b;
+
+        b.quote = (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, quote)) |
+                  (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, quote)) << 32;
+        b.sep = (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, delim)) |
+                (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, delim)) << 32;
+        b.newline = (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, lf)) |
+                    (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, lf)) << 32;
+        blocks[w] = b;
+    }
+
+    if (w * 64 < n) {
+        csv_blocks_scalar(p + w * 64, n - w * 64, sep, blocks + w);
+    }
+}
+
+#endif /* KITE_X86 */
+
+/* =========================
+   Dispatch
+   ========================= */
+
+bool simd_sum_i64(const int64_t *xs, size_t n, int64_t *sum) {
+#ifdef KITE_X86
+    if (simd_has_avx2()) return sum_avx2(xs, n, sum);
+#endif
+    return sum_scalar(xs, n, sum);
+}
+
+int64_t simd_min_i64(const int64_t *xs, size_t n) {
+#ifdef KITE_X86
+    if (simd_has_avx2()) return minmax_avx2(xs, n, 0);
+#endif
+    return min_scalar(xs, n);
+}
+
+int64_t simd_max_i64(const int64_t *xs, size_t n) {
+#ifdef KITE_X86
+    if (simd_has_avx2()) return minmax_avx2(xs, n, 1);
+#endif
+    return max_scalar(xs, n);
+}
+
+size_t simd_count_eq_i64(const int64_t *xs, size_t n, int64_t x) {
+#ifdef KITE_X86
+    if (simd_has_avx2()) return count_eq_avx2(xs, n, x);
+#endif
+    return count_eq_scalar(xs, n, x);
+}
+
+bool simd_add_i64(int64_t *out, const int64_t *a, const int64_t *b, size_t n) {
+#ifdef KITE_X86
+    if (simd_has_avx2()) return add_avx2(out, a, b, n);
+#endif
+    return add_scalar(out, a, b, n);
+}
+
+bool simd_mul_i64(int64_t *out, const int64_t *a, const int64_t *b, size_t n) {
+#ifdef KITE_X86
+    if (simd_has_avx2()) return mul_avx2(out, a, b, n);
+#endif
+    return mul_scalar(out, a, b, n);
+}
+
+size_t simd_find_byte(const char *p, size_t n, char c) {
+#ifdef KITE_X86
+    if (simd_has_avx2()) return find_byte_avx2(p, n, c);
+#endif
+    return find_byte_scalar(p, n, c);
+}
+
+size_t simd_count_byte(const char *p, size_t n, char c) {
+#ifdef KITE_X86
+    if (simd_has_avx2()) return count_byte_avx2(p, n, c);
+#endif
+    return count_byte_scalar(p, n, c);
+}
+
+size_t simd_find_substr(const char *p, size_t n, const char *needle, size_t m) {
+    if (m == 0) {
+        return 0;
+    }
+    if (m > n) {
+        return n;
+    }
+    if (m == 1) {
+        return simd_find_byte(p, n, needle[0]);
+    }
+#ifdef KITE_X86
+    if (simd_has_avx2()) return find_substr_avx2(p, n, needle, m);
+#endif
+    return find_substr_scalar(p, n, needle, m);
+}
+
+void simd_space_bits(const char *p, size_t n, uint64_t *bits) {
+#ifdef KITE_X86
+    if (simd_has_avx2()) {
+        space_bits_avx2(p, n, bits);
+        return;
+    }
+#endif
+    space_bits_scalar(p, n, bits);
+}
+
+void simd_json_blocks(const char *p, size_t n, SimdJsonBlock *blocks) {
+#ifdef KITE_X86
+    if (simd_has_avx2()) {
+        json_blocks_avx2(p, n, blocks);
+        return;
+    }
+#endif
+    json_blocks_scalar(p, n, blocks);
+}
+
+void simd_csv_blocks(const char *p, size_t n, char sep, SimdCsvBlock *blocks) {
+#ifdef KITE_X86
+    if (simd_has_avx2()) {
+        csv_blocks_avx2(p, n, sep, blocks);
+        return;
+    }
+#endif
+    csv_blocks_scalar(p, n, sep, blocks);
+}
+
+size_t simd_popcount_bits(const uint64_t *words, size_t n) {
+    size_t full = n / 64;
+    size_t count = 0;
+
+    for (size_t i = 0; i < full; i++) {
+        count += (size_t)__builtin_popcountll(words[i]);
+    }
+    if (n % 64) {
+        uint64_t mask = ((uint64_t)1 << (n % 64)) - 1;
+        count += (size_t)__builtin_popcountll(words[full] & mask);
+    }
+    return count;
+}
@@ -0,0 +1,86 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Bulk kernels over packed arrays. Each one checks once for AVX2 and
+   otherwise runs a plain loop. The arithmetic kernels return false when
+   a result may have overflowed int64_t (the output then holds wrapped
+   values), so the caller can redo the work exactly; mul may also say so
+   for operands outside the int32_t range whose product fits. */
+
+bool    simd_sum_i64(const int64_t *xs, size_t n, int64_t *sum);
+int64_t simd_min_i64(const int64_t *xs, size_t n);  /* n > 0 */
+int64_t simd_max_i64(const int64_t *xs, size_t n);  /* n > 0 */
+size_t  simd_count_eq_i64(const int64_t *xs, size_t n, int64_t x);
+
+bool simd_add_i64(int64_t *out, const int64_t *a, const int64_t *b, size_t n);
+bool simd_mul_i64(int64_t *out, const int64_t *a, const int64_t *b, size_t n);
+
+/* Byte scans over strings and I/O buffers. */
+size_t simd_find_byte(const char *p, size_t n, char c);   /* n if absent */
+size_t simd_count_byte(const char *p, size_t n, char c);
+/* First occurrence of needle[0, m); n if absent, 0 for an empty needle. */
+size_t simd_find_substr(const char *p, size_t n, const char *needle, size_t m);
+/* Bit i of bits (sized (n + 63) / 64 words) is set when p[i] is ASCII
+   whitespace: space, \t, \n, \v, \f or \r. Bits past n are clear. */
+void   simd_space_bits(const char *p, size_t n, uint64_t *bits);
+
+/* Character classes of one 64-byte block of JSON text; bit i is byte i.
+   op is the six structural characters {}[]:, space is JSON whitespace
+   (space, \t, \n, \r) and control is every byte below 0x20. */
+typedef struct {
+    uint64_t quote;
+    uint64_t backslash;
+    uint64_t op;
+    uint64_t space;
+    uint64_t control;
+} SimdJsonBlock;
+
+/* Classifies p[0, n) into (n + 63) / 64 blocks. Bits past n are clear. */
+void   simd_json_blocks(const char *p, size_t n, SimdJsonBlock *blocks);
+
+/* The same for CSV: double quotes, the separator byte and '\n'. */
+typedef struct {
+    uint64_t quote;
+    uint64_t sep;
+    uint64_t newline;
+} SimdCsvBlock;
+
+void   simd_csv_blocks(const char *p, size_t n, char sep, SimdCsvBlock *blocks);
+
+/* Bit i is the parity of bits 0..i: given the quote positions of a
+   block, the bytes inside quotes (opening quote included). */
+static inline uint64_t simd_prefix_xor(uint64_t x) {
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+}
+
+/* Eight characters loaded little-endian (the first in the low byte):
+   whether all are ASCII digits, and their value read as a decimal
+   number, first character most significant. */
+static inline bool simd_is_digits8(uint64_t x) {
+    return ((x & 0xF0F0F0F0F0F0F0F0u) |
+            (((x + 0x0606060606060606u) & 0xF0F0F0F0F0F0F0F0u) >> 4)) ==
+           0x3333333333333333u;
+}
+
+static inline uint64_t simd_digits8(uint64_t x) {
+    x = ((x & 0x0F0F0F0F0F0F0F0Fu) * 2561) >> 8;
+    x = ((x & 0x00FF00FF00FF00FFu) * 6553601) >> 16;
+    return ((x & 0x0000FFFF0000FFFFu) * 42949672960001u) >> 32;
+}
+
+/* Number of set bits among the first n bits of a packed bool array. */
+size_t simd_popcount_bits(const uint64_t *words, size_t n);
+
+int simd_has_avx2(void);
+
+#endif
@@ -0,0 +1,421 @@
+#include "sort.h"
+#include "error.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define INSERTION_THRESHOLD      24
+#define NINTHER_THRESHOLD        128
+#define PARTIAL_INSERTION_LIMIT  8
+#define RADIX_THRESHOLD          64
+#define RADIX_BITS               11
+
+/* =========================
+   Ints
+   ========================= */
+
+static void insertion_sort_ints(int64_t *items, size_t count, bool desc) {
+    for (size_t i = 1; i < count; i++) {
+        int64_t x = items[i];
+        size_t j = i;
+        while (j > 0 && (desc ? items[j - 1] < x : items[j - 1] > x)) {
+            items[j] = items[j - 1];
+            j--;
+        }
+        items[j] = x;
+    }
+}
+
+static void copy_ints(const int64_t *src, int64_t *out, size_t count, bool reverse) {
+    if (!reverse) {
+        if (out != src) {
+            memcpy(out, src, sizeof(int64_t) * count);
+        }
+        return;
+    }
+    for (size_t i = 0, j = count; i < j; i++, j--) {
+        int64_t t = src[i];
+        out[i] = src[j - 1];
+        out[j - 1] = t;
+    }
+}
+
+void sort_ints(const int64_t *src, int64_t *out, size_t count, bool desc) {
+    if (count < RADIX_THRESHOLD) {
+        copy_ints(src, out, count, false);
+        insertion_sort_ints(out, count, desc);
+        return;
+    }
+
+    /* one scan for the range of keys and whether they are in order */
+    int64_t min = src[0];
+    int64_t max = src[0];
+    bool ascending = true;
+    bool descending = true;
+    for (size_t i = 1; i < count; i++) {
+        int64_t x = src[i];
+        min = x < min ? x : min;
+        max = x > max ? x : max;
+        ascending &= src[i - 1] <= x;
+        descending &= src[i - 1] >= x;
+    }
+    if (desc ? descending : ascending) {
+        copy_ints(src, out, count, false);
+        return;
+    }
+    if (desc ? ascending : descending) {
+        copy_ints(src, out, count, true);
+        return;
+    }
+
+    /* keys are sorted on their unsigned distance from min (from max when
+       descending), in digits of up to RADIX_BITS covering just the bits
+       those distances use */
+    const uint64_t lo = (uint64_t)min;
+    const uint64_t hi = (uint64_t)max;
+    unsigned span = 64 - (unsigned)__builtin_clzll(hi - lo);
+    unsigned passes = (span + RADIX_BITS - 1) / RADIX_BITS;
+    unsigned bits = (span + passes - 1) / passes;
+    size_t buckets = (size_t)1 << bits;
+    uint64_t mask = buckets - 1;
+
+    uint64_t *tmp = malloc(sizeof(uint64_t) * count);
+    size_t *hist = calloc(passes * buckets, sizeof(size_t));
+    if (!tmp || !hist) {
+        runtime_error("Out of memory");
+    }
+
+    const uint64_t *keys = (const uint64_t *)src;
+    for (size_t i = 0; i < count; i++) {
+        uint64_t k = desc ? hi - keys[i] : keys[i] - lo;
+        for (unsigned p = 0; p < passes; p++) {
+            hist[p * buckets + ((k >> (p * bits)) & mask)]++;
+        }
+    }
+
+    /* ping-pong between out and tmp so the last pass lands in out; the
+       first pass reads src, which may be out itself */
+    uint64_t *bufs[2] = {(uint64_t *)out, tmp};
+    unsigned target = (passes & 1) ? 0 : 1;
+    if ((const int64_t *)out == src && (passes & 1)) {
+        target = 1;   /* cannot scatter in place; copy back at the end */
+    }
+
+    const uint64_t *from = keys;
+    for (unsigned p = 0; p < passes; p++) {
+        unsigned shift = p * bits;
+        size_t *offsets = hist + p * buckets;
+        uint64_t *to = bufs[target];
+
+        size_t sum = 0;
+        for (size_t d = 0; d < buckets; d++) {
+            size_t c = offsets[d];
+            offsets[d] = sum;
+            sum += c;
+        }
+        for (size_t i = 0; i < count; i++) {
+            uint64_t x = from[i];
+            uint64_t k = desc ? hi - x : x - lo;
+            to[offsets[(k >> shift) & mask]++] = x;
+        }
+
+        from = to;
+        target ^= 1;
+    }
+
+    if (from != (const uint64_t *)out) {
+        memcpy(out, from, sizeof(uint64_t) * count);
+    }
+
+    free(hist);
+    free(tmp);
+}
+
+/* =========================
+   Values
+   ========================= */
+
+typedef struct {
+    SortLess less;
+    void *ctx;
+} Order;
+
+static inline bool less(const Order *o, const Value *a, const Value *b) {
+    return o->less(a, b, o->ctx);
+}
+
+static inline void swap(Value *a, Value *b) {
+    Value t = *a;
+    *a = *b;
+    *b = t;
+}
+
+/* Stable. */
+static void insertion_sort(Value *begin, Value *end, const Order *o) {
+    if (begin == end) {
+        return;
+    }
+    for (Value *cur = begin + 1; cur < end; cur++) {
+        if (less(o, cur, cur - 1)) {
+            Value tmp = *cur;
+            Value *sift = cur;
+            do {
+                *sift = sift[-1];
+                sift--;
+            } while (sift != begin && less(o, &tmp, sift - 1));
+            *sift = tmp;
+        }
+    }
+}
+
+/* Insertion sort that gives up after moving a few elements; true if
+   the range ended up sorted. */
+static bool partial_insertion_sort(Value *begin, Value *end, const Order *o) {
+    size_t moved = 0;
+
+    if (begin == end) {
+        return true;
+    }
+    for (Value *cur = begin + 1; cur < end; cur++) {
+        if (less(o, cur, cur - 1)) {
+            Value tmp = *cur;
+            Value *sift = cur;
+            do {
+                *sift = sift[-1];
+                sift--;
+            } while (sift != begin && less(o, &tmp, sift - 1));
+            *sift = tmp;
+            moved += (size_t)(cur - sift);
+        }
+        if (moved > PARTIAL_INSERTION_LIMIT) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void sort2(Value *a, Value *b, const Order *o) {
+    if (less(o, b, a)) {
+        swap(a, b);
+    }
+}
+
+static void sort3(Value *a, Value *b, Value *c, const Order *o) {
+    sort2(a, b, o);
+    sort2(b, c, o);
+    sort2(a, b, o);
+}
+
+static void sift_down(Value *heap, size_t count, size_t i, const Order *o) {
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= count) {
+            return;
+        }
+        if (child + 1 < count && less(o, &heap[child], &heap[child + 1])) {
+            child++;
+        }
+        if (!less(o, &heap[i], &heap[child])) {
+            return;
+        }
+        swap(&heap[i], &heap[child]);
+        i = child;
+    }
+}
+
+static void heap_sort(Value *begin, Value *end, const Order *o) {
+    size_t count = (size_t)(end - begin);
+
+    for (size_t i = count / 2; i-- > 0;) {
+        sift_down(begin, count, i, o);
+    }
+    for (size_t n = count; n > 1; n--) {
+        swap(&begin[0], &begin[n - 1]);
+        sift_down(begin, n - 1, 0, o);
+    }
+}
+
+/* Partitions around the pivot at *begin into [< pivot] pivot [>= pivot]
+   and returns where the pivot ended up. The scans are bounded, so a
+   comparator that is not a consistent order gives a wrong order but
+   never runs off the range. */
+static Value *partition_right(Value *begin, Value *end, const Order *o, bool *already) {
+    Value pivot = *begin;
+    Value *first = begin;
+    Value *last = end;
+
+    while (++first < end && less(o, first, &pivot)) {
+    }
+    if (first - 1 == begin) {
+        while (first < last && !less(o, --last, &pivot)) {
+        }
+    } else {
+        while (--last > begin && !less(o, last, &pivot)) {
+        }
+    }
+
+    *already = first >= last;
+    while (first < last) {
+        swap(first, last);
+        while (++first < end && less(o, first, &pivot)) {
+        }
+        while (--last > begin && !less(o, last, &pivot)) {
+        }
+    }
+
+    Value *pivot_pos = first - 1;
+    *begin = *pivot_pos;
+    *pivot_pos = pivot;
+    return pivot_pos;
+}
+
+/* Partitions into [<= pivot] pivot [> pivot]; used when the pivot
+   equals the element before the range, so the left part is all equal
+   keys and needs no more sorting. */
+static Value *partition_left(Value *begin, Value *end, const Order *o) {
+    Value pivot = *begin;
+    Value *first = begin;
+    Value *last = end;
+
+    while (--last > begin && less(o, &pivot, last)) {
+    }
+    if (last + 1 == end) {
+        while (first < last && !less(o, &pivot, ++first)) {
+        }
+    } else {
+        while (++first < end && !less(o, &pivot, first)) {
+        }
+    }
+
+    while (first < last) {
+        swap(first, last);
+        while (--last > begin && less(o, &pivot, last)) {
+        }
+        while (++first < end && !less(o, &pivot, first)) {
+        }
+    }
+
+    Value *pivot_pos = last;
+    *begin = *pivot_pos;
+    *pivot_pos = pivot;
+    return pivot_pos;
+}
+
+static void pdq_sort(Value *begin, Value *end, const Order *o, int bad_allowed, bool leftmost) {
+    for (;;) {
+        size_t size = (size_t)(end - begin);
+
+        if (size < INSERTION_THRESHOLD) {
+            insertion_sort(begin, end, o);
+            return;
+        }
+
+        /* pivot to *begin: median of three, or ninther on large ranges */
+        size_t half = size / 2;
+        if (size > NINTHER_THRESHOLD) {
+            sort3(begin, begin + half, end - 1, o);
+            sort3(begin + 1, begin + (half - 1), end - 2, o);
+            sort3(begin + 2, begin + (half + 1), end - 3, o);
+            sort3(begin + (half - 1), begin + half, begin + (half + 1), o);
+            swap(begin, begin + half);
+        } else {
+            sort3(begin + half, begin, end - 1, o);
+        }
+
+        if (!leftmost && !less(o, begin - 1, begin)) {
+            begin = partition_left(begin, end, o) + 1;
+            continue;
+        }
+
+        bool already;
+        Value *pivot_pos = partition_right(begin, end, o, &already);
+        size_t l_size = (size_t)(pivot_pos - begin);
+        size_t r_size = (size_t)(end - (pivot_pos + 1));
+
+        if (l_size < size / 8 || r_size < size / 8) {
+            /* a bad split: after too many, heapsort; otherwise scramble
+               a few elements to break the pattern */
+            if (--bad_allowed == 0) {
+                heap_sort(begin, end, o);
+                return;
+            }
+            if (l_size >= INSERTION_THRESHOLD) {
+                swap(begin, begin + l_size / 4);
+                swap(pivot_pos - 1, pivot_pos - l_size / 4);
+                if (l_size > NINTHER_THRESHOLD) {
+                    swap(begin + 1, begin + (l_size / 4 + 1));
+                    swap(begin + 2, begin + (l_size / 4 + 2));
+                    swap(pivot_pos - 2, pivot_pos - (l_size / 4 + 1));
+                    swap(pivot_pos - 3, pivot_pos - (l_size / 4 + 2));
+                }
+            }
+            if (r_size >= INSERTION_THRESHOLD) {
+                swap(pivot_pos + 1, pivot_pos + (1 + r_size / 4));
+                swap(end - 1, end - r_size / 4);
+                if (r_size > NINTHER_THRESHOLD) {
+                    swap(pivot_pos + 2, pivot_pos + (2 + r_size / 4));
+                    swap(pivot_pos + 3, pivot_pos + (3 + r_size / 4));
+                    swap(end - 2, end - (1 + r_size / 4));
+                    swap(end - 3, end - (2 + r_size / 4));
+                }
+            }
+        } else if (already &&
+                   partial_insertion_sort(begin, pivot_pos, o) &&
+                   partial_insertion_sort(pivot_pos + 1, end, o)) {
+            return;   /* the input was (nearly) sorted already */
+        }
+
+        pdq_sort(begin, pivot_pos, o, bad_allowed, leftmost);
+        begin = pivot_pos + 1;
+        leftmost = false;
+    }
+}
+
+static void merge_sort(Value *items, Value *tmp, size_t count, const Order *o) {
+    if (count < INSERTION_THRESHOLD) {
+        insertion_sort(items, items + count, o);
+        return;
+    }
+
+    size_t half = count / 2;
+    merge_sort(items, tmp, half, o);
+    merge_sort(items + half, tmp, count - half, o);
+    if (!less(o, &items[half], &items[half - 1])) {
+        return;   /* already in order */
+    }
+
+    /* the left half moves out; the merge never overtakes the right */
+    memcpy(tmp, items, sizeof(Value) * half);
+    size_t i = 0;
+    size_t j = half;
+    size_t k = 0;
+    while (i < half && j < count) {
+        if (less(o, &items[j], &tmp[i])) {
+            items[k++] = items[j++];
+        } else {
+            items[k++] = tmp[i++];
+        }
+    }
+    while (i < half) {
+        items[k++] = tmp[i++];
+    }
+}
+
+void sort_values(Value *items, size_t count, SortLess less_fn, void *ctx, bool stable) {
+    Order o = {less_fn, ctx};
+
+    if (stable) {
+        Value *tmp = malloc(sizeof(Value) * (count / 2 + 1));
+        if (!tmp) {
+            runtime_error("Out of memory");
+        }
+        merge_sort(items, tmp, count, &o);
+        free(tmp);
+        return;
+    }
+
+    int bad_allowed = 1;
+    for (size_t n = count; n > 1; n >>= 1) {
+        bad_allowed++;
+    }
+    pdq_sort(items, items + count, &o, bad_allowed, true);
+}
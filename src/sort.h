@@ -0,0 +1,31 @@
+#ifndef SORT_H
+#define SORT_H
+
+#include "value.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Sorting.
+
+   Ints are sorted with an LSD radix sort. A first scan finds the range
+   of the keys (and copies input that is already sorted or reversed
+   straight through); only the bits that offsets into that range use are sorted
+   on, in digits of up to 11 bits with every histogram taken in one more
+   scan, so small or clustered values cost one to three passes.
+
+   Everything else is sorted through a less-than callback: unstable with
+   pattern-defeating quicksort (insertion sort on short ranges, ninther
+   pivots, a pass that keeps runs of equal keys from recursing, partial
+   insertion sort to finish nearly sorted input, and a heapsort fallback
+   that bounds the worst case at O(n log n)), or stable with a merge
+   sort. */
+
+typedef bool (*SortLess)(const Value *a, const Value *b, void *ctx);
+
+/* Sorts count ints from src into out, which may be src. */
+void sort_ints(const int64_t *src, int64_t *out, size_t count, bool desc);
+
+void sort_values(Value *items, size_t count, SortLess less, void *ctx, bool stable);
+
+#endif
@@ -1,6 +1,11 @@
 #include "value.h"
+#include "map.h"
+#include "bigint.h"
+#include "io.h"
+#include "memo.h"
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 
 /* ===== Constructors ===== */
 
@@ -11,28 +16,84 @@ Value value_int(int64_t x) {
     return v;
 }
 
-Value value_string(const char *s) {
-    Value v;
-    v.type = VAL_STRING;
+/* ===== String buffers ===== */
 
-    size_t len = strlen(s);
-    v.as.str_val.data = malloc(len + 1);
-    if (!v.as.str_val.data) {
+static StrBuf *strbuf_new(size_t capacity) {
+    /* Header and bytes share one allocation; +1 keeps room for a NUL. */
+    StrBuf *buf = (StrBuf *)malloc(sizeof(StrBuf) + capacity + 1);
+    if (!buf) {
         exit(1);
     }
 
-    memcpy(v.as.str_val.data, s, len + 1);
-    v.as.str_val.len = len;
+    buf->refcount = 1;
+    buf->used = 0;
+    buf->capacity = capacity;
+    buf->bytes = (char *)(buf + 1);
+    buf->bytes[0] = '\0';
+    buf->mapped = false;
+    buf->hashed_len = SIZE_MAX;
+    return buf;
+}
+
+static void strbuf_release(StrBuf *buf) {
+    if (buf && --buf->refcount == 0) {
+        if (buf->mapped) {
+            munmap(buf->bytes, buf->capacity);
+        }
+        free(buf);
+    }
+}
 
+static Value string_from_buf(StrBuf *buf, const char *data, size_t len) {
+    Value v;
+    v.type = VAL_STRING;
+    v.as.str_val.data = data;
+    v.as.str_val.len = len;
+    v.as.str_val.buf = buf;
     return v;
 }
 
+Value value_string(const char *s) {
+    return value_string_len(s, strlen(s));
+}
+
+Value value_string_len(const char *s, size_t len) {
+    StrBuf *buf = strbuf_new(len);
+
+    memcpy(buf->bytes, s, len);
+    buf->bytes[len] = '\0';
+    buf->used = len;
+
+    return string_from_buf(buf, buf->bytes, len);
+}
+
+Value value_string_alloc(size_t len) {
+    StrBuf *buf = strbuf_new(len);
+
+    buf->bytes[len] = '\0';
+    buf->used = len;
+
+    return string_from_buf(buf, buf->bytes, len);
+}
+
+static Array *array_new(void) {
+    Array *arr = (Array *)malloc(sizeof(Array));
+    if (!arr) {
+        exit(1);
+    }
+    arr->refcount = 1;
+    arr->shape = NULL;
+    return arr;
+}
+
 Value value_array(void) {
     Value v;
     v.type = VAL_ARRAY;
-    v.as.array_val.items = NULL;
-    v.as.array_val.count = 0;
-    v.as.array_val.capacity = 0;
+    v.as.array_val = array_new();
+    v.as.array_val->kind = ARRAY_VALUES;
+    v.as.array_val->items = NULL;
+    v.as.array_val->count = 0;
+    v.as.array_val->capacity = 0;
     return v;
 }
 
@@ -43,40 +104,650 @@ Value value_bool(bool b) {
     return v;
 }
 
+static size_t bool_words(size_t count) {
+    return (count + 63) / 64;
+}
+
+Value value_int_array(size_t count) {
+    Value v = value_array();
+    v.as.array_val->kind = ARRAY_INTS;
+    v.as.array_val->count = count;
+    v.as.array_val->capacity = count;
+
+    if (count > 0) {
+        v.as.array_val->ints = (int64_t *)calloc(count, sizeof(int64_t));
+        if (!v.as.array_val->ints) {
+            exit(1);
+        }
+    }
+    return v;
+}
+
+Value value_bool_array(size_t count) {
+    Value v = value_array();
+    v.as.array_val->kind = ARRAY_BOOLS;
+    v.as.array_val->count = count;
+    v.as.array_val->capacity = bool_words(count) * 64;
+
+    if (count > 0) {
+        v.as.array_val->bits =
+            (uint64_t *)calloc(bool_words(count), sizeof(uint64_t));
+        if (!v.as.array_val->bits) {
+            exit(1);
+        }
+    }
+    return v;
+}
+
+static void record_release(Record *rec);
+static void record_store(Value *row, Value rec, bool fresh);
+
+/* Takes ownership of `items` (malloc'd). All-int and all-bool arrays are
+   repacked so bulk builtins can stream over raw storage, and records of
+   a single shape are laid out inline. */
+Value value_array_from_values(Value *items, size_t count) {
+    bool all_int = count > 0;
+    bool all_bool = count > 0;
+    bool all_rec = count > 0 && items[0].type == VAL_RECORD;
+
+    for (size_t i = 0; i < count; i++) {
+        all_int = all_int && items[i].type == VAL_INT;
+        all_bool = all_bool && items[i].type == VAL_BOOL;
+        all_rec = all_rec && items[i].type == VAL_RECORD &&
+                  items[i].as.rec_val->shape == items[0].as.rec_val->shape;
+    }
+
+    Value v;
+
+    if (all_int) {
+        v = value_int_array(count);
+        for (size_t i = 0; i < count; i++) {
+            v.as.array_val->ints[i] = items[i].as.int_val;
+        }
+        free(items);
+        return v;
+    }
+
+    if (all_bool) {
+        v = value_bool_array(count);
+        for (size_t i = 0; i < count; i++) {
+            array_set_bool(v.as.array_val, i, items[i].as.bool_val);
+        }
+        free(items);
+        return v;
+    }
+
+    if (all_rec) {
+        const Shape *shape = items[0].as.rec_val->shape;
+        size_t nf = shape->field_count;
+
+        v = value_array();
+        v.as.array_val->kind = ARRAY_RECORDS;
+        v.as.array_val->shape = shape;
+        v.as.array_val->items =
+            (Value *)malloc(sizeof(Value) * (nf > 0 ? count * nf : 1));
+        if (!v.as.array_val->items) {
+            exit(1);
+        }
+        for (size_t i = 0; i < count; i++) {
+            record_store(v.as.array_val->items + i * nf, items[i], true);
+        }
+        v.as.array_val->count = count;
+        v.as.array_val->capacity = count;
+        free(items);
+        return v;
+    }
+
+    v = value_array();
+    v.as.array_val->items = items;
+    v.as.array_val->count = count;
+    v.as.array_val->capacity = count;
+    return v;
+}
+
+Value value_record(const Shape *shape) {
+    Record *rec = (Record *)malloc(sizeof(Record) +
+                                   sizeof(Value) * shape->field_count);
+    if (!rec) {
+        exit(1);
+    }
+
+    rec->refcount = 1;
+    rec->shape = shape;
+    for (size_t i = 0; i < shape->field_count; i++) {
+        rec->slots[i] = value_int(0);
+    }
+
+    Value v;
+    v.type = VAL_RECORD;
+    v.as.rec_val = rec;
+    return v;
+}
+
+Shape *shape_new(const char *name, char **fields, size_t field_count) {
+    Shape *shape = (Shape *)malloc(sizeof(Shape));
+    char **copy = (char **)malloc(sizeof(char *) * (field_count ? field_count : 1));
+    if (!shape || !copy) {
+        exit(1);
+    }
+
+    for (size_t i = 0; i < field_count; i++) {
+        copy[i] = strdup(fields[i]);
+    }
+
+    shape->name = strdup(name);
+    shape->fields = copy;
+    shape->field_count = field_count;
+    return shape;
+}
+
+long shape_find_field(const Shape *shape, const char *field) {
+    for (size_t i = 0; i < shape->field_count; i++) {
+        if (strcmp(shape->fields[i], field) == 0) {
+            return (long)i;
+        }
+    }
+    return -1;
+}
+
+static void record_release(Record *rec) {
+    if (--rec->refcount > 0) {
+        return;
+    }
+    for (size_t i = 0; i < rec->shape->field_count; i++) {
+        value_free(rec->slots[i]);
+    }
+    free(rec);
+}
+
+/* Moves the fields of an owned record into an inline row. When `fresh`
+   the row holds no values yet; otherwise the old ones are released. */
+static void record_store(Value *row, Value v, bool fresh) {
+    Record *rec = v.as.rec_val;
+    size_t nf = rec->shape->field_count;
+
+    for (size_t i = 0; i < nf; i++) {
+        if (!fresh) {
+            value_free(row[i]);
+        }
+        row[i] = rec->refcount == 1 ? rec->slots[i]
+                                    : value_clone(rec->slots[i]);
+    }
+
+    if (rec->refcount == 1) {
+        free(rec);   /* slots were moved out */
+    } else {
+        rec->refcount--;
+    }
+}
+
+Value value_map(void) {
+    Value v;
+    v.type = VAL_MAP;
+    v.as.map_val = map_new();
+    return v;
+}
+
+/* ===== Strings ===== */
+
+/* Appends (data, len) to `left`, consuming it.
+   When `left` is the tail of its buffer and the buffer has room, the bytes
+   are written in place and the result keeps sharing the buffer. Otherwise
+   a new buffer with geometric headroom is allocated, so a chain of
+   `s = s + piece` costs amortized O(len(piece)) per step. */
+Value value_string_append(Value left, const char *data, size_t len) {
+    String *l = &left.as.str_val;
+    StrBuf *buf = l->buf;
+
+    if (len == 0) {
+        return left;
+    }
+
+    if (l->data + l->len == buf->bytes + buf->used &&
+        buf->capacity - buf->used >= len) {
+        memcpy(buf->bytes + buf->used, data, len);
+        buf->used += len;
+        buf->bytes[buf->used] = '\0';
+        l->len += len;
+        return left;
+    }
+
+    size_t total = l->len + len;
+    size_t capacity = total < 32 ? 64 : total * 2;
+    StrBuf *grown = strbuf_new(capacity);
+
+    memcpy(grown->bytes, l->data, l->len);
+    memcpy(grown->bytes + l->len, data, len);
+    grown->used = total;
+    grown->bytes[total] = '\0';
+
+    strbuf_release(buf);
+    return string_from_buf(grown, grown->bytes, total);
+}
+
+/* A zero-copy window [offset, offset + len) of `parent`, which stays
+   alive through the shared buffer. Bounds are the caller's job. */
+Value value_string_view(Value parent, size_t offset, size_t len) {
+    StrBuf *buf = parent.as.str_val.buf;
+    buf->refcount++;
+    return string_from_buf(buf, parent.as.str_val.data + offset, len);
+}
+
+/* A string over a whole read-only mapping of `len` bytes. Views taken
+   from it keep the mapping alive; the last one to go unmaps it. The
+   buffer is full (used == capacity), so appends always copy out. */
+Value value_string_mapped(void *addr, size_t len) {
+    StrBuf *buf = (StrBuf *)malloc(sizeof(StrBuf));
+    if (!buf) {
+        exit(1);
+    }
+
+    buf->refcount = 1;
+    buf->used = len;
+    buf->capacity = len;
+    buf->bytes = (char *)addr;
+    buf->mapped = true;
+    buf->hashed_len = SIZE_MAX;
+    return string_from_buf(buf, buf->bytes, len);
+}
+
+/* Returns a malloc'd NUL-terminated copy, for C APIs such as fopen. */
+char *string_to_cstr(const String *s) {
+    char *out = (char *)malloc(s->len + 1);
+    if (!out) {
+        exit(1);
+    }
+    memcpy(out, s->data, s->len);
+    out[s->len] = '\0';
+    return out;
+}
+
+/* ===== Arrays ===== */
+
+/* Returns an owned element; packed kinds are boxed on the way out. */
+Value array_get(const Array *arr, size_t i) {
+    switch (arr->kind) {
+        case ARRAY_INTS:
+            return value_int(arr->ints[i]);
+        case ARRAY_BOOLS:
+            return value_bool(array_get_bool(arr, i));
+        case ARRAY_RECORDS: {
+            size_t nf = arr->shape->field_count;
+            Value rec = value_record(arr->shape);
+            for (size_t f = 0; f < nf; f++) {
+                rec.as.rec_val->slots[f] = value_clone(arr->items[i * nf + f]);
+            }
+            return rec;
+        }
+        case ARRAY_VALUES:
+        default:
+            return value_clone(arr->items[i]);
+    }
+}
+
+bool array_get_bool(const Array *arr, size_t i) {
+    return (arr->bits[i / 64] >> (i % 64)) & 1;
+}
+
+void array_set_bool(Array *arr, size_t i, bool b) {
+    uint64_t mask = (uint64_t)1 << (i % 64);
+    if (b) {
+        arr->bits[i / 64] |= mask;
+    } else {
+        arr->bits[i / 64] &= ~mask;
+    }
+}
+
+bool value_equal(Value a, Value b) {
+    if (a.type != b.type) {
+        return false;
+    }
+
+    switch (a.type) {
+        case VAL_INT:
+            return a.as.int_val == b.as.int_val;
+        case VAL_BOOL:
+            return a.as.bool_val == b.as.bool_val;
+        case VAL_STRING:
+        case VAL_BYTES:
+            return a.as.str_val.len == b.as.str_val.len &&
+                   memcmp(a.as.str_val.data, b.as.str_val.data,
+                          a.as.str_val.len) == 0;
+        case VAL_BUILTIN:
+            return a.as.builtin_val == b.as.builtin_val;
+        case VAL_MAP: {
+            const Map *x = a.as.map_val;
+            const Map *y = b.as.map_val;
+
+            if (x->count != y->count) {
+                return false;
+            }
+            for (size_t i = 0; i < x->used; i++) {
+                const MapEntry *e = &x->entries[i];
+                if (e->deleted) {
+                    continue;
+                }
+                Value *other = map_find(y, e->key);
+                if (!other || !value_equal(e->value, *other)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        case VAL_RECORD: {
+            const Record *x = a.as.rec_val;
+            const Record *y = b.as.rec_val;
+
+            if (x->shape != y->shape) {
+                return false;
+            }
+            for (size_t i = 0; i < x->shape->field_count; i++) {
+                if (!value_equal(x->slots[i], y->slots[i])) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        case VAL_SHAPE:
+            return a.as.shape_val == b.as.shape_val;
+        case VAL_BIGINT:
+            return bigint_cmp(a, b) == 0;
+        case VAL_HANDLE:
+            return a.as.handle_val == b.as.handle_val;
+        case VAL_ARRAY: {
+            const Array *x = a.as.array_val;
+            const Array *y = b.as.array_val;
+
+            if (x->count != y->count) {
+                return false;
+            }
+            if (x->kind == ARRAY_INTS && y->kind == ARRAY_INTS) {
+                return x->count == 0 ||
+                       memcmp(x->ints, y->ints,
+                              x->count * sizeof(int64_t)) == 0;
+            }
+            for (size_t i = 0; i < x->count; i++) {
+                Value xi = array_get(x, i);
+                Value yi = array_get(y, i);
+                bool eq = value_equal(xi, yi);
+                value_free(xi);
+                value_free(yi);
+                if (!eq) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
 /* ===== Internal helpers ===== */
 
-static void array_free(Array *arr) {
-    for (size_t i = 0; i < arr->count; i++) {
-        value_free(arr->items[i]);
+static void array_release(Array *arr) {
+    if (--arr->refcount > 0) {
+        return;
+    }
+
+    if (arr->kind == ARRAY_VALUES || arr->kind == ARRAY_RECORDS) {
+        size_t n = arr->count *
+                   (arr->kind == ARRAY_RECORDS ? arr->shape->field_count : 1);
+        for (size_t i = 0; i < n; i++) {
+            value_free(arr->items[i]);
+        }
     }
+    /* items/ints/bits alias the same pointer */
     free(arr->items);
-    arr->items = NULL;
-    arr->count = 0;
-    arr->capacity = 0;
+    free(arr);
 }
 
-static Array array_clone(const Array *src) {
-    Array dst;
-    dst.count = src->count;
-    dst.capacity = src->count;
-    dst.items = NULL;
+static Array *array_copy(const Array *src) {
+    Array *dst = array_new();
+    dst->kind = src->kind;
+    dst->shape = src->shape;
+    dst->count = src->count;
+    dst->capacity = src->count;
+    dst->items = NULL;
 
     if (src->count == 0) {
         return dst;
     }
 
-    dst.items = (Value *)malloc(sizeof(Value) * src->count);
-    if (!dst.items) {
+    if (src->kind == ARRAY_INTS) {
+        dst->ints = (int64_t *)malloc(sizeof(int64_t) * src->count);
+        if (!dst->ints) {
+            exit(1);
+        }
+        memcpy(dst->ints, src->ints, sizeof(int64_t) * src->count);
+        return dst;
+    }
+
+    if (src->kind == ARRAY_BOOLS) {
+        size_t words = bool_words(src->count);
+        dst->capacity = words * 64;
+        dst->bits = (uint64_t *)malloc(sizeof(uint64_t) * words);
+        if (!dst->bits) {
+            exit(1);
+        }
+        memcpy(dst->bits, src->bits, sizeof(uint64_t) * words);
+        return dst;
+    }
+
+    size_t n = src->count *
+               (src->kind == ARRAY_RECORDS ? src->shape->field_count : 1);
+    dst->items = (Value *)malloc(sizeof(Value) * (n ? n : 1));
+    if (!dst->items) {
         exit(1);
     }
 
-    for (size_t i = 0; i < src->count; i++) {
-        dst.items[i] = value_clone(src->items[i]);
+    for (size_t i = 0; i < n; i++) {
+        dst->items[i] = value_clone(src->items[i]);
     }
 
     return dst;
 }
 
+/* Boxes packed storage back into a Value array, in place. Used when an
+   element of another type is stored into a packed array. */
+static void array_unpack(Array *arr) {
+    if (arr->kind == ARRAY_VALUES) {
+        return;
+    }
+
+    size_t capacity = arr->count < 8 ? 8 : arr->count;
+    Value *items = (Value *)malloc(sizeof(Value) * capacity);
+    if (!items) {
+        exit(1);
+    }
+
+    for (size_t i = 0; i < arr->count; i++) {
+        items[i] = array_get(arr, i);
+    }
+
+    if (arr->kind == ARRAY_RECORDS) {
+        size_t n = arr->count * arr->shape->field_count;
+        for (size_t i = 0; i < n; i++) {
+            value_free(arr->items[i]);
+        }
+    }
+    free(arr->items);
+    arr->kind = ARRAY_VALUES;
+    arr->items = items;
+    arr->capacity = capacity;
+}
+
+static int packs_into(const Array *arr, Value v) {
+    return (arr->kind == ARRAY_INTS && v.type == VAL_INT) ||
+           (arr->kind == ARRAY_BOOLS && v.type == VAL_BOOL) ||
+           (arr->kind == ARRAY_RECORDS && v.type == VAL_RECORD &&
+            v.as.rec_val->shape == arr->shape);
+}
+
+/* ===== Array mutation ===== */
+
+void array_make_unique(Value *slot) {
+    Array *arr = slot->as.array_val;
+    if (arr->refcount > 1) {
+        slot->as.array_val = array_copy(arr);
+        arr->refcount--;
+    }
+}
+
+/* Copy-on-write for any mutable container held in *slot. */
+void value_make_unique(Value *slot) {
+    if (slot->type == VAL_ARRAY) {
+        array_make_unique(slot);
+    } else if (slot->type == VAL_MAP && slot->as.map_val->refcount > 1) {
+        Map *shared = slot->as.map_val;
+        slot->as.map_val = map_copy(shared);
+        shared->refcount--;
+    } else if (slot->type == VAL_RECORD && slot->as.rec_val->refcount > 1) {
+        Record *shared = slot->as.rec_val;
+        Value copy = value_record(shared->shape);
+        for (size_t i = 0; i < shared->shape->field_count; i++) {
+            copy.as.rec_val->slots[i] = value_clone(shared->slots[i]);
+        }
+        slot->as.rec_val = copy.as.rec_val;
+        shared->refcount--;
+    }
+}
+
+void array_reserve(Array *arr, size_t capacity) {
+    if (capacity <= arr->capacity) {
+        return;
+    }
+
+    size_t bytes;
+
+    switch (arr->kind) {
+        case ARRAY_INTS:
+            bytes = sizeof(int64_t) * capacity;
+            break;
+        case ARRAY_BOOLS:
+            capacity = bool_words(capacity) * 64;
+            bytes = sizeof(uint64_t) * bool_words(capacity);
+            break;
+        case ARRAY_RECORDS:
+            bytes = sizeof(Value) * capacity * arr->shape->field_count;
+            if (bytes == 0) {
+                bytes = sizeof(Value);
+            }
+            break;
+        case ARRAY_VALUES:
+        default:
+            bytes = sizeof(Value) * capacity;
+            break;
+    }
+
+    void *grown = realloc(arr->items, bytes);
+    if (!grown) {
+        exit(1);
+    }
+
+    arr->items = (Value *)grown;
+    if (arr->kind == ARRAY_BOOLS) {
+        /* new words must start cleared so set bits only come from pushes */
+        size_t old_words = bool_words(arr->capacity);
+        memset(arr->bits + old_words, 0,
+               sizeof(uint64_t) * (bool_words(capacity) - old_words));
+    }
+    arr->capacity = capacity;
+}
+
+void array_set(Array *arr, size_t i, Value v) {
+    if (arr->kind != ARRAY_VALUES && !packs_into(arr, v)) {
+        array_unpack(arr);
+    }
+
+    switch (arr->kind) {
+        case ARRAY_INTS:
+            arr->ints[i] = v.as.int_val;
+            break;
+        case ARRAY_BOOLS:
+            array_set_bool(arr, i, v.as.bool_val);
+            break;
+        case ARRAY_RECORDS:
+            record_store(arr->items + i * arr->shape->field_count, v, false);
+            break;
+        case ARRAY_VALUES:
+        default:
+            value_free(arr->items[i]);
+            arr->items[i] = v;
+            break;
+    }
+}
+
+void array_push(Array *arr, Value v) {
+    /* An empty array takes the packed layout of its first element. */
+    if (arr->count == 0 && arr->kind == ARRAY_VALUES &&
+        (v.type == VAL_INT || v.type == VAL_BOOL || v.type == VAL_RECORD)) {
+        free(arr->items);
+        arr->items = NULL;
+        arr->capacity = 0;
+        arr->kind = v.type == VAL_INT    ? ARRAY_INTS
+                    : v.type == VAL_BOOL ? ARRAY_BOOLS
+                                         : ARRAY_RECORDS;
+        if (v.type == VAL_RECORD) {
+            arr->shape = v.as.rec_val->shape;
+        }
+    }
+
+    if (arr->kind != ARRAY_VALUES && !packs_into(arr, v)) {
+        array_unpack(arr);
+    }
+
+    if (arr->count == arr->capacity) {
+        array_reserve(arr, arr->capacity < 8 ? 8 : arr->capacity * 2);
+    }
+
+    switch (arr->kind) {
+        case ARRAY_INTS:
+            arr->ints[arr->count] = v.as.int_val;
+            break;
+        case ARRAY_BOOLS:
+            array_set_bool(arr, arr->count, v.as.bool_val);
+            break;
+        case ARRAY_RECORDS:
+            record_store(arr->items + arr->count * arr->shape->field_count,
+                         v, true);
+            break;
+        case ARRAY_VALUES:
+        default:
+            arr->items[arr->count] = v;
+            break;
+    }
+    arr->count++;
+}
+
+Value array_pop(Array *arr) {
+    Value last;
+
+    switch (arr->kind) {
+        case ARRAY_INTS:
+            last = value_int(arr->ints[arr->count - 1]);
+            break;
+        case ARRAY_BOOLS:
+            last = value_bool(array_get_bool(arr, arr->count - 1));
+            array_set_bool(arr, arr->count - 1, false);
+            break;
+        case ARRAY_RECORDS: {
+            size_t nf = arr->shape->field_count;
+            Value *row = arr->items + (arr->count - 1) * nf;
+            last = value_record(arr->shape);
+            memcpy(last.as.rec_val->slots, row, sizeof(Value) * nf);
+            break;
+        }
+        case ARRAY_VALUES:
+        default:
+            last = arr->items[arr->count - 1];
+            break;
+    }
+
+    arr->count--;
+    return last;
+}
+
 /* ===== Memory management ===== */
 
 Value value_clone(Value v) {
@@ -96,18 +767,42 @@ Value value_clone(Value v) {
             out.as.builtin_val = v.as.builtin_val;
             break;
 
-        case VAL_STRING: {
-            size_t len = v.as.str_val.len;
-            out.as.str_val.data = (char *)malloc(len + 1);
-            if (!out.as.str_val.data) {
-                exit(1);
-            }
-            memcpy(out.as.str_val.data, v.as.str_val.data, len + 1);
-            out.as.str_val.len = len;
-        } break;
+        case VAL_STRING:
+        case VAL_BYTES:
+            /* Strings are immutable: share the buffer. */
+            out.as.str_val = v.as.str_val;
+            out.as.str_val.buf->refcount++;
+            break;
 
         case VAL_ARRAY:
-            out.as.array_val = array_clone(&v.as.array_val);
+            /* Copy-on-write: share until someone mutates. */
+            out.as.array_val = v.as.array_val;
+            out.as.array_val->refcount++;
+            break;
+
+        case VAL_MAP:
+            out.as.map_val = v.as.map_val;
+            out.as.map_val->refcount++;
+            break;
+
+        case VAL_RECORD:
+            out.as.rec_val = v.as.rec_val;
+            out.as.rec_val->refcount++;
+            break;
+
+        case VAL_SHAPE:
+            /* Shapes are never freed. */
+            out.as.shape_val = v.as.shape_val;
+            break;
+
+        case VAL_BIGINT:
+            out.as.big_val = v.as.big_val;
+            out.as.big_val->refcount++;
+            break;
+
+        case VAL_HANDLE:
+            out.as.handle_val = v.as.handle_val;
+            out.as.handle_val->refcount++;
             break;
 
         case VAL_FUNCTION: {
@@ -124,6 +819,10 @@ Value value_clone(Value v) {
             fn->body = src->body;
             fn->body_count = src->body_count;
             fn->closure = src->closure;
+            fn->memo = src->memo;
+            if (fn->memo) {
+                memo_retain(fn->memo);
+            }
 
             out.as.fn_val = fn;
         } break;
@@ -139,14 +838,34 @@ Value value_clone(Value v) {
 void value_free(Value v) {
     switch (v.type) {
         case VAL_STRING:
-            free(v.as.str_val.data);
+        case VAL_BYTES:
+            strbuf_release(v.as.str_val.buf);
             break;
 
         case VAL_ARRAY:
-            array_free(&v.as.array_val);
+            array_release(v.as.array_val);
+            break;
+
+        case VAL_MAP:
+            map_release(v.as.map_val);
+            break;
+
+        case VAL_RECORD:
+            record_release(v.as.rec_val);
+            break;
+
+        case VAL_BIGINT:
+            if (--v.as.big_val->refcount == 0) {
+                free(v.as.big_val);
+            }
+            break;
+
+        case VAL_HANDLE:
+            handle_release(v.as.handle_val);
             break;
 
         case VAL_FUNCTION:
+            memo_release(v.as.fn_val->memo);
             free(v.as.fn_val);
             break;
 
@@ -11,40 +11,118 @@ typedef enum {
     VAL_ARRAY,
     VAL_FUNCTION,
     VAL_BUILTIN,
-    VAL_BOOL
+    VAL_BOOL,
+    VAL_MAP,
+    VAL_RECORD,
+    VAL_SHAPE,
+    VAL_BIGINT,
+    VAL_HANDLE,
+    VAL_BYTES
 } ValueType;
 
 typedef struct Value Value;
 typedef struct Function Function;
+typedef struct Map Map;   /* see map.h */
+typedef struct Record Record;
+typedef struct BigInt BigInt; /* see bigint.h */
+typedef struct Handle Handle; /* see io.h */
+typedef struct Memo Memo;     /* see memo.h */
 
 typedef struct Stmt Stmt;
 typedef struct Env Env;
 
 typedef Value (*BuiltinFn)(Value *args, size_t argc);
 
+/* Shared, refcounted byte storage behind string values.
+   Strings never write into bytes another string can see: an append only
+   lands in place when the left operand ends exactly at `used`, so older
+   values keep seeing their own (shorter) prefix. */
+typedef struct StrBuf {
+    size_t refcount;
+    size_t used;
+    size_t capacity;
+    char *bytes;
+    bool mapped;   /* bytes is a read-only file mapping, munmap'd on release */
+
+    /* hash of bytes[0, hashed_len), filled in by map lookups */
+    size_t hashed_len;
+    uint64_t hash;
+} StrBuf;
+
+/* A string is a (data, len) window into a StrBuf. Data is NOT guaranteed
+   to be NUL-terminated; always go through len.
+
+   Bytes values (VAL_BYTES) use the same representation and storage, so
+   converting between the two is a retag; they differ in what indexing
+   returns (ints rather than one-byte strings) and how they print. */
 typedef struct {
-    char *data;
+    const char *data;
     size_t len;
+    StrBuf *buf;
 } String;
 
+/* A declared record type: `record Point(x, y)`. Field i of every
+   Point lives in slot i. Shapes are created once per declaration and
+   never freed, so they can be compared (and cached) by address. */
+typedef struct Shape {
+    char *name;
+    char **fields;
+    size_t field_count;
+} Shape;
+
+/* Arrays built from homogeneous ints or bools are stored packed:
+   ARRAY_INTS keeps raw int64_t, ARRAY_BOOLS keeps one bit per element
+   (bit i of word i / 64). ARRAY_RECORDS stores records of one shape
+   inline: element i's fields are items[i * field_count ...]. Everything
+   else is a plain Value array.
+
+   Arrays are refcounted and copy-on-write: cloning shares the Array, and
+   mutation goes through array_make_unique() first, so a uniquely owned
+   array is changed in place. */
+typedef enum {
+    ARRAY_VALUES,
+    ARRAY_INTS,
+    ARRAY_BOOLS,
+    ARRAY_RECORDS
+} ArrayKind;
+
 typedef struct {
-    Value *items;
+    size_t refcount;
+    ArrayKind kind;
+    union {
+        Value *items;
+        int64_t *ints;
+        uint64_t *bits;
+    };
     size_t count;
     size_t capacity;
+    const Shape *shape;   /* ARRAY_RECORDS only */
 } Array;
 
 struct Value {
     ValueType type;
     union {
         int64_t int_val;
-        String str_val;
-        Array array_val;
+        String str_val;     /* VAL_STRING and VAL_BYTES */
+        Array *array_val;
         Function *fn_val;
         BuiltinFn builtin_val;
         bool bool_val;
+        Map *map_val;
+        Record *rec_val;
+        const Shape *shape_val;
+        BigInt *big_val;
+        Handle *handle_val;
     } as;
 };
 
+/* Records are refcounted and copy-on-write like arrays. */
+struct Record {
+    size_t refcount;
+    const Shape *shape;
+    Value slots[];
+};
+
 typedef struct Function {
     char **params;
     size_t param_count;
@@ -53,16 +131,54 @@ typedef struct Function {
     size_t body_count;
 
     Env *closure;  // entorno donde se definió
+
+    Memo *memo;    /* result table from memo(), shared by copies; or NULL */
 } Function;
 
 /* Constructors */
 Value value_int(int64_t x);
 Value value_string(const char *s);
+Value value_string_len(const char *s, size_t len);
+/* A string of len uninitialized bytes, to be filled in through
+   buf->bytes before anyone else sees it. */
+Value value_string_alloc(size_t len);
 Value value_array(void);
 Value value_bool(bool b);
+Value value_int_array(size_t count);
+Value value_bool_array(size_t count);
+Value value_array_from_values(Value *items, size_t count);
+Value value_map(void);
+Value value_record(const Shape *shape);   /* slots start as int 0 */
 
 /* Memory management */
 Value value_clone(Value v);
 void value_free(Value v);
+void value_make_unique(Value *slot);
+
+/* Strings */
+Value value_string_append(Value left, const char *data, size_t len);
+Value value_string_view(Value parent, size_t offset, size_t len);
+Value value_string_mapped(void *addr, size_t len);   /* takes the mapping */
+char *string_to_cstr(const String *s);
+
+/* Arrays */
+Value array_get(const Array *arr, size_t i);
+bool  array_get_bool(const Array *arr, size_t i);
+void  array_set_bool(Array *arr, size_t i, bool b);
+void  array_make_unique(Value *slot);
+
+/* Mutators: callers make the array unique first. set/push take
+   ownership of the value; pop returns an owned value. */
+void  array_set(Array *arr, size_t i, Value v);
+void  array_push(Array *arr, Value v);
+Value array_pop(Array *arr);
+void  array_reserve(Array *arr, size_t capacity);
+
+/* Records */
+Shape *shape_new(const char *name, char **fields, size_t field_count);
+long   shape_find_field(const Shape *shape, const char *field);
+
+/* Equality of scalars, strings and containers (by content). */
+bool value_equal(Value a, Value b);
 
 #endif
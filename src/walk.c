@@ -0,0 +1,198 @@
+#include "walk.h"
+#include "batch.h"
+#include "error.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define DENTS_BUF_SIZE (1 << 16)
+
+/* getdents64 record; glibc only wraps it from 2.30 on */
+struct dirent64_raw {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+typedef struct {
+    char **items;
+    size_t count;
+    size_t cap;
+} PathList;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    PathList dirs;    /* still to be listed */
+    PathList files;
+    size_t busy;      /* workers listing a directory right now */
+    const char *pattern;
+} Walk;
+
+static void list_push(PathList *list, char *path) {
+    if (list->count == list->cap) {
+        list->cap = list->cap ? list->cap * 2 : 64;
+        list->items = (char **)realloc(list->items, sizeof(char *) * list->cap);
+        if (!list->items) {
+            runtime_error("Out of memory");
+        }
+    }
+    list->items[list->count++] = path;
+}
+
+/* Moves every path of src to the end of dst. */
+static void list_take(PathList *dst, PathList *src) {
+    for (size_t i = 0; i < src->count; i++) {
+        list_push(dst, src->items[i]);
+    }
+    src->count = 0;
+}
+
+static char *join_path(const char *dir, size_t dir_len, const char *name) {
+    size_t name_len = strlen(name);
+    bool slash = dir_len > 0 && dir[dir_len - 1] != '/';
+    char *path = (char *)malloc(dir_len + slash + name_len + 1);
+    if (!path) {
+        runtime_error("Out of memory");
+    }
+
+    memcpy(path, dir, dir_len);
+    if (slash) {
+        path[dir_len] = '/';
+    }
+    memcpy(path + dir_len + slash, name, name_len + 1);
+    return path;
+}
+
+/* Lists one directory into dirs and files. */
+static void scan_dir(Walk *w, const char *dir, char *buf,
+                     PathList *dirs, PathList *files) {
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+
+    size_t dir_len = strlen(dir);
+    long n;
+
+    while ((n = syscall(SYS_getdents64, fd, buf, DENTS_BUF_SIZE)) > 0) {
+        for (long off = 0; off < n;) {
+            struct dirent64_raw *d = (struct dirent64_raw *)(buf + off);
+            const char *name = d->d_name;
+            unsigned char type = d->d_type;
+
+            off += d->d_reclen;
+
+            if (name[0] == '.' &&
+                (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                continue;
+            }
+
+            if (type == DT_UNKNOWN) {
+                /* some filesystems leave the type to a stat */
+                struct stat st;
+                if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+                    continue;
+                }
+                type = S_ISDIR(st.st_mode) ? DT_DIR :
+                       S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+            }
+
+            if (type == DT_DIR) {
+                list_push(dirs, join_path(dir, dir_len, name));
+            } else if (type == DT_REG &&
+                       (w->pattern[0] == '\0' || fnmatch(w->pattern, name, 0) == 0)) {
+                list_push(files, join_path(dir, dir_len, name));
+            }
+        }
+    }
+
+    close(fd);
+}
+
+static void walk_worker(void *ctx, size_t thread) {
+    Walk *w = (Walk *)ctx;
+    PathList dirs = {0};
+    PathList files = {0};
+    char *buf = (char *)malloc(DENTS_BUF_SIZE);
+    if (!buf) {
+        runtime_error("Out of memory");
+    }
+
+    (void)thread;
+
+    pthread_mutex_lock(&w->lock);
+    for (;;) {
+        while (w->dirs.count == 0 && w->busy > 0) {
+            pthread_cond_wait(&w->changed, &w->lock);
+        }
+        if (w->dirs.count == 0) {
+            /* nothing queued and nobody left to queue more */
+            pthread_cond_broadcast(&w->changed);
+            break;
+        }
+
+        char *dir = w->dirs.items[--w->dirs.count];
+        w->busy++;
+        pthread_mutex_unlock(&w->lock);
+
+        scan_dir(w, dir, buf, &dirs, &files);
+        free(dir);
+
+        pthread_mutex_lock(&w->lock);
+        w->busy--;
+        list_take(&w->dirs, &dirs);
+        list_take(&w->files, &files);
+        pthread_cond_broadcast(&w->changed);
+    }
+    pthread_mutex_unlock(&w->lock);
+
+    free(buf);
+    free(dirs.items);
+    free(files.items);
+}
+
+static int compare_paths(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+bool walk_tree(const char *root, const char *pattern, WalkResult *out) {
+    struct stat st;
+    if (stat(root, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        return false;
+    }
+
+    Walk w;
+    pthread_mutex_init(&w.lock, NULL);
+    pthread_cond_init(&w.changed, NULL);
+    w.dirs = (PathList){0};
+    w.files = (PathList){0};
+    w.busy = 0;
+    w.pattern = pattern;
+
+    char *start = strdup(root);
+    if (!start) {
+        runtime_error("Out of memory");
+    }
+    list_push(&w.dirs, start);
+
+    batch_parallel(batch_threads(), walk_worker, &w);
+
+    pthread_cond_destroy(&w.changed);
+    pthread_mutex_destroy(&w.lock);
+    free(w.dirs.items);
+
+    qsort(w.files.items, w.files.count, sizeof(char *), compare_paths);
+    out->paths = w.files.items;
+    out->count = w.files.count;
+    return true;
+}
@@ -0,0 +1,24 @@
+#ifndef WALK_H
+#define WALK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Recursive directory listing.
+
+   Directories go on a shared stack that the batch thread pool drains:
+   each worker lists one directory with getdents64 into a large buffer,
+   pushes the subdirectories it finds and keeps the regular files whose
+   name matches the fnmatch(3) pattern ("" matches everything). Symbolic
+   links are not followed. Unreadable subdirectories are skipped. The
+   result is sorted so the order does not depend on thread timing. */
+
+typedef struct {
+    char **paths;   /* malloc'd, as is each path */
+    size_t count;
+} WalkResult;
+
+/* False when root itself cannot be opened as a directory. */
+bool walk_tree(const char *root, const char *pattern, WalkResult *out);
+
+#endif